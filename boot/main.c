@@ -8,6 +8,7 @@
  */
 #include <inc/x86.h>
 #include <inc/elf.h>
+#include <inc/boot.h>
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
@@ -35,18 +36,27 @@
  *    and a stack so C code then run, then calls bootmain()
  *
  *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *
+ *  * bootmain() leaves timestamps at BOOTINFO (see inc/boot.h)
+ *    for the kernel to report how long loading took.
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MAXSECTS	255		// most sectors we ask for in one command
 #define ELFHDR		((elfhdr *) 0x10000) // scratch space
 
-void readsect(void*, uint32_t);
-void readseg(uint32_t, uint32_t, uint32_t);
+static void waitdisk(void);
+static void readcmd(uint32_t, uint32_t);
+static void readseg(uint32_t, uint32_t, uint32_t);
 
 void
 bootmain(void)
 {
+	bootinfo *bi = BOOTINFO;
 	proghdr *ph, *eph;
+	uint32_t va = 0, end = 0, offset = 1;	// a layout no segment has
+
+	bi->tsc_start = rdtsc();
 
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
@@ -55,14 +65,25 @@ bootmain(void)
 	if (ELFHDR->e_magic != ELF_MAGIC)
 		goto bad;
 
-	// load each program segment (ignores ph flags)
+	// load each program segment's file contents (ignores ph flags),
+	// reading successive segments in one go if the file lays them out
+	// just as they go in memory, as it usually does;
+	// the kernel clears its own BSS
 	ph = (proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
 	eph = ph + ELFHDR->e_phnum;
-	for (; ph < eph; ph++)
-		readseg(ph->p_va, ph->p_memsz, ph->p_offset);
+	for (; ph < eph; ph++) {
+		if (ph->p_va - ph->p_offset != va - offset) {
+			readseg(va, end - va, offset);
+			va = ph->p_va;
+			offset = ph->p_offset;
+		}
+		end = ph->p_va + ph->p_filesz;
+	}
+	readseg(va, end - va, offset);
 
 	// call the entry point from the ELF header
 	// note: does not return!
+	bi->tsc_loaded = rdtsc();
 	((void (*)(void)) (ELFHDR->e_entry & 0xFFFFFF))();
 
 bad:
@@ -74,10 +95,10 @@ bad:
 
 // Read 'count' bytes at 'offset' from kernel into virtual address 'va'.
 // Might copy more than asked
-void
+static void
 readseg(uint32_t va, uint32_t count, uint32_t offset)
 {
-	uint32_t end_va;
+	uint32_t end_va, n = 0;
 
 	va &= 0xFFFFFF;
 	end_va = va + count;
@@ -88,17 +109,24 @@ readseg(uint32_t va, uint32_t count, uint32_t offset)
 	// translate from bytes to sectors, and kernel starts at sector 1
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
-	// we load in increasing order.
-	while (va < end_va) {
-		readsect((uint8_t*) va, offset);
-		va += SECTSIZE;
-		offset++;
+	// Ask the disk for as many sectors at a time as we can, then read
+	// each one as it gets it ready.  We might write more to memory than
+	// asked, but it doesn't matter -- we load in increasing order.
+	// We must read every sector we ask for, though: one left unread
+	// keeps the drive from taking its next command.
+	for (; va < end_va; va += SECTSIZE, offset++, n--) {
+		if (n == 0) {
+			n = (end_va - va - 1) / SECTSIZE + 1;
+			if (n > MAXSECTS)
+				n = MAXSECTS;
+			readcmd(offset, n);
+		}
+		waitdisk();
+		insl(0x1F0, (uint8_t*) va, SECTSIZE/4);
 	}
 }
 
-void
+static void
 waitdisk(void)
 {
 	// wait for disk reaady
@@ -106,23 +134,27 @@ waitdisk(void)
 		/* do nothing */;
 }
 
-void
-readsect(void *dst, uint32_t offset)
+// Write the bytes of 'w', low-order first, to the count and LBA registers.
+// (Not inlined, nor its loop unrolled, to fit in the boot sector.)
+static void gcc_noinline
+outregs(uint32_t w)
 {
-	// wait for disk to be ready
-	waitdisk();
-
-	outb(0x1F2, 1);		// count = 1
-	outb(0x1F3, offset);
-	outb(0x1F4, offset >> 8);
-	outb(0x1F5, offset >> 16);
-	outb(0x1F6, (offset >> 24) | 0xE0);
-	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
+	int port;
+	for (port = 0x1F2; port <= 0x1F5; port++, w >>= 8)
+		outb(port, w);
+}
 
+// Start reading 'count' sectors, at most MAXSECTS, at sector 'offset'.
+// Uses a 48-bit LBA command, which takes the count and LBA registers
+// twice, high-order bytes first, so sectors past 128GB work too.
+static void
+readcmd(uint32_t offset, uint32_t count)
+{
 	// wait for disk to be ready
 	waitdisk();
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+	outregs(offset >> 24 << 8);		// count 15:8, LBA 47:24
+	outregs(count | offset << 8);		// count 7:0, LBA 23:0
+	outb(0x1F6, 0xE0);
+	outb(0x1F7, 0x24);	// cmd 0x24 - read sectors ext
 }
-
@@ -0,0 +1,27 @@
+/*
+ * QEMU and Bochs debug console driver.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/x86.h>
+
+#include <dev/debugcon.h>
+
+
+bool debugcon_exists;
+
+void
+debugcon_init(void)
+{
+	// Nothing answers an unused port, so reading it gives 0xff.
+	debugcon_exists = (inb(IO_DEBUGCON) == IO_DEBUGCON);
+}
+
+void
+debugcon_write(const char *str, int n)
+{
+	if (n > 0)
+		outsb(IO_DEBUGCON, str, n);
+}
@@ -0,0 +1,26 @@
+/*
+ * QEMU and Bochs debug console: a write-only port that takes a whole
+ * string in one "rep outsb", with no line to pace it.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_DEV_DEBUGCON_H
+#define PIOS_DEV_DEBUGCON_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+
+#define IO_DEBUGCON	0xe9		// Reads back 0xe9 if present
+
+
+extern bool debugcon_exists;
+
+void debugcon_init(void);
+void debugcon_write(const char *str, int n);
+
+#endif /* !PIOS_DEV_DEBUGCON_H */
@@ -19,6 +19,7 @@
 #include <kern/cons.h>
 
 #include <dev/kbd.h>
+#include <dev/pic.h>
 
 
 #define NO		0
@@ -180,4 +181,13 @@ kbd_init(void)
 {
 }
 
+void
+kbd_intenable(void)
+{
+	// Take anything typed before now, so the controller
+	// raises its interrupt line again for what comes next.
+	kbd_intr();
+	pic_enable(IRQ_KBD);
+}
+
 
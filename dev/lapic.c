@@ -0,0 +1,239 @@
+/*
+ * Local APIC (per-processor interrupt controller) driver.
+ * The local APIC manages internal (non-I/O) interrupts,
+ * including the per-CPU timer that drives kernel timers (kern/timer.c).
+ * See Chapter 8 & Appendix C of Intel processor manual volume 3.
+ *
+ * Copyright (c) 2010 Yale University.
+ * Copyright (c) 2006-2009 Frans Kaashoek, Robert Morris, Russ Cox,
+ *                         Massachusetts Institute of Technology
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ *
+ * Derived from xv6.
+ */
+
+#include <inc/assert.h>
+#include <inc/trap.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/clock.h>
+
+#include <dev/lapic.h>
+#include <dev/nvram.h>
+
+
+// Local APIC registers, divided by 4 for use as uint32_t[] indices.
+#define ID      (0x0020/4)   // ID
+#define VER     (0x0030/4)   // Version
+#define TPR     (0x0080/4)   // Task Priority
+#define EOI     (0x00B0/4)   // EOI
+#define SVR     (0x00F0/4)   // Spurious Interrupt Vector
+	#define ENABLE     0x00000100   // Unit Enable
+#define ESR     (0x0280/4)   // Error Status
+#define ICRLO   (0x0300/4)   // Interrupt Command
+	#define INIT       0x00000500   // INIT/RESET
+	#define STARTUP    0x00000600   // Startup IPI
+	#define DELIVS     0x00001000   // Delivery status
+	#define ASSERT     0x00004000   // Assert interrupt (vs deassert)
+	#define LEVEL      0x00008000   // Level triggered
+	#define BCAST      0x00080000   // Send to all APICs, including self.
+#define ICRHI   (0x0310/4)   // Interrupt Command [63:32]
+#define TIMER   (0x0320/4)   // Local Vector Table 0 (TIMER)
+	#define X1         0x0000000B   // divide counts by 1
+	#define PERIODIC   0x00020000   // Periodic
+#define PCINT   (0x0340/4)   // Performance Counter LVT
+#define LINT0   (0x0350/4)   // Local Vector Table 1 (LINT0)
+#define LINT1   (0x0360/4)   // Local Vector Table 2 (LINT1)
+	#define EXTINT     0x00000700   // Deliver as 8259A external interrupt
+	#define NMI        0x00000400   // Deliver as non-maskable interrupt
+#define ERROR   (0x0370/4)   // Local Vector Table 3 (ERROR)
+	#define MASKED     0x00010000   // Interrupt masked
+#define TICR    (0x0380/4)   // Timer Initial Count
+#define TCCR    (0x0390/4)   // Timer Current Count
+#define TDCR    (0x03E0/4)   // Timer Divide Configuration
+
+volatile uint32_t *lapic;  // Initialized in lapic_init()
+
+
+static void
+lapicw(int index, int value)
+{
+	lapic[index] = value;
+	lapic[ID];  // wait for write to finish, by reading
+}
+
+void
+lapic_init(void)
+{
+	if (cpu_onboot()) {
+		// The local APIC's registers live wherever the APIC base MSR
+		// says; physical memory is identity-mapped, so use that.
+		cpuinfo inf;
+		cpuid(1, &inf);
+		if (!(inf.edx & CPUID_EDX_APIC) || !(inf.edx & CPUID_EDX_MSR)) {
+			warn("lapic_init: no local APIC; timers disabled");
+			return;
+		}
+		lapic = mem_ptr((uint32_t) rdmsr(MSR_APIC_BASE) & ~0xfff);
+	}
+	if (!lapic)
+		return;
+
+	cpu_cur()->apicid = lapic_id();
+
+	// Enable local APIC; set spurious interrupt vector.
+	lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
+
+	// The timer counts down at bus frequency and is used only in
+	// one-shot mode, armed on demand by kern/timer.c for the next
+	// pending timer on this CPU: leave it masked and idle until then.
+	lapicw(TDCR, X1);
+	lapicw(TIMER, MASKED | T_LTIMER);
+	lapicw(TICR, 0);
+
+	// The boot CPU keeps receiving legacy 8259A interrupts (dev/pic.c)
+	// in virtual wire mode through LINT0; other CPUs mask their LINTs.
+	if (cpu_onboot()) {
+		lapicw(LINT0, EXTINT);
+		lapicw(LINT1, NMI);
+	} else {
+		lapicw(LINT0, MASKED);
+		lapicw(LINT1, MASKED);
+	}
+
+	// Disable performance counter overflow interrupts
+	// on machines that provide that interrupt entry.
+	if (((lapic[VER]>>16) & 0xFF) >= 4)
+		lapicw(PCINT, MASKED);
+
+	// Map error interrupt to T_LERROR.
+	lapicw(ERROR, T_LERROR);
+
+	// Clear error status register (requires back-to-back writes).
+	lapicw(ESR, 0);
+	lapicw(ESR, 0);
+
+	// Ack any outstanding interrupts.
+	lapicw(EOI, 0);
+
+	// Send an Init Level De-Assert to synchronise arbitration ID's.
+	lapicw(ICRHI, 0);
+	lapicw(ICRLO, BCAST | INIT | LEVEL);
+	while(lapic[ICRLO] & DELIVS)
+		;
+
+	// Enable interrupts on the APIC (but not on the processor).
+	lapicw(TPR, 0);
+}
+
+int
+lapic_id(void)
+{
+	if (!lapic)
+		return 0;
+	return lapic[ID] >> 24;
+}
+
+// Acknowledge interrupt.
+void
+lapic_eoi(void)
+{
+	if (lapic)
+		lapicw(EOI, 0);
+}
+
+void
+lapic_errintr(void)
+{
+	lapic_eoi();	// Acknowledge interrupt
+	lapicw(ESR, 0);	// Trigger update of ESR by writing anything
+	warn("CPU%d LAPIC error: ESR %x", lapic_id(), lapic[ESR]);
+}
+
+void
+lapic_ipi(int apicid, int vector)
+{
+	if (!lapic)
+		return;
+	lapicw(ICRHI, apicid << 24);
+	lapicw(ICRLO, vector);		// fixed delivery, edge triggered
+	while(lapic[ICRLO] & DELIVS)
+		;
+}
+
+// Spin for a given number of microseconds.
+static void
+microdelay(int us)
+{
+	uint64_t end = clock_ns() + us * 1000ULL;
+	while (clock_ns() < end)
+		pause();
+}
+
+// Start additional processor running bootstrap code at addr.
+// See Appendix B of MultiProcessor Specification.
+void
+lapic_startap(uint8_t apicid, uint32_t addr)
+{
+	int i;
+	uint16_t *wrv;
+
+	// "The BSP must initialize CMOS shutdown code to 0AH
+	// and the warm reset vector (DWORD based at 40:67) to point at
+	// the AP startup code prior to the [universal startup algorithm]."
+	outb(IO_RTC, 0xF);  // offset 0xF is shutdown code
+	outb(IO_RTC+1, 0x0A);
+	wrv = (uint16_t*)mem_ptr((0x40<<4 | 0x67));  // Warm reset vector
+	wrv[0] = 0;
+	wrv[1] = addr >> 4;
+
+	// "Universal startup algorithm."
+	// Send INIT (level-triggered) interrupt to reset other CPU.
+	lapicw(ICRHI, apicid<<24);
+	lapicw(ICRLO, INIT | LEVEL | ASSERT);
+	microdelay(200);
+	lapicw(ICRLO, INIT | LEVEL);
+	microdelay(100);    // should be 10ms, but too slow in Bochs!
+
+	// Send startup IPI (twice!) to enter bootstrap code.
+	// Regular hardware is supposed to only accept a STARTUP
+	// when it is in the halted state due to an INIT.  So the second
+	// should be ignored, but it is part of the official Intel algorithm.
+	// Bochs complains about the second one.  Too bad for Bochs.
+	for(i = 0; i < 2; i++){
+		lapicw(ICRHI, apicid<<24);
+		lapicw(ICRLO, STARTUP | (addr>>12));
+		microdelay(200);
+	}
+}
+
+void
+lapic_timer_oneshot(uint32_t count)
+{
+	if (!lapic)
+		return;
+	if (count == 0) {
+		lapicw(TIMER, MASKED | T_LTIMER);
+		lapicw(TICR, 0);
+		return;
+	}
+	lapicw(TIMER, T_LTIMER);	// one-shot mode, unmasked
+	lapicw(TICR, count);
+}
+
+uint32_t
+lapic_timer_count(void)
+{
+	if (!lapic)
+		return 0;
+	return lapic[TCCR];
+}
+
+void
+lapic_perfintr(int vector)
+{
+	if (lapic)
+		lapicw(PCINT, vector);
+}
@@ -0,0 +1,56 @@
+/*
+ * Local APIC (per-processor interrupt controller) definitions.
+ *
+ * Copyright (c) 2010 Yale University.
+ * Copyright (c) 2006-2009 Frans Kaashoek, Robert Morris, Russ Cox,
+ *                         Massachusetts Institute of Technology
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ *
+ * Derived from xv6.
+ */
+
+#ifndef PIOS_DEV_LAPIC_H
+#define PIOS_DEV_LAPIC_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+
+// Memory-mapped local APIC registers, or NULL if there is no local APIC.
+extern volatile uint32_t *lapic;
+
+
+// Find and enable the current CPU's local APIC.
+void lapic_init(void);
+
+// Return the current CPU's local APIC ID.
+int lapic_id(void);
+
+// Acknowledge the interrupt currently being serviced.
+void lapic_eoi(void);
+
+// Handle a local APIC error interrupt (T_LERROR).
+void lapic_errintr(void);
+
+// Send interrupt 'vector' to the CPU whose local APIC ID is 'apicid'.
+void lapic_ipi(int apicid, int vector);
+
+// Start the processor whose local APIC ID is 'apicid'
+// running real-mode bootstrap code at physical address 'addr'.
+void lapic_startap(uint8_t apicid, uint32_t addr);
+
+// Arm the local APIC timer to fire T_LTIMER once, after 'count' ticks;
+// a count of zero disarms it.  There is never a periodic tick.
+void lapic_timer_oneshot(uint32_t count);
+
+// Read the local APIC timer's current (down-)count.
+uint32_t lapic_timer_count(void);
+
+// Deliver performance counter overflows as interrupt 'vector'.
+// The local APIC masks the interrupt each time it delivers one,
+// so the handler must call this again to re-enable it.
+void lapic_perfintr(int vector);
+
+#endif	// !PIOS_DEV_LAPIC_H
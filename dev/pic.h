@@ -0,0 +1,40 @@
+/*
+ * Legacy 8259A Programmable Interrupt Controller (PIC) definitions.
+ *
+ * Copyright (C) 1997 Massachusetts Institute of Technology
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ *
+ * Derived from the MIT Exokernel and JOS.
+ */
+
+#ifndef PIOS_DEV_PIC_H
+#define PIOS_DEV_PIC_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+
+#define MAX_IRQS	16	// Number of IRQs
+
+// I/O Addresses of the two 8259A programmable interrupt controllers
+#define IO_PIC1		0x20	// Master (IRQs 0-7)
+#define IO_PIC2		0xA0	// Slave (IRQs 8-15)
+
+#define IRQ_SLAVE	2	// IRQ at which slave connects to master
+
+
+// Initialize the PICs: remap ISA IRQs to T_IRQ0 onwards and mask them all.
+void pic_init(void);
+
+// Set the mask of ISA IRQs the PICs are allowed to deliver.
+void pic_setmask(uint16_t mask);
+
+// Unmask a single ISA IRQ.
+void pic_enable(int irq);
+
+// Acknowledge an ISA IRQ after handling it.
+void pic_eoi(int irq);
+
+#endif	// !PIOS_DEV_PIC_H
@@ -0,0 +1,31 @@
+/*
+ * Intel 8253/8254 Programmable Interval Timer (PIT) driver.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/x86.h>
+
+#include <dev/pit.h>
+
+
+void
+pit_oneshot(uint16_t count)
+{
+	// Counter 2's gate is controlled by software and its output
+	// can be read back, so it needs no interrupt; keep the speaker off.
+	outb(IO_PITGATE, (inb(IO_PITGATE) & ~PITGATE_SPKR) | PITGATE_GATE2);
+
+	// In mode 0 the counter starts as soon as the count is loaded.
+	outb(PIT_MODE, PIT_SEL2 | PIT_ONESHOT);
+	outb(PIT_CNTR2, count & 0xff);
+	outb(PIT_CNTR2, count >> 8);
+}
+
+bool
+pit_expired(void)
+{
+	return (inb(IO_PITGATE) & PITGATE_OUT2) != 0;
+}
+
@@ -0,0 +1,42 @@
+/*
+ * Intel 8253/8254 Programmable Interval Timer (PIT) definitions.
+ * The kernel doesn't take PIT interrupts; it uses the PIT only as
+ * a known-frequency reference against which to calibrate faster clocks.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_DEV_PIT_H
+#define PIOS_DEV_PIT_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+
+#define PIT_FREQ	1193182		// Input clock rate in Hz
+
+#define IO_PIT		0x040		// 8253 Timer #1
+#define PIT_CNTR0	(IO_PIT+0)	// timer 0 counter port
+#define PIT_CNTR1	(IO_PIT+1)	// timer 1 counter port
+#define PIT_CNTR2	(IO_PIT+2)	// timer 2 counter port
+#define PIT_MODE	(IO_PIT+3)	// timer mode port
+#define   PIT_SEL2	0xb0		//   select counter 2, LSB then MSB
+#define   PIT_ONESHOT	0x00		//   mode 0: interrupt on terminal count
+
+#define IO_PITGATE	0x061		// System control port B
+#define   PITGATE_GATE2	0x01		//   counter 2 gate
+#define   PITGATE_SPKR	0x02		//   speaker data enable
+#define   PITGATE_OUT2	0x20		//   counter 2 output (read-only)
+
+
+// Start PIT counter 2 counting down once from 'count' input clocks,
+// without generating any interrupt or sound.
+void pit_oneshot(uint16_t count);
+
+// Returns true once the countdown started by pit_oneshot() has finished.
+bool pit_expired(void);
+
+#endif	// !PIOS_DEV_PIT_H
@@ -11,16 +11,39 @@
  * Adapted for PIOS by Bryan Ford at Yale University.
  */
 
+#include <inc/stdio.h>
+#include <inc/assert.h>
 #include <inc/x86.h>
 #include <inc/trap.h>
 
+#include <kern/cpu.h>
 #include <kern/cons.h>
+#include <kern/clock.h>
 
+#include <dev/pic.h>
 #include <dev/serial.h>
 
 
+#define SERIAL_BAUD	115200
+
 bool serial_exists;
 
+// Output queue, drained into the UART's transmit FIFO.
+// The console lock serializes serial_putc(), the only producer;
+// whoever drains it takes 'busy' instead, without ever waiting for it,
+// so that the transmit interrupt can never deadlock against a producer.
+#define SERIAL_TXBUFSIZE	4096	// Must be a power of two
+
+static struct {
+	volatile uint8_t	buf[SERIAL_TXBUFSIZE];
+	volatile uint32_t	head;	// Next slot to fill; only producer writes
+	volatile uint32_t	tail;	// Next byte to send; only 'busy' holder
+	volatile uint32_t	busy;	// Someone is feeding the FIFO
+	bool			intr;	// Transmit interrupt drains the queue
+	uint32_t		fifosize;	// Bytes we can send at once
+	uint32_t		nstalls;	// Times serial_putc found it full
+} serial_tx;
+
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -40,11 +63,60 @@ serial_proc_data(void)
 	return inb(COM1+COM_RX);
 }
 
+// Queue a character, if there's room.
+static bool
+serial_txput(int c)
+{
+	uint32_t h = serial_tx.head;
+	if (h - serial_tx.tail == SERIAL_TXBUFSIZE)
+		return 0;
+	serial_tx.buf[h % SERIAL_TXBUFSIZE] = c;
+	serial_tx.head = h + 1;
+	return 1;
+}
+
+// Move as much of the queue into the transmit FIFO as it will take,
+// unless someone else is at it, in which case they see our bytes
+// before they let go.  Returns with the queue empty,
+// or the FIFO not yet empty and its transmit interrupt to come.
+static void
+serial_txfill(void)
+{
+	while (serial_tx.tail != serial_tx.head) {
+		if (xchg(&serial_tx.busy, 1) != 0)
+			return;
+		bool ready = inb(COM1+COM_LSR) & COM_LSR_TXRDY;
+		if (ready) {
+			uint32_t t = serial_tx.tail;
+			uint32_t n = MIN(serial_tx.head - t, serial_tx.fifosize);
+			uint32_t i;
+			for (i = 0; i < n; i++)
+				outb(COM1+COM_TX,
+					serial_tx.buf[(t + i) % SERIAL_TXBUFSIZE]);
+			serial_tx.tail = t + n;
+		}
+		serial_tx.busy = 0;
+		if (!ready)
+			return;
+	}
+}
+
 void
 serial_intr(void)
 {
-	if (serial_exists)
-		cons_intr(serial_proc_data);
+	if (!serial_exists)
+		return;
+
+	// The PIC only sees the UART's interrupt line go up,
+	// so deal with everything it has pending before we go,
+	// or it will never interrupt again.
+	int i;
+	for (i = 0; i < COM_FIFOSIZE; i++) {
+		cons_intr(serial_proc_data);	// the receive FIFO, in one burst
+		serial_txfill();
+		if (inb(COM1+COM_IIR) & COM_IIR_NOPEND)
+			break;
+	}
 }
 
 void
@@ -53,24 +125,54 @@ serial_putc(int c)
 	if (!serial_exists)
 		return;
 
+	// If the queue is full, help drain it; give up after a while,
+	// as we used to if the UART never got ready.
 	int i;
-	for (i = 0;
-	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
-	     i++)
+	for (i = 0; !serial_txput(c) && i < 12800; i++) {
+		if (i == 0)
+			serial_tx.nstalls++;
+		serial_txfill();
 		delay();
-	
-	outb(COM1 + COM_TX, c);
+	}
+}
+
+void
+serial_start(void)
+{
+	if (!serial_exists)
+		return;
+	if (serial_tx.intr)
+		serial_txfill();	// the transmit interrupt does the rest
+	else
+		serial_flush();
+}
+
+void
+serial_flush(void)
+{
+	uint32_t tail = serial_tx.tail;
+	int i = 0;
+	while (serial_exists && serial_tx.tail != serial_tx.head &&
+			i++ < 12800) {
+		serial_txfill();
+		delay();
+		if (serial_tx.tail != tail) {
+			tail = serial_tx.tail;
+			i = 0;
+		}
+	}
 }
 
 void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
-	
+	// Turn on and clear the FIFOs, interrupting on receive at 8 bytes.
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_RXRST | COM_FCR_TXRST |
+			COM_FCR_TRIG8);
+
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
-	outb(COM1+COM_DLL, (uint8_t) (115200 / 9600));
+	outb(COM1+COM_DLL, (uint8_t) (115200 / SERIAL_BAUD));
 	outb(COM1+COM_DLM, 0);
 
 	// 8 data bits, 1 stop bit, parity off; turn off DLAB latch
@@ -84,8 +186,76 @@ serial_init(void)
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	uint8_t iir = inb(COM1+COM_IIR);
 	(void) inb(COM1+COM_RX);
+
+	// Only a 16550A has working FIFOs; older UARTs take a byte at a time.
+	serial_tx.fifosize = (iir & COM_IIR_FIFO) == COM_IIR_FIFO ?
+				COM_FIFOSIZE : 1;
 }
 
+// Let the UART interrupt us when there's input, or room for more output.
+// On a PC it needs OUT2 to connect its interrupt line to the PIC.
+void
+serial_intenable(void)
+{
+	if (!serial_exists || !cpu_onboot())
+		return;
+	outb(COM1+COM_MCR, COM_MCR_OUT2 | COM_MCR_RTS | COM_MCR_DTR);
+	outb(COM1+COM_IER, COM_IER_RDI | COM_IER_TXRDY);
+	serial_tx.intr = 1;
+	pic_enable(IRQ_SERIAL);
+}
+
+
+#define SERIAL_CHECKLEN	512	// Bytes to loop back through the UART
 
+void
+serial_check(void)
+{
+	if (!serial_exists)
+		return;
+	assert(serial_tx.fifosize == 1 || serial_tx.fifosize == COM_FIFOSIZE);
+
+	// Loop the UART's output back to its input, so that the test bytes
+	// don't go out the wire, once everything before them has.
+	serial_flush();
+	assert(serial_tx.tail == serial_tx.head);
+	uint8_t mcr = inb(COM1+COM_MCR);
+	outb(COM1+COM_MCR, mcr | COM_MCR_LOOP);
+	while (serial_proc_data() >= 0)
+		;
+
+	// Queueing a burst must not wait for the UART.
+	uint32_t nstalls = serial_tx.nstalls;
+	uint64_t t0 = rdtsc();
+	int i;
+	for (i = 0; i < SERIAL_CHECKLEN; i++)
+		serial_putc(i * 13 + 7);
+	uint64_t t1 = rdtsc();
+	assert(serial_tx.nstalls == nstalls);
+	assert(serial_tx.head - serial_tx.tail == SERIAL_CHECKLEN);
+
+	// Then push it through, checking that it all comes back in order,
+	// but only complain once we can talk to the outside world again.
+	int got = 0, bad = 0, c;
+	while (got < SERIAL_CHECKLEN && rdtsc() - t1 < clock_tsc_hz) {
+		serial_txfill();
+		while ((c = serial_proc_data()) >= 0)
+			if (c != (uint8_t) (got++ * 13 + 7))
+				bad++;
+	}
+	uint64_t t2 = rdtsc();
+	outb(COM1+COM_MCR, mcr);
+	if (got < SERIAL_CHECKLEN || bad)
+		panic("serial_check: %d of %d bytes came back, %d wrong",
+			got, SERIAL_CHECKLEN, bad);
+	assert(serial_tx.tail == serial_tx.head);
+
+	cprintf("serial_check: queued %d bytes at %lld cycles/byte, "
+		"sent at %lldKB/s, %d-byte FIFO\n", SERIAL_CHECKLEN,
+		(t1 - t0) / SERIAL_CHECKLEN,
+		SERIAL_CHECKLEN * clock_tsc_hz / (t2 - t1) / 1024,
+		serial_tx.fifosize);
+	cprintf("serial_check() succeeded!\n");
+}
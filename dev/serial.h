@@ -21,6 +21,7 @@
 
 
 #define COM1		0x3F8
+#define COM2		0x2F8	// Left to user-level drivers (kern/udev.c)
 
 #define COM_RX		0	// In:	Receive buffer (DLAB=0)
 #define COM_TX		0	// Out: Transmit buffer (DLAB=0)
@@ -28,8 +29,16 @@
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXRDY	0x02	//   Enable transmit buffer empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_NOPEND 0x01	//   No interrupt pending
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled (16550A only)
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE 0x01	//   Enable the FIFOs
+#define   COM_FCR_RXRST	0x02	//   Clear the receive FIFO
+#define   COM_FCR_TXRST	0x04	//   Clear the transmit FIFO
+#define   COM_FCR_TRIG8	0x80	//   Receive interrupt at 8 bytes
+#define COM_FIFOSIZE	16	// Bytes in a 16550A's transmit FIFO
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -37,17 +46,31 @@
 #define	  COM_MCR_RTS	0x02	// RTS complement
 #define	  COM_MCR_DTR	0x01	// DTR complement
 #define	  COM_MCR_OUT2	0x08	// Out2 complement
+#define	  COM_MCR_LOOP	0x10	// Loopback: receive what we transmit
 #define COM_LSR		5	// In:	Line Status Register
 #define   COM_LSR_DATA	0x01	//   Data available
-#define   COM_LSR_TXRDY	0x20	//   Transmit buffer avail
+#define   COM_LSR_TXRDY	0x20	//   Transmit buffer (or FIFO) empty
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
+#define COM_SCR		7	// In/Out: Scratch register
 
 
 extern bool serial_exists;
 
 void serial_init(void);
+
+// Queue a character for output.  The transmit-empty interrupt sends it,
+// once serial_intenable() has been called; until then, or when the
+// queue is full, serial_putc() sends what it can itself.
 void serial_putc(int c);
+
+// Start sending what serial_putc() queued.
+void serial_start(void);
+
+// Wait until everything queued has gone out, before halting or the like.
+void serial_flush(void);
+
 void serial_intenable(void);
 void serial_intr(void); // irq 4
+void serial_check(void);
 
 #endif /* PIOS_KERN_SERIAL_H_ */
@@ -12,6 +12,7 @@
  */
 
 #include <inc/string.h>
+#include <inc/assert.h>
 
 #include <kern/mem.h>
 
@@ -19,8 +20,37 @@
 
 
 static unsigned addr_6845;
-static uint16_t *crt_buf;
-static uint16_t crt_pos;
+static volatile uint16_t *crt_buf;	// Video memory
+static unsigned crt_bufsize;		// Cells of it to scroll through
+static unsigned crt_start;		// Cell shown at the top left
+
+// What should be on the screen, in RAM, so that we can write it out
+// a row at a time and never read video memory back.  Screen row r
+// lives in row (crt_top + r) % CRT_ROWS here, so scrolling moves nothing.
+static uint16_t crt_shadow[CRT_SIZE];
+static unsigned crt_top;
+static uint16_t crt_pos;		// Cursor, as a cell of the screen
+static uint32_t crt_dirty;		// Screen rows video memory lacks
+static unsigned crt_scrolled;		// Rows scrolled since video_flush()
+
+// Set a pair of 6845 registers, high byte first.
+static void
+video_crtc(int reg, uint16_t val)
+{
+	outb(addr_6845, reg);
+	outb(addr_6845 + 1, val >> 8);
+	outb(addr_6845, reg + 1);
+	outb(addr_6845 + 1, val);
+}
+
+static uint16_t
+video_getcrtc(int reg)
+{
+	outb(addr_6845, reg);
+	uint16_t val = inb(addr_6845 + 1) << 8;
+	outb(addr_6845, reg + 1);
+	return val | inb(addr_6845 + 1);
+}
 
 void
 video_init(void)
@@ -29,6 +59,8 @@ video_init(void)
 	uint16_t was;
 	unsigned pos;
 
+	static_assert(CRT_ROWS < 32);	// crt_dirty has a bit per row
+
 	/* Get a pointer to the memory-mapped text display buffer. */
 	cp = (uint16_t*) mem_ptr(CGA_BUF);
 	was = *cp;
@@ -36,22 +68,52 @@ video_init(void)
 	if (*cp != 0xA55A) {
 		cp = (uint16_t*) mem_ptr(MONO_BUF);
 		addr_6845 = MONO_BASE;
+		crt_bufsize = MONO_BUFSIZE / sizeof(uint16_t);
 	} else {
 		*cp = was;
 		addr_6845 = CGA_BASE;
+		crt_bufsize = CGA_BUFSIZE / sizeof(uint16_t);
+	}
+	crt_buf = cp;
+
+	/* Extract the screen's start and the cursor location,
+	 * which whatever ran before us may have left anywhere. */
+	crt_start = video_getcrtc(CRT_START);
+	pos = video_getcrtc(CRT_CURSOR);
+	if (crt_start > crt_bufsize - CRT_SIZE) {
+		crt_start = 0;
+		video_crtc(CRT_START, 0);
 	}
-	
-	/* Extract cursor location */
-	outb(addr_6845, 14);
-	pos = inb(addr_6845 + 1) << 8;
-	outb(addr_6845, 15);
-	pos |= inb(addr_6845 + 1);
-
-	crt_buf = (uint16_t*) cp;
-	crt_pos = pos;
+	crt_pos = pos >= crt_start && pos - crt_start < CRT_SIZE ?
+			pos - crt_start : 0;
+
+	// Pick up what's on the screen already, the last time we read it.
+	int i;
+	for (i = 0; i < CRT_SIZE; i++)
+		crt_shadow[i] = crt_buf[crt_start + i];
 }
 
+// The shadow cell for the screen cell at 'pos'.
+static uint16_t *
+video_cell(unsigned pos)
+{
+	return &crt_shadow[(crt_top + pos / CRT_COLS) % CRT_ROWS * CRT_COLS +
+				pos % CRT_COLS];
+}
 
+// Scroll the shadow up a row, leaving video memory to video_flush().
+static void
+video_scroll(void)
+{
+	int i;
+	uint16_t *row = &crt_shadow[crt_top * CRT_COLS];
+	for (i = 0; i < CRT_COLS; i++)
+		row[i] = 0x0700 | ' ';
+	crt_top = (crt_top + 1) % CRT_ROWS;
+	crt_dirty = crt_dirty >> 1 | 1 << (CRT_ROWS - 1);
+	crt_scrolled++;
+	crt_pos -= CRT_COLS;
+}
 
 void
 video_putc(int c)
@@ -64,7 +126,8 @@ video_putc(int c)
 	case '\b':
 		if (crt_pos > 0) {
 			crt_pos--;
-			crt_buf[crt_pos] = (c & ~0xff) | ' ';
+			*video_cell(crt_pos) = (c & ~0xff) | ' ';
+			crt_dirty |= 1 << (crt_pos / CRT_COLS);
 		}
 		break;
 	case '\n':
@@ -81,26 +144,50 @@ video_putc(int c)
 		video_putc(' ');
 		break;
 	default:
-		crt_buf[crt_pos++] = c;		/* write the character */
+		*video_cell(crt_pos) = c;		/* write the character */
+		crt_dirty |= 1 << (crt_pos / CRT_COLS);
+		crt_pos++;
 		break;
 	}
 
-	// What is the purpose of this?
-	if (crt_pos >= CRT_SIZE) {
-		int i;
+	// Scroll when we run off the bottom of the screen.
+	if (crt_pos >= CRT_SIZE)
+		video_scroll();
+}
+
+void
+video_flush(void)
+{
+	if (crt_buf == NULL)
+		return;
+
+	// Scroll in hardware, by starting the screen further on
+	// in video memory, with the new rows already marked dirty.
+	// Once we run out of video memory, start again at the beginning,
+	// writing out the whole screen.
+	unsigned start = crt_start;
+	if (crt_scrolled > 0) {
+		start += crt_scrolled * CRT_COLS;
+		if (crt_scrolled >= CRT_ROWS ||
+				start > crt_bufsize - CRT_SIZE) {
+			start = 0;
+			crt_dirty = (1 << CRT_ROWS) - 1;
+		}
+	}
 
-		memmove(crt_buf, crt_buf + CRT_COLS,
-			(CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
-		for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-			crt_buf[i] = 0x0700 | ' ';
-		crt_pos -= CRT_COLS;
+	// Write out the dirty rows before showing them.
+	int r;
+	for (r = 0; crt_dirty != 0; r++, crt_dirty >>= 1)
+		if (crt_dirty & 1)
+			memmove((uint16_t*) crt_buf + start + r * CRT_COLS,
+				video_cell(r * CRT_COLS),
+				CRT_COLS * sizeof(uint16_t));
+	if (start != crt_start) {
+		crt_start = start;
+		video_crtc(CRT_START, start);
 	}
+	crt_scrolled = 0;
 
-	/* move that little blinky thing */
-	outb(addr_6845, 14);
-	outb(addr_6845 + 1, crt_pos >> 8);
-	outb(addr_6845, 15);
-	outb(addr_6845 + 1, crt_pos);
+	/* move that little blinky thing, once per burst */
+	video_crtc(CRT_CURSOR, crt_start + crt_pos);
 }
-
-
@@ -23,8 +23,14 @@
 
 #define MONO_BASE	0x3B4
 #define MONO_BUF	0xB0000
+#define MONO_BUFSIZE	0x1000
 #define CGA_BASE	0x3D4
 #define CGA_BUF		0xB8000
+#define CGA_BUFSIZE	0x4000	// VGA has twice this, but CGA doesn't
+
+// 6845 CRT controller register pairs, high byte first
+#define CRT_START	12	// Cell shown at the top left of the screen
+#define CRT_CURSOR	14	// Cell the cursor is on
 
 #define CRT_ROWS	25
 #define CRT_COLS	80
@@ -32,7 +38,11 @@
 
 
 void video_init(void);
+
+// Write a character into the shadow screen in RAM;
+// video_flush() then brings video memory and the cursor up to date.
 void video_putc(int c);
+void video_flush(void);
 
 
 #endif /* PIOS_KERN_VIDEO_H_ */
@@ -0,0 +1,22 @@
+/*
+ * Information the boot loader leaves for the kernel.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_INC_BOOT_H
+#define PIOS_INC_BOOT_H
+
+#include <inc/types.h>
+
+// Where boot/main.c leaves its bootinfo: just past the boot sector,
+// in low memory the kernel copies it out of before allocating anything.
+#define BOOTINFO	((bootinfo *) 0x7E00)
+
+typedef struct bootinfo {
+	uint64_t	tsc_start;	// TSC on entry to bootmain()
+	uint64_t	tsc_loaded;	// TSC just before jumping to the kernel
+} bootinfo;
+
+#endif /* !PIOS_INC_BOOT_H */
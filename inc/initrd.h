@@ -0,0 +1,50 @@
+/*
+ * Format of the compressed initial ramdisk linked into the kernel.
+ *
+ * The archive starts with an initrd_hdr, followed by an initrd_file
+ * for each file.  Each file is compressed a page (INITRD_BLOCK bytes)
+ * at a time, so that any page of it can be decompressed on its own;
+ * its block table, an array of blocks+1 archive offsets, says where
+ * each compressed block starts and where the last one ends.
+ * A block as long compressed as uncompressed is stored as is;
+ * any other block is in the LZ4 block format:
+ *
+ *	sequence: token [literal length bytes] literals
+ *		  offset [match length bytes]
+ *	token: high nibble = literal count, low nibble = match length - 4;
+ *		a nibble of 15 continues in bytes of 255, ended by one less
+ *	offset: 16-bit little-endian distance back to copy the match from
+ *
+ * where the last sequence ends after its literals.
+ *
+ * This header is shared with the packer, misc/mkinitrd.c, which runs
+ * on the build host: include it after <inc/types.h> or <stdint.h>.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_INC_INITRD_H
+#define PIOS_INC_INITRD_H
+
+
+#define INITRD_MAGIC	0x44525449	// "ITRD" in little endian
+#define INITRD_BLOCK	4096		// Compression unit: one page
+#define INITRD_NAMELEN	52		// Max name length, with the NUL
+
+typedef struct initrd_hdr {
+	uint32_t	magic;		// INITRD_MAGIC
+	uint32_t	nfiles;		// Number of initrd_file entries
+} initrd_hdr;
+
+typedef struct initrd_file {
+	char		name[INITRD_NAMELEN];	// NUL-terminated path
+	uint32_t	size;		// Uncompressed size in bytes
+	uint32_t	blocks;		// Archive offset of block table
+	uint32_t	sum;		// FNV-1a hash of the contents
+} initrd_file;
+
+#define INITRD_FNVBASIS	2166136261U	// FNV-1a initial hash value
+#define INITRD_FNVPRIME	16777619U	// FNV-1a multiplier
+
+#endif /* !PIOS_INC_INITRD_H */
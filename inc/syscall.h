@@ -0,0 +1,286 @@
+/*
+ * PIOS system call definitions.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_INC_SYSCALL_H
+#define PIOS_INC_SYSCALL_H
+
+#include <inc/trap.h>
+
+
+// System call command codes (passed in EAX)
+#define SYS_TYPE	0x0000000f	// Basic operation type
+#define SYS_CPUTS	0x00000000	// Write debugging string to console
+#define SYS_PUT		0x00000001	// Push data to child and start it
+#define SYS_GET		0x00000002	// Pull results from child
+#define SYS_RET		0x00000003	// Return to parent
+#define SYS_YIELD	0x00000004	// Let another ready process run
+#define SYS_FUTEX	0x00000005	// Wait on or wake a memory word
+#define SYS_DEV		0x00000006	// Claim device resources for a driver
+#define SYS_GETC	0x00000007	// Read a character of console input
+
+#define SYS_START	0x00000010	// Put: start child running
+#define SYS_GANG	0x00000020	// Put: start child in our gang, together
+					// with the rest once we wait for one
+
+#define SYS_WAKE	0x00000010	// Futex: wake waiters instead of waiting
+
+#define SYS_DEVOP	0x00000030	// Dev: which kind of resource
+#define SYS_DEVPORT	0x00000010	// Dev: I/O ports
+#define SYS_DEVMMIO	0x00000020	// Dev: memory-mapped I/O pages
+#define SYS_DEVDMA	0x00000030	// Dev: pinned DMA buffer
+
+#define SYS_REGS	0x00001000	// Get/put register state
+
+// Memory operations on 4MB-aligned (PTSIZE) regions of user space,
+// between [ESI,ESI+ECX) of the source and [EDI,EDI+ECX) of the destination.
+#define SYS_MEMOP	0x00030000	// Get/put: memory operation
+#define SYS_NONE	0x00000000	// Get/put: no memory operation
+#define SYS_COPY	0x00010000	// Get/put: copy-on-write copy
+#define SYS_MERGE	0x00020000	// Get: merge child's changes since snap
+#define SYS_ZERO	0x00030000	// Get/put: zero the destination region
+
+#define SYS_SNAP	0x00040000	// Put: snapshot child's memory for merge
+
+// Replace all the child's memory with the ELF executable of ECX bytes
+// at ESI, which must be part of the kernel image, or if ECX is 0,
+// the one in the initial ramdisk named by the string at ESI,
+// ready to run from its entry point, with its pages loaded
+// as it touches them (kern/elf.c).
+#define SYS_EXEC	0x00080000	// Put: load executable (no SYS_MEMOP)
+
+// Set nominal permissions on the page-aligned destination region.
+// These live in the PTE_AVAIL bits of page table entries.
+#define SYS_PERM	0x00000100	// Get/put: set memory permissions
+#define SYS_READ	0x00000200	// Read permission
+#define SYS_WRITE	0x00000400	// Write permission
+#define SYS_RW		0x00000600	// Both read and write permission
+
+
+#ifndef __ASSEMBLER__
+
+// Process state save area, which SYS_REGS copies to or from a child.
+// On SYS_PUT the kernel ignores the segment registers,
+// all but the user-modifiable EFLAGS bits (see FL_USER),
+// and undefined pff bits.
+// If 'tls' is nonzero, the process starts with %gs selecting a segment
+// (CPU_GDT_UDTLS) based there, for fast thread-local storage.
+// If 'upcall' is nonzero, whenever the process blocks in sys_wait()
+// other than on that word itself, the kernel first increments the word
+// and wakes one process waiting on it: a user-level thread scheduler
+// can use this to bring in another virtual processor (see inc/thread.h).
+// If 'xeip' is nonzero, traps the process takes go to the handler there,
+// running on the page-sized exception stack below 'xesp' (see utrapframe),
+// rather than to the parent, unless the kernel can't push the trap there.
+typedef struct procstate {
+	trapframe	tf;		// general registers
+	uint32_t	pff;		// process feature flags (PFF_*)
+	int32_t		icnt;		// instructions executed so far
+	int32_t		imax;		// max instructions before T_ICNT
+	uint32_t	tls;		// base of %gs segment, if nonzero
+	uint32_t	upcall;		// word to bump when blocking, if nonzero
+	uint32_t	xeip;		// exception handler, if nonzero
+	uint32_t	xesp;		// top of exception stack
+} procstate;
+
+// Process feature flags (procstate.pff)
+#define PFF_ICNT	0x0001	// Count instructions, and stop with T_ICNT
+				// after exactly imax of them
+
+
+static void gcc_inline
+sys_cputs(const char *s)
+{
+	// Pass system call number and arguments in registers.
+	asm volatile("int %0" :
+		: "i" (T_SYSCALL),
+		  "a" (SYS_CPUTS),
+		  "b" (s)
+		: "cc", "memory");
+}
+
+// Optionally set the register state of child number 'child' from 'save',
+// do a memory operation from our 'localsrc' to the child's 'childdest',
+// optionally snapshot and start the child, and return;
+// if the child is still running, first wait for it to stop.
+static void gcc_inline
+sys_put(uint32_t flags, uint16_t child, procstate *save,
+		void *localsrc, void *childdest, size_t size)
+{
+	asm volatile("int %0" :
+		: "i" (T_SYSCALL),
+		  "a" (SYS_PUT | flags),
+		  "b" (save),
+		  "d" (child),
+		  "S" (localsrc),
+		  "D" (childdest),
+		  "c" (size)
+		: "cc", "memory");
+}
+
+// Wait for child 'child' to stop (return or take a trap),
+// optionally copy its register state into 'save',
+// and do a memory operation from its 'childsrc' to our 'localdest'.
+// SYS_MERGE copies only the bytes the child changed since its snapshot,
+// making any page where we changed the same bytes differently
+// inaccessible, so that using the conflicting data causes a page fault.
+static void gcc_inline
+sys_get(uint32_t flags, uint16_t child, procstate *save,
+		void *childsrc, void *localdest, size_t size)
+{
+	asm volatile("int %0" :
+		: "i" (T_SYSCALL),
+		  "a" (SYS_GET | flags),
+		  "b" (save),
+		  "d" (child),
+		  "S" (childsrc),
+		  "D" (localdest),
+		  "c" (size)
+		: "cc", "memory");
+}
+
+// Return control to our parent.
+// For the root process, this means the whole system is done.
+static void gcc_inline
+sys_ret(void)
+{
+	asm volatile("int %0" :
+		: "i" (T_SYSCALL),
+		  "a" (SYS_RET)
+		: "cc", "memory");
+}
+
+// Give up the CPU to another process ready to run on it, if any.
+static void gcc_inline
+sys_yield(void)
+{
+	asm volatile("int %0" :
+		: "i" (T_SYSCALL),
+		  "a" (SYS_YIELD)
+		: "cc", "memory");
+}
+
+// Futexes: wait queues for user-level synchronization, such as mutexes
+// that need no system call unless contended.  A futex is identified by
+// the physical address of a 32-bit word, so processes share one only
+// where they share the page it is in: writing a copy-on-write page
+// gives the writer a new page, and so a different futex.
+
+// Block until another process wakes the futex at 'addr' with sys_wake(),
+// if the word there still contains 'val'; else return right away.
+// May also return spuriously, so callers must recheck what they wait for.
+static void gcc_inline
+sys_wait(volatile uint32_t *addr, uint32_t val)
+{
+	asm volatile("int %0" :
+		: "i" (T_SYSCALL),
+		  "a" (SYS_FUTEX),
+		  "b" (addr),
+		  "d" (val)
+		: "cc", "memory");
+}
+
+// Wake up to 'n' processes waiting on the futex at 'addr',
+// returning how many there were.
+static int gcc_inline
+sys_wake(volatile uint32_t *addr, int n)
+{
+	int woken;
+	asm volatile("int %1" :
+		  "=a" (woken)
+		: "i" (T_SYSCALL),
+		  "a" (SYS_FUTEX | SYS_WAKE),
+		  "b" (addr),
+		  "c" (n)
+		: "cc", "memory");
+	return woken;
+}
+
+// User-level device drivers claim what they need with these,
+// and from then on drive the device with no further system calls.
+// A process has exclusive use of what it claims, for good,
+// but can't claim anything the kernel itself uses.
+
+// Claim I/O ports [port,port+n), which must lie below 0x400,
+// so that this process can use IN and OUT on them.
+// Returns false if some other process or the kernel has any of them.
+static bool gcc_inline
+sys_devport(uint16_t port, int n)
+{
+	int ok;
+	asm volatile("int %1" :
+		  "=a" (ok)
+		: "i" (T_SYSCALL),
+		  "a" (SYS_DEV | SYS_DEVPORT),
+		  "d" (port),
+		  "c" (n)
+		: "cc", "memory");
+	return ok;
+}
+
+// Claim the page-aligned device memory at physical address 'pa',
+// which must lie above all RAM, and map it uncached at 'va'.
+// Returns false if it's taken, or the kernel ran out of memory.
+static bool gcc_inline
+sys_devmmio(uint32_t pa, void *va, size_t size)
+{
+	int ok;
+	asm volatile("int %1" :
+		  "=a" (ok)
+		: "i" (T_SYSCALL),
+		  "a" (SYS_DEV | SYS_DEVMMIO),
+		  "S" (pa),
+		  "D" (va),
+		  "c" (size)
+		: "cc", "memory");
+	return ok;
+}
+
+// Allocate a physically contiguous DMA buffer of page-aligned 'size',
+// pinned in memory, and map it at 'va'.  Returns its physical address,
+// for the driver to give the device, or 0 if there's no room for it.
+static uint32_t gcc_inline
+sys_devdma(void *va, size_t size)
+{
+	uint32_t pa;
+	asm volatile("int %1" :
+		  "=a" (pa)
+		: "i" (T_SYSCALL),
+		  "a" (SYS_DEV | SYS_DEVDMA),
+		  "D" (va),
+		  "c" (size)
+		: "cc", "memory");
+	return pa;
+}
+
+// Read a character of console input, waiting until there is some.
+static int gcc_inline
+sys_getc(void)
+{
+	int c;
+	do {
+		// The kernel returns 0 if woken without input for us,
+		// as when another process took it first.
+		asm volatile("int %1" :
+			  "=a" (c)
+			: "i" (T_SYSCALL),
+			  "a" (SYS_GETC)
+			: "cc", "memory");
+	} while (c == 0);
+	return c;
+}
+
+// Start child 'child' running fn(arg) on the stack ending at 'stacktop',
+// as sys_put() would with SYS_REGS | SYS_START and any other 'flags'
+// and memory operation.  'ps' holds the rest of the child's registers,
+// zeroed but for what the caller wants, such as tls or xeip,
+// or is NULL for none.  (In lib/spawn.c.)
+void spawn(uint32_t flags, uint16_t child, procstate *ps, void *stacktop,
+	void (*fn)(int), int arg, void *localsrc, void *childdest, size_t size);
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !PIOS_INC_SYSCALL_H */
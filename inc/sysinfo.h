@@ -0,0 +1,153 @@
+/*
+ * System information page the kernel shares with user code.
+ *
+ * The kernel keeps this page up to date at the fixed address SYSINFO_ADDR,
+ * where user code can read it directly, without a system call:
+ * to read the clock, find out which CPU it is running on,
+ * or sample kernel statistics at the cost of a few memory loads.
+ * User code must treat the page as read-only.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_INC_SYSINFO_H
+#define PIOS_INC_SYSINFO_H
+
+#include <inc/types.h>
+#include <inc/x86.h>
+
+
+#define SYSINFO_ADDR	0x2000	// Physical page 2, just above the AP boot page
+#define SYSINFO_NCPU	32	// Max CPUs described; must match CPU_MAX
+
+// Flags in sysinfo.flags
+#define SYSINFO_RDTSCP	0x0001	// RDTSCP works and returns our CPU index
+
+#ifndef __ASSEMBLER__
+
+// Per-CPU part of the system information page.
+typedef struct sysinfo_cpu {
+	uint64_t	tsc_base;	// CPU's TSC at clock time 0 [seq]
+	uint32_t	apicid;		// Local APIC ID, as CPUID reports it
+	uint32_t	traps;		// Traps and interrupts taken
+	uint32_t	syscalls;	// System calls handled
+	uint32_t	intrs;		// Device and timer interrupts handled
+	uint32_t	timers;		// Kernel timers expired
+	uint32_t	halts;		// Times the CPU halted in the idle loop
+	uint32_t	switches;	// Processes dispatched
+	uint32_t	steals;		// Ready processes stolen from other CPUs
+	uint32_t	preempts;	// Processes preempted at end of quantum
+	uint32_t	gangs;		// Gangs dispatched
+	uint32_t	merges;		// Pages merged byte by byte
+	uint32_t	conflicts;	// Pages with write/write merge conflicts
+	uint32_t	dpcs;		// Deferred procedure calls run
+	uint32_t	works;		// Kernel work queue items run
+	uint32_t	futex_waits;	// Processes blocked on a futex
+	uint32_t	futex_wakes;	// Processes woken from a futex
+	uint32_t	upcalls;	// Scheduler upcalls on blocking
+	uint32_t	utraps;		// Traps reflected to user handlers
+	uint32_t	pageins;	// Executable pages loaded on demand
+	uint32_t	pagemaps;	// ... mapped from the image, not copied
+	uint64_t	irq_cycles;	// TSC cycles in interrupt handlers
+	uint64_t	dpc_cycles;	// ... in DPCs on the way out of them
+	uint64_t	work_cycles;	// ... in the kernel worker
+} sysinfo_cpu;
+
+typedef struct sysinfo {
+	// Fields marked [seq] may change together at any time:
+	// the kernel makes seq odd while it is updating them.
+	volatile uint32_t seq;
+
+	uint32_t	flags;		// SYSINFO_* flags
+	uint32_t	ncpu;		// Number of CPUs running [seq]
+
+	// Clock parameters:
+	// clock_ns = (tsc - cpu[i].tsc_base) * clock_mult / 2^clock_shift
+	uint32_t	clock_mult;	// [seq]
+	uint32_t	clock_shift;	// [seq]
+	uint64_t	tsc_hz;		// TSC frequency [seq]
+
+	// Physical page allocator statistics.
+	uint32_t	mem_npage;	// Total physical pages
+	uint32_t	mem_nfree;	// Pages currently free
+	uint32_t	mem_nalloc;	// Total page allocations
+	uint32_t	mem_nfreed;	// Total page frees
+
+	sysinfo_cpu	cpu[SYSINFO_NCPU];
+} sysinfo;
+
+#define SYSINFO		((const volatile sysinfo *) SYSINFO_ADDR)
+
+
+// Seqlock read side: copy [seq] fields between sysinfo_begin() and
+// a sysinfo_retry() that returns false, retrying if it returns true.
+static gcc_inline uint32_t
+sysinfo_begin(const volatile sysinfo *si)
+{
+	uint32_t seq;
+	while ((seq = si->seq) & 1)
+		pause();
+	asm volatile("" : : : "memory");
+	return seq;
+}
+
+static gcc_inline bool
+sysinfo_retry(const volatile sysinfo *si, uint32_t seq)
+{
+	asm volatile("" : : : "memory");
+	return si->seq != seq;
+}
+
+// Convert TSC cycles to nanoseconds given the clock's conversion factor,
+// with a 64x32-bit multiply that doesn't overflow the 64-bit intermediate.
+static gcc_inline uint64_t
+sysinfo_cyc2ns(uint64_t cyc, uint32_t mult, uint32_t shift)
+{
+	uint32_t lo = cyc, hi = cyc >> 32;
+	return (((uint64_t) lo * mult) >> shift) +
+		(((uint64_t) hi * mult) << (32 - shift));
+}
+
+// Find the index of the CPU we're running on from its local APIC ID.
+// Of course we might be moved to another CPU right after we return.
+static gcc_inline int
+sysinfo_cpuid(const volatile sysinfo *si)
+{
+	cpuinfo inf;
+	cpuid(1, &inf);
+	uint32_t apicid = inf.ebx >> 24;
+	int i;
+	for (i = 0; i < si->ncpu; i++)
+		if (si->cpu[i].apicid == apicid)
+			return i;
+	return 0;
+}
+
+// Return the clock time in nanoseconds since boot, like the kernel's
+// clock_ns(), along with the index of the CPU we read it on if 'cpu'
+// is non-NULL.  Prefers RDTSCP, which gives both in one instruction.
+static gcc_inline uint64_t
+sysinfo_clock(const volatile sysinfo *si, int *cpu)
+{
+	uint32_t seq, i;
+	uint64_t tsc, ns;
+	do {
+		seq = sysinfo_begin(si);
+		if (si->flags & SYSINFO_RDTSCP)
+			tsc = rdtscp(&i);
+		else {
+			i = sysinfo_cpuid(si);
+			tsc = rdtsc();
+		}
+		ns = sysinfo_cyc2ns(tsc - si->cpu[i].tsc_base,
+				si->clock_mult, si->clock_shift);
+	} while (sysinfo_retry(si, seq));
+	if (cpu)
+		*cpu = i;
+	return ns;
+}
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !PIOS_INC_SYSINFO_H */
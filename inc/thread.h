@@ -0,0 +1,72 @@
+/*
+ * User-level ("green") threads, run M:N over a few kernel processes.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_INC_THREAD_H
+#define PIOS_INC_THREAD_H
+
+#include <inc/types.h>
+
+
+#define THREAD_MAXVP	32	// Max virtual processors
+
+// A user-level thread.  The caller provides the structure and the stack,
+// neither of which it may reuse until the thread has exited.
+typedef struct thread {
+	uint32_t	sp;		// Saved stack pointer while switched out
+	struct thread	*next;		// Next on the run queue
+	void		(*fn)(void *arg);	// What the thread runs
+	void		*arg;
+	void		*local;		// Free for the thread's own use
+} thread;
+
+// A virtual processor: one of the processes that run threads.
+// Each one's thread-local storage segment (%gs) is based at its threadvp,
+// so that finding the current thread takes a single load.
+typedef struct threadvp {
+	thread		*cur;		// %gs:0: thread running here
+	struct threadvp	*self;		// %gs:4: this structure
+	int		id;		// Which virtual processor we are
+	uint32_t	sp;		// Scheduler's stack pointer, while
+					// it has switched to a thread
+	thread		*prev;		// Thread to requeue once off its stack
+} threadvp;
+
+
+// The current thread.  Only valid in code running as a thread.
+static gcc_inline thread *
+thread_self(void)
+{
+	thread *t;
+	asm volatile("movl %%gs:0,%0" : "=r" (t));
+	return t;
+}
+
+// Make thread 't' ready to run fn(arg) on the given stack.
+// Threads can create more threads, both before and during thread_run().
+void thread_create(thread *t, void *stack, size_t size,
+			void (*fn)(void *arg), void *arg);
+
+// Let another ready thread run, if there is one.
+void thread_yield(void);
+
+// End the current thread.  Returning from its function does the same.
+void thread_exit(void) gcc_noreturn;
+
+// Run the threads created so far, and any they create, on 'nvp' virtual
+// processors, which are our children 0 through nvp-1, and return once
+// they have all exited.  Whenever a virtual processor blocks in the kernel
+// in sys_wait(), the kernel wakes an idle one (see procstate.upcall),
+// so use more virtual processors than CPUs if threads block that way.
+// Virtual processors share threads through memory they all map:
+// code in the kernel image, whose memory all processes share, can use
+// several; a program in its own address space should use just one.
+void thread_run(int nvp);
+
+// Check threads, reporting creation and context switch costs.
+void thread_check(void);
+
+#endif /* !PIOS_INC_THREAD_H */
@@ -0,0 +1,51 @@
+/*
+ * Format of the binary event trace the kernel dumps to the serial port
+ * (kern/trace.c), for misc/tracedump.c to decode on the build host.
+ *
+ * A dump is a tracehdr, then 'nrec' tracerecs, then a tracetail,
+ * all little endian, with nothing between them.  It can turn up
+ * anywhere in the serial output, among the console text around it:
+ * the decoder finds it by its magic numbers and checks it by its sum,
+ * an FNV-1a hash over the records' bytes.
+ *
+ * Each record's 'event' is the address of the tracepoint it came from,
+ * which the decoder looks up in the kernel's symbol table,
+ * obj/kern/kernel.sym, where tracepoint 'foo' appears as trace_foo.
+ *
+ * This header is shared with the decoder:
+ * include it after <inc/types.h> or <stdint.h>.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_INC_TRACE_H
+#define PIOS_INC_TRACE_H
+
+
+#define TRACE_MAGIC	0x45435254	// "TRCE" in little endian
+#define TRACE_ENDMAGIC	0x444e4554	// "TEND" in little endian
+#define TRACE_NARGS	4		// Arguments per record
+#define TRACE_FNVBASIS	2166136261u
+#define TRACE_FNVPRIME	16777619u
+
+typedef struct tracehdr {
+	uint32_t	magic;		// TRACE_MAGIC
+	uint32_t	nrec;		// Records following
+	uint64_t	tsc_hz;		// TSC ticks per second
+} tracehdr;
+
+typedef struct tracerec {
+	uint64_t	tsc;		// TSC ticks since clock time zero
+	uint32_t	event;		// Address of the tracepoint
+	uint16_t	cpu;		// Index of the CPU it happened on
+	uint16_t	pad;
+	uint32_t	arg[TRACE_NARGS];	// Meaning depends on the event
+} tracerec;
+
+typedef struct tracetail {
+	uint32_t	magic;		// TRACE_ENDMAGIC
+	uint32_t	sum;		// FNV-1a hash of the records
+} tracetail;
+
+#endif /* !PIOS_INC_TRACE_H */
@@ -47,6 +47,8 @@
 // We use these vectors to receive local per-CPU interrupts
 #define T_LTIMER	49	// Local APIC timer interrupt
 #define T_LERROR	50	// Local APIC error interrupt
+#define T_IPI		51	// Wakeup interrupt from another CPU
+#define T_PERFCTR	52	// Performance counter overflow interrupt
 
 #define T_DEFAULT	500	// Unused trap vectors produce this value
 #define T_ICNT		501	// Child process instruction count expired
@@ -114,6 +116,30 @@ typedef struct trapframe {
 #define trapframe_ksize (sizeof(trapframe) - 8)	// no esp, ss, padding4
 
 
+// Compact record of a trap, which the kernel pushes onto a process's
+// exception stack for the process's own handler (see procstate.xeip)
+// instead of stopping it and returning to its parent.
+// The handler gets a pointer to the record as its argument,
+// and mustn't return: it can resume the trapping code with utrap_resume().
+typedef struct utrapframe {
+	uint32_t	trapno;
+	uint32_t	err;
+	uint32_t	fva;		// faulting address, for T_PGFLT
+	pushregs	regs;
+	uint32_t	eip;
+	uint32_t	eflags;
+	uint32_t	esp;
+} utrapframe;
+
+// Resume the code that took a trap described by 'utf', in lib/utrap.c:
+// restores all its registers directly, without a system call.
+// Uses the 4 bytes below utf->esp on the trap-time stack.
+void utrap_resume(utrapframe *utf) gcc_noreturn;
+
+// Check exception upcalls from user mode, in lib/utrap.c.
+void utrap_check(void);
+
+
 // Floating-point/MMX/XMM register save area format,
 // in the layout defined by the processor's FXSAVE/FXRSTOR instructions.
 typedef gcc_aligned(16) struct fxsave {
@@ -0,0 +1,42 @@
+/*
+ * Virtual memory layout definitions.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_INC_VM_H
+#define PIOS_INC_VM_H
+
+#include <inc/mmu.h>
+
+
+// Every process's address space looks like this:
+//
+//    4 Gig -------->  +------------------------------+
+//                     |  Memory-mapped I/O (LAPIC),  |
+//                     |  identity-mapped, kernel-only|
+//    VM_USERHI ---->  +------------------------------+ 0xf0000000
+//                     |                              |
+//                     |   Per-process user space:    |
+//                     |   private to each process,   |
+//                     |   copied and merged by       |
+//                     |   fork/join system calls     |
+//                     |                              |
+//    VM_USERLO ---->  +------------------------------+ 0x40000000
+//                     |  Physical memory, identity-  |
+//                     |  mapped and shared by all    |
+//                     |  processes; holds the kernel |
+//                     |  and its user-mode test code |
+//    0 ------------>  +------------------------------+
+//
+// The kernel's low memory mapping is global (PTE_G), so it stays in the
+// TLB when we switch address spaces.  It is user-accessible, because
+// this kernel still runs user-mode code linked into its own image
+// (see user() in kern/init.c), except for the sysinfo page (inc/sysinfo.h),
+// which user code may only read.
+
+#define VM_USERLO	0x40000000	// Start of per-process user space
+#define VM_USERHI	0xf0000000	// End of per-process user space
+
+#endif /* !PIOS_INC_VM_H */
@@ -38,6 +38,36 @@
 #define FL_VIP		0x00100000	// Virtual Interrupt Pending
 #define FL_ID		0x00200000	// ID flag
 
+// EFLAGS bits user code may change in its own saved state
+#define FL_USER		(FL_CF|FL_PF|FL_AF|FL_ZF|FL_SF|FL_DF|FL_OF|FL_AC)
+
+
+// CPUID feature flags (CPUID function 1)
+#define CPUID_EDX_PSE	0x00000008	// 4MB pages
+#define CPUID_EDX_TSC	0x00000010	// Time stamp counter
+#define CPUID_EDX_MSR	0x00000020	// RDMSR/WRMSR instructions
+#define CPUID_EDX_APIC	0x00000200	// On-chip local APIC
+#define CPUID_EDX_PGE	0x00002000	// Global pages
+#define CPUID_ECX_MWAIT	0x00000008	// MONITOR/MWAIT instructions
+
+// Extended CPUID feature flags (CPUID function 0x80000001)
+#define CPUID_EXT_EDX_RDTSCP 0x08000000	// RDTSCP instruction
+
+// Model-specific registers
+#define MSR_APIC_BASE	0x0000001b	// Local APIC base address
+#define MSR_TSC_AUX	0xc0000103	// Value RDTSCP returns in ECX
+#define MSR_PMC0	0x000000c1	// Performance counter 0
+#define MSR_PERFEVTSEL0	0x00000186	// Event select for counter 0
+#define MSR_PERF_GLOBAL_STATUS	0x0000038e	// Counter overflow status
+#define MSR_PERF_GLOBAL_CTRL	0x0000038f	// Counter global enables
+#define MSR_PERF_GLOBAL_OVF_CTRL 0x00000390	// Clear overflow status
+
+// Performance event select register bits
+#define PERFEVT_INSNS	0x000000c0	// Event: instructions retired
+#define PERFEVT_USR	0x00010000	// Count in user mode (CPL > 0)
+#define PERFEVT_INT	0x00100000	// Interrupt on overflow
+#define PERFEVT_EN	0x00400000	// Enable counter
+
 
 // Struct containing information returned by the CPUID instruction
 typedef struct cpuinfo {
@@ -285,6 +315,27 @@ xchg(volatile uint32_t *addr, uint32_t newval)
 	return result;
 }
 
+// Atomically set *addr to newval if it currently equals oldval,
+// and return the value *addr had, so that the swap happened iff it's oldval.
+static inline uint32_t
+cmpxchg(volatile uint32_t *addr, uint32_t oldval, uint32_t newval)
+{
+	uint32_t result;
+	asm volatile("lock; cmpxchgl %2, %0" :
+	       "+m" (*addr), "=a" (result) :
+	       "r" (newval), "1" (oldval) :
+	       "cc", "memory");
+	return result;
+}
+
+// Full memory barrier: no later load may be performed before earlier stores,
+// which x86 otherwise allows.
+static inline void
+mfence(void)
+{
+	asm volatile("mfence" : : : "memory");
+}
+
 // Atomically add incr to *addr.
 static inline void
 lockadd(volatile int32_t *addr, int32_t incr)
@@ -312,8 +363,8 @@ xadd(volatile uint32_t *addr, int32_t incr)
 
 	// The + in "+m" denotes a read-modify-write operand.
 	asm volatile("lock; xaddl %0, %1" :
-	       "+m" (*addr), "=a" (result) :
-	       "1" (incr) :
+	       "=a" (result), "+m" (*addr) :
+	       "0" (incr) :
 	       "cc");
 	return result;
 }
@@ -341,6 +392,61 @@ rdtsc(void)
         return tsc;
 }
 
+// Read the TSC together with this processor's MSR_TSC_AUX value,
+// atomically, so the caller knows which processor's TSC it read.
+static gcc_inline uint64_t
+rdtscp(uint32_t *aux)
+{
+	uint64_t tsc;
+	asm volatile("rdtscp" : "=A" (tsc), "=c" (*aux));
+	return tsc;
+}
+
+static gcc_inline uint64_t
+rdmsr(uint32_t msr)
+{
+	uint64_t val;
+	asm volatile("rdmsr" : "=A" (val) : "c" (msr));
+	return val;
+}
+
+static gcc_inline void
+wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr" : : "c" (msr), "A" (val));
+}
+
+// Halt the processor until the next external interrupt.
+static gcc_inline void
+hlt(void)
+{
+	asm volatile("hlt" : : : "memory");
+}
+
+// Atomically enable interrupts and halt:
+// the STI takes effect only after the following instruction,
+// so an interrupt can't sneak in between the two and be missed.
+static gcc_inline void
+sti_hlt(void)
+{
+	asm volatile("sti; hlt" : : : "memory");
+}
+
+// Arm address-range monitoring hardware on the cache line containing addr.
+static gcc_inline void
+monitor(volatile void *addr)
+{
+	asm volatile("monitor" : : "a" (addr), "c" (0), "d" (0));
+}
+
+// Enable interrupts and wait for a write to the monitored cache line
+// or an interrupt, whichever comes first (see sti_hlt above).
+static gcc_inline void
+sti_mwait(uint32_t hints)
+{
+	asm volatile("sti; mwait" : : "a" (hints), "c" (0) : "memory");
+}
+
 // Enable external device interrupts.
 static gcc_inline void
 sti(void)
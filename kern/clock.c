@@ -0,0 +1,154 @@
+/*
+ * Monotonic system clock based on the processor's time stamp counter.
+ *
+ * At boot we measure how fast the TSC and the local APIC timer run
+ * against the PIT, whose input clock frequency is fixed by the PC design.
+ * From then on reading the time costs only an RDTSC and a multiply,
+ * and timers (kern/timer.c) can convert nanoseconds into APIC counts.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/clock.h>
+
+#include <dev/pit.h>
+#include <dev/lapic.h>
+
+
+uint64_t clock_tsc_hz;
+uint64_t clock_lapic_hz;
+uint32_t clock_mult;
+uint32_t clock_shift;
+
+#define CLOCK_CALPIT	(PIT_FREQ / 100)	// Calibrate over 10ms...
+#define CLOCK_CALRUNS	3			// ...taking the median of 3
+
+
+void
+clock_init(void)
+{
+	// Other CPUs just synchronize their TSC offsets with the boot CPU's,
+	// which runs clock_sync_master() in cpu_bootothers() meanwhile.
+	if (!cpu_onboot())
+		return clock_sync_slave();
+
+	cpuinfo inf;
+	cpuid(1, &inf);
+	if (!(inf.edx & CPUID_EDX_TSC))
+		panic("clock_init: processor has no time stamp counter");
+
+	// Count TSC cycles and APIC timer ticks across a fixed PIT interval.
+	// Anything that delays us (an SMI, the host preempting our VCPU)
+	// lengthens a run if it hits while we wait for the PIT, but shortens
+	// it if it hits between starting the PIT and reading our own counters,
+	// so neither the shortest nor the longest run is to be trusted:
+	// take the median.
+	uint64_t cycles[CLOCK_CALRUNS];
+	uint32_t ticks[CLOCK_CALRUNS];
+	int i, j;
+	for (i = 0; i < CLOCK_CALRUNS; i++) {
+		lapic_timer_oneshot(~0);	// won't expire before we stop it
+		pit_oneshot(CLOCK_CALPIT);
+		uint32_t l0 = lapic_timer_count();
+		uint64_t t0 = rdtsc();
+		while (!pit_expired())
+			;
+		uint64_t t1 = rdtsc();
+		uint32_t l1 = lapic_timer_count();
+
+		// Insert this run in order of cycles counted.
+		for (j = i; j > 0 && cycles[j-1] > t1 - t0; j--) {
+			cycles[j] = cycles[j-1];
+			ticks[j] = ticks[j-1];
+		}
+		cycles[j] = t1 - t0;
+		ticks[j] = l0 - l1;
+	}
+	lapic_timer_oneshot(0);
+
+	clock_tsc_hz = cycles[CLOCK_CALRUNS/2] * PIT_FREQ / CLOCK_CALPIT;
+	clock_lapic_hz = (uint64_t) ticks[CLOCK_CALRUNS/2] * PIT_FREQ
+			/ CLOCK_CALPIT;
+	assert(clock_tsc_hz > 0);
+
+	// Pick the most precise conversion factor that fits in 32 bits.
+	for (clock_shift = 32; clock_shift > 0; clock_shift--) {
+		uint64_t mult = (CLOCK_HZ << clock_shift) / clock_tsc_hz;
+		if (mult <= 0xffffffff) {
+			clock_mult = mult;
+			break;
+		}
+	}
+	assert(clock_mult != 0);
+
+	// Start the clock.
+	cpu_cur()->tsc_base = rdtsc();
+
+	cprintf("clock: TSC %d.%03d MHz, LAPIC timer %d.%03d MHz\n",
+		(int) (clock_tsc_hz / 1000000),
+		(int) (clock_tsc_hz / 1000 % 1000),
+		(int) (clock_lapic_hz / 1000000),
+		(int) (clock_lapic_hz / 1000 % 1000));
+}
+
+uint32_t
+clock_ns2lapic(uint64_t ns)
+{
+	// Longer intervals saturate well before the product can overflow.
+	if (ns > 0xffffffff)
+		ns = 0xffffffff;
+	uint64_t count = ns * clock_lapic_hz / CLOCK_HZ;
+	return count > 0xffffffff ? 0xffffffff : count;
+}
+
+
+// A new CPU repeatedly asks the boot CPU what time it is,
+// estimating the offset between their TSCs from the round trip
+// that took the least time, which is the least disturbed.
+#define CLOCK_SYNCROUNDS	16
+
+static volatile uint32_t clock_syncreq;		// Round the slave asks for
+static volatile uint32_t clock_syncack;		// Round the master answered
+static volatile uint64_t clock_synctsc;		// Master's cycles since boot
+
+void
+clock_sync_master(void)
+{
+	cpu *c = cpu_cur();
+	uint32_t i;
+	for (i = 1; i <= CLOCK_SYNCROUNDS; i++) {
+		while (clock_syncreq != i)
+			pause();
+		clock_synctsc = rdtsc() - c->tsc_base;
+		clock_syncack = i;
+	}
+}
+
+void
+clock_sync_slave(void)
+{
+	cpu *c = cpu_cur();
+	uint64_t best = ~0ULL;
+	uint32_t i;
+	for (i = 1; i <= CLOCK_SYNCROUNDS; i++) {
+		uint64_t t0 = rdtsc();
+		clock_syncreq = i;
+		while (clock_syncack != i)
+			pause();
+		uint64_t t1 = rdtsc();
+
+		// Assume the master read its TSC halfway through our round trip.
+		if (t1 - t0 < best) {
+			best = t1 - t0;
+			c->tsc_base = t0 + best / 2 - clock_synctsc;
+		}
+	}
+	clock_syncreq = clock_syncack = 0;	// ready for the next CPU
+}
+
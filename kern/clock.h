@@ -0,0 +1,64 @@
+/*
+ * Monotonic system clock based on the processor's time stamp counter.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_CLOCK_H
+#define PIOS_KERN_CLOCK_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/x86.h>
+#include <inc/sysinfo.h>
+
+#include <kern/cpu.h>
+
+
+#define CLOCK_HZ	1000000000ULL	// The clock counts nanoseconds
+
+
+// Calibrated at boot against the PIT by clock_init().
+extern uint64_t clock_tsc_hz;		// TSC frequency
+extern uint64_t clock_lapic_hz;		// Local APIC timer frequency
+
+// Fixed-point TSC cycles to nanoseconds conversion factor:
+// ns = cycles * clock_mult / 2^clock_shift.
+extern uint32_t clock_mult;
+extern uint32_t clock_shift;
+
+
+// Calibrate the TSC and local APIC timer on the boot CPU,
+// and start the clock at zero.
+void clock_init(void);
+
+// Convert a number of TSC cycles to nanoseconds.
+static gcc_inline uint64_t
+clock_cyc2ns(uint64_t cyc)
+{
+	return sysinfo_cyc2ns(cyc, clock_mult, clock_shift);
+}
+
+// Return the time in nanoseconds since boot.
+// The clock is monotonic and consistent across CPUs:
+// each CPU's TSC is corrected by that CPU's own tsc_base.
+static gcc_inline uint64_t
+clock_ns(void)
+{
+	return clock_cyc2ns(rdtsc() - cpu_cur()->tsc_base);
+}
+
+// Convert a nanosecond interval into a local APIC timer count,
+// saturating at the largest count the timer can hold.
+uint32_t clock_ns2lapic(uint64_t ns);
+
+// Synchronize a newly booted CPU's clock with the boot CPU's:
+// clock_sync_slave() runs on the new CPU while the boot CPU, which must be
+// waiting for it, runs clock_sync_master() to answer its queries.
+void clock_sync_master(void);
+void clock_sync_slave(void);
+
+#endif /* !PIOS_KERN_CLOCK_H */
@@ -1,6 +1,7 @@
 /*
  * Main console driver for PIOS, which manages lower-level console devices
- * such as video (dev/video.*), keyboard (dev/kbd.*), and serial (dev/serial.*)
+ * such as video (dev/video.*), keyboard (dev/kbd.*), serial (dev/serial.*),
+ * and QEMU's debug console (dev/debugcon.*)
  *
  * Copyright (c) 2010 Yale University.
  * Copyright (c) 1993, 1994, 1995 Charles Hannum.
@@ -17,32 +18,59 @@
 #include <inc/x86.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/syscall.h>
 
 #include <kern/cpu.h>
 #include <kern/cons.h>
 #include <kern/mem.h>
+#include <kern/log.h>
+#include <kern/clock.h>
+#include <kern/work.h>
+#include <kern/proc.h>
+#include <kern/futex.h>
+#include <kern/spinlock.h>
 
 #include <dev/video.h>
 #include <dev/kbd.h>
 #include <dev/serial.h>
+#include <dev/debugcon.h>
 
 void cons_intr(int (*proc)(void));
-static void cons_putc(int c);
 
 
 /***** General device-independent console code *****/
 // Here we manage the console input buffer,
 // where we stash characters received from the keyboard or serial port
 // whenever the corresponding interrupt occurs.
+//
+// The buffer is a ring with one producer and one consumer, which need
+// no lock between them.  The producer is whichever device interrupt
+// handler is running: their IRQs all go to the boot CPU, which takes them
+// one at a time.  (Before cons_intenable(), cons_getc() polls the devices
+// itself instead, but only the boot CPU is up then.)  Readers take
+// cons_inlock, which makes them the one consumer.  A process waiting for
+// input waits on the futex at the producer's index (kern/futex.h),
+// and the kernel worker wakes it like any other futex waiter.
 
-#define CONSBUFSIZE 512
+#define CONSBUFSIZE 512		// A power of 2
 
 static struct {
 	uint8_t buf[CONSBUFSIZE];
-	uint32_t rpos;
-	uint32_t wpos;
+	volatile uint32_t rpos;		// Next to read; only under cons_inlock
+	volatile uint32_t wpos;		// Next to write; only the producer
+	uint32_t ndropped;		// Input lost to a full buffer
+	work wake;			// Worker item to wake waiting readers
 } cons;
 
+static spinlock cons_inlock;
+static bool cons_intenabled;		// Input comes by interrupt
+
+
+static void
+cons_wakework(work *w)
+{
+	futex_wake(mem_phys(&cons.wpos), 0x7fffffff);	// all of them
+}
 
 // called by device interrupt routines to feed input characters
 // into the circular console input buffer.
@@ -50,44 +78,167 @@ void
 cons_intr(int (*proc)(void))
 {
 	int c;
+	uint32_t w = cons.wpos;
 
 	while ((c = (*proc)()) != -1) {
 		if (c == 0)
 			continue;
-		cons.buf[cons.wpos++] = c;
-		if (cons.wpos == CONSBUFSIZE)
-			cons.wpos = 0;
+		if (w - cons.rpos == CONSBUFSIZE) {
+			cons.ndropped++;	// keep what's waiting to be read
+			continue;
+		}
+		cons.buf[w++ % CONSBUFSIZE] = c;
 	}
+	if (w == cons.wpos)
+		return;
+
+	// Don't let the compiler publish the input before storing it;
+	// the processor itself keeps stores in order.
+	asm volatile("" : : : "memory");
+	cons.wpos = w;
+	work_queue(&cons.wake, cons_wakework, NULL);
 }
 
 // return the next input character from the console, or 0 if none waiting
 int
 cons_getc(void)
 {
-	int c;
-
 	// poll for any pending input characters,
-	// so that this function works even when interrupts are disabled
-	// (e.g., when called from the kernel monitor).
-	serial_intr();
-	kbd_intr();
+	// so that this function works before input interrupts are enabled.
+	if (!cons_intenabled) {
+		serial_intr();
+		kbd_intr();
+	}
 
 	// grab the next character from the input buffer.
-	if (cons.rpos != cons.wpos) {
-		c = cons.buf[cons.rpos++];
-		if (cons.rpos == CONSBUFSIZE)
-			cons.rpos = 0;
-		return c;
+	int c = 0;
+	spinlock_acquire(&cons_inlock);
+	uint32_t r = cons.rpos;
+	if (r != cons.wpos) {
+		c = cons.buf[r % CONSBUFSIZE];
+		asm volatile("" : : : "memory");	// read it before freeing it
+		cons.rpos = r + 1;
 	}
-	return 0;
+	spinlock_release(&cons_inlock);
+	return c;
+}
+
+void
+cons_wait(proc *p, trapframe *tf)
+{
+	uint32_t w = cons.wpos;
+	if (w != cons.rpos)
+		return;
+	tf->regs.eax = 0;		// what the system call returns if woken
+	futex_wait(p, tf, mem_phys(&cons.wpos), w);
+}
+
+
+/***** Console output sinks *****/
+
+static conssink *cons_sinks;
+
+static void
+cons_serialwrite(const char *str, int n)
+{
+	while (n-- > 0)
+		serial_putc(*str++);
+	serial_start();
+}
+
+static void
+cons_videowrite(const char *str, int n)
+{
+	while (n-- > 0)
+		video_putc(*str++);
+	video_flush();
+}
+
+static conssink cons_debugcon = { "debugcon", debugcon_write };
+static conssink cons_serial = { "serial", cons_serialwrite, serial_flush };
+static conssink cons_video = { "video", cons_videowrite };
+
+void
+cons_addsink(conssink *s)
+{
+	s->enabled = 0;
+	s->next = cons_sinks;
+	cons_sinks = s;
+}
+
+static conssink *
+cons_findsink(const char *name)
+{
+	conssink *s;
+	for (s = cons_sinks; s != NULL; s = s->next)
+		if (strcmp(s->name, name) == 0)
+			return s;
+	return NULL;
+}
+
+bool
+cons_enable(const char *name, bool enabled)
+{
+	conssink *s = cons_findsink(name);
+	if (s == NULL)
+		return 0;
+	s->enabled = enabled;
+	return 1;
+}
+
+bool
+cons_ratelimit(const char *name, uint32_t rate, uint32_t burst)
+{
+	conssink *s = cons_findsink(name);
+	if (s == NULL)
+		return 0;
+	s->rate = rate;
+	s->burst = burst;
+	s->credit = rate ? burst * (CLOCK_HZ / rate) : 0;
+	s->time = clock_ns();
+	return 1;
+}
+
+// Tell sink 's' it missed 'n' bytes.
+static void
+cons_sinkdropped(conssink *s, uint32_t n)
+{
+	char buf[32], *p = &buf[sizeof(buf)];
+	const char *tail = " bytes dropped]\n";
+	p -= strlen(tail);
+	memmove(p, tail, strlen(tail));
+	do {
+		*--p = '0' + n % 10;
+	} while ((n /= 10) != 0);
+	*--p = '[';
+	*--p = '\n';
+	s->write(p, &buf[sizeof(buf)] - p);
 }
 
-// output a character to the console
+// Give sink 's' as much of the 'n' bytes at 'str' as its rate allows.
 static void
-cons_putc(int c)
+cons_sinkwrite(conssink *s, const char *str, int n)
 {
-	serial_putc(c);
-	video_putc(c);
+	uint32_t dropped = s->dropped;	// before this write
+
+	// Until the clock is calibrated, there's no telling the rate.
+	uint64_t cost = s->rate ? CLOCK_HZ / s->rate : 0;
+	if (cost > 0 && clock_tsc_hz != 0) {
+		uint64_t now = clock_ns();
+		s->credit = MIN(s->credit + (now - s->time), s->burst * cost);
+		s->time = now;
+		int ok = MIN((uint64_t) n, s->credit / cost);
+		s->credit -= ok * cost;
+		s->dropped += n - ok;
+		n = ok;
+	}
+	if (n == 0)
+		return;
+	if (dropped > 0) {
+		cons_sinkdropped(s, dropped);
+		s->dropped -= dropped;
+	}
+	s->write(str, n);
 }
 
 // initialize the console devices
@@ -97,22 +248,149 @@ cons_init(void)
 	if (!cpu_onboot())	// only do once, on the boot CPU
 		return;
 
+	spinlock_init(&cons_inlock);
 	video_init();
 	kbd_init();
 	serial_init();
+	debugcon_init();
+
+	cons_addsink(&cons_video);
+	cons_addsink(&cons_serial);
+	cons_addsink(&cons_debugcon);
+
+	// The debug console is only there when the GNUmakefile asks QEMU
+	// for one, in place of the serial port and display, for headless runs.
+	// It's far quicker than either, taking whole strings in one go.
+	if (debugcon_exists)
+		cons_enable("debugcon", 1);
+	else {
+		cons_enable("serial", 1);
+		cons_enable("video", 1);
+	}
 
 	if (!serial_exists)
 		warn("Serial port does not exist!\n");
 }
 
+void
+cons_intenable(void)
+{
+	if (!cpu_onboot())
+		return;
+	serial_intenable();
+	kbd_intenable();
+	cons_intenabled = 1;
+}
+
+void
+cons_flush(void)
+{
+	if (read_cs() & 3)
+		return;		// the kernel does so before it halts
+	log_flush();
+
+	// Even disabled sinks may have output from before, or from elsewhere.
+	conssink *s;
+	for (s = cons_sinks; s != NULL; s = s->next)
+		if (s->flush != NULL)
+			s->flush();
+}
+
+
+void
+cons_write(const char *str, int n)
+{
+	conssink *s;
+	for (s = cons_sinks; s != NULL; s = s->next)
+		if (s->enabled)
+			cons_sinkwrite(s, str, n);
+}
 
 // `High'-level console I/O.  Used by readline and cprintf.
+// Goes through the kernel log, which calls cons_write() in its own time.
 void
 cputs(const char *str)
 {
-	char ch;
-	while (*str)
-		cons_putc(*str++);
+	log_write(LOG_INFO, str);
 }
 
+// A sink that keeps what it's given, for cons_check().
+static char cons_checkbuf[64];
+static int cons_checklen;
+
+static void
+cons_checkwrite(const char *str, int n)
+{
+	assert(cons_checklen + n <= sizeof(cons_checkbuf));
+	memmove(&cons_checkbuf[cons_checklen], str, n);
+	cons_checklen += n;
+}
+
+// Input for cons_check(): 'cons_checkin' more characters, then none.
+static int cons_checkin;
+
+static int
+cons_checkproc(void)
+{
+	if (cons_checkin == 0)
+		return -1;
+	return 'a' + --cons_checkin % 26;
+}
 
+void
+cons_check(void)
+{
+	assert(cpu_onboot());
+
+	// Sinks are there to find by name, and keep their settings.
+	assert(cons_findsink("serial") == &cons_serial);
+	assert(cons_findsink("no such sink") == NULL);
+	assert(!cons_enable("no such sink", 1));
+	bool on = cons_video.enabled;
+	assert(cons_enable("video", !on) && cons_video.enabled == !on);
+	assert(cons_enable("video", on) && cons_video.enabled == on);
+
+	// Without a limit, a sink takes everything.
+	conssink s = { "check", cons_checkwrite };
+	cons_sinkwrite(&s, "hello", 5);
+	assert(cons_checklen == 5 && s.dropped == 0);
+
+	// At one byte a second, it takes a burst and drops the rest...
+	s.rate = 1;
+	s.burst = 8;
+	s.credit = s.burst * CLOCK_HZ;
+	s.time = clock_ns();
+	cons_sinkwrite(&s, "world!", 6);
+	cons_sinkwrite(&s, "world!", 6);
+	assert(cons_checklen == 13 && s.dropped == 4);
+	cons_sinkwrite(&s, "x", 1);
+	assert(cons_checklen == 13 && s.dropped == 5);
+
+	// ... until a few seconds later, when it says how much it dropped.
+	s.time -= 3 * CLOCK_HZ;
+	cons_sinkwrite(&s, "xyz", 3);
+	const char *want = "helloworld!wo\n[5 bytes dropped]\nxyz";
+	assert(cons_checklen == strlen(want));
+	assert(memcmp(cons_checkbuf, want, cons_checklen) == 0);
+	assert(s.dropped == 0);
+
+	// Input that doesn't fit is counted and dropped,
+	// leaving what was there first to be read in order.
+	while (cons_getc() != 0)
+		;		// whatever someone typed
+	uint32_t dropped = cons.ndropped;
+	int n = CONSBUFSIZE + 10, i;
+	cons_checkin = n;
+	cons_intr(cons_checkproc);
+	assert(cons.ndropped == dropped + 10);
+	assert(cons.wake.queued);
+	for (i = 0; i < CONSBUFSIZE; i++)
+		assert(cons_getc() == 'a' + (n - 1 - i) % 26);
+	assert(cons_getc() == 0);
+
+	// The worker wakes any readers, though there are none yet.
+	work_run();
+	assert(!cons.wake.queued);
+
+	cprintf("cons_check() succeeded!\n");
+}
@@ -19,13 +19,32 @@
 #endif
 
 #include <inc/types.h>
+#include <inc/trap.h>
 
 
 #define DEBUG_TRACEFRAMES	10
 
 struct iocons;
+struct proc;
 
 
+// A console output device.  cons_write() gives every enabled sink
+// the same output, at no more than 'rate' bytes a second on average
+// after a first 'burst', dropping what goes over and saying how much
+// once the sink can take more.
+typedef struct conssink {
+	const char	*name;
+	void		(*write)(const char *str, int n);
+	void		(*flush)(void);	// Wait for output to go out, or NULL
+	bool		enabled;
+	uint32_t	rate;		// Bytes per second, or 0 for no limit
+	uint32_t	burst;		// Bytes it can take all at once
+	uint64_t	credit;		// Nanoseconds' worth it can take now
+	uint64_t	time;		// When we last added to it, by clock_ns()
+	uint32_t	dropped;	// Bytes dropped since it last took any
+	struct conssink	*next;
+} conssink;
+
 
 void cons_init(void);
 
@@ -38,5 +57,31 @@ void cons_intr(int (*proc)(void));
 // Called by init() when the kernel is ready to receive console interrupts.
 void cons_intenable(void);
 
+// Return the next character of console input, or 0 if there is none yet.
+int cons_getc(void);
+
+// Block process 'p', which made system call 'tf' to read console input,
+// until there is some, unless there is already.
+// If it blocks, the system call returns 0 once it is woken.
+void cons_wait(struct proc *p, trapframe *tf);
+
+// Write 'n' bytes at 'str' to each enabled console sink.  Only the kernel log
+// (kern/log.c) calls this, serializing it with its flush lock.
+void cons_write(const char *str, int n);
+
+// Wait until all console output has gone out, before halting.
+void cons_flush(void);
+
+// Add a sink for console output, disabled until cons_enable().
+void cons_addsink(conssink *s);
+
+// Enable or disable the sink called 'name',
+// or limit the rate at which it takes output: see conssink.
+// Both return false if there is no such sink.
+bool cons_enable(const char *name, bool enabled);
+bool cons_ratelimit(const char *name, uint32_t rate, uint32_t burst);
+
+void cons_check(void);
+
 
 #endif /* PIOS_KERN_CONSOLE_H_ */
@@ -8,15 +8,27 @@
  * Primary author: Bryan Ford
  */
 
+#include <inc/stdio.h>
 #include <inc/assert.h>
 #include <inc/string.h>
 
 #include <kern/mem.h>
 #include <kern/cpu.h>
 #include <kern/init.h>
+#include <kern/timer.h>
+#include <kern/work.h>
+#include <kern/clock.h>
+#include <kern/proc.h>
+#include <kern/pmap.h>
+#include <kern/sysinfo.h>
+#include <kern/trace.h>
 
+#include <dev/lapic.h>
 
 
+// True if the processor supports MONITOR/MWAIT, which cpu_halt() prefers.
+static bool cpu_mwait;
+
 cpu cpu_boot = {
 
 	// Global descriptor table for bootstrap CPU.
@@ -78,8 +90,216 @@ void cpu_init()
     //init TSS
     c->tss.ts_ss0 = CPU_GDT_KDATA;
     c->tss.ts_esp0 = (uintptr_t)(c->kstackhi);
-    c->gdt[CPU_GDT_TSS >> 3] = SEGDESC16(0, STS_T32A, (uintptr_t)(&c->tss), sizeof(c->tss)-1, 0);
+	c->tss.ts_iomb = offsetof(cpu, iomap) - offsetof(cpu, tss);
+	memset(c->iomap, 0xff, sizeof(c->iomap));	// no ports granted
+	c->ioproc = NULL;
+    c->gdt[CPU_GDT_TSS >> 3] = SEGDESC16(0, STS_T32A, (uintptr_t)(&c->tss),
+			c->tss.ts_iomb + sizeof(c->iomap) - 1, 0);
     ltr(CPU_GDT_TSS);
+
+	// Prefer MONITOR/MWAIT for idling if this processor supports it.
+	if (cpu_onboot()) {
+		cpuinfo inf;
+		cpuid(1, &inf);
+		cpu_mwait = (inf.ecx & CPUID_ECX_MWAIT) != 0;
+	}
+	c->idle_base = rdtsc();
+}
+
+// Allocate an additional cpu struct representing a non-bootstrap processor.
+cpu *
+cpu_alloc(void)
+{
+	// Pointer to the cpu.next pointer of the last CPU on the list,
+	// for chaining on new CPUs in cpu_alloc().  Note: static.
+	static cpu **cpu_tail = &cpu_boot.next;
+	static uint8_t cpu_nextid = 1;
+
+	if (cpu_nextid >= CPU_MAX)
+		return NULL;
+	pageinfo *pi = mem_alloc();
+	if (pi == NULL)
+		return NULL;
+
+	// Initialize the new cpu struct to all zeros.
+	cpu *c = (cpu*) mem_pi2ptr(pi);
+	memset(c, 0, PAGESIZE);
+
+	// Copy the GDT from the bootstrap CPU's cpu struct;
+	// cpu_init() fixes up its TSS descriptor.
+	memmove(c->gdt, cpu_boot.gdt, sizeof(c->gdt));
+
+	// Magic verification tag for stack overflow/cpu corruption checking
+	c->magic = CPU_MAGIC;
+	c->id = cpu_nextid++;
+
+	// Chain the new CPU onto the tail of the list.
+	*cpu_tail = c;
+	cpu_tail = &c->next;
+
+	return c;
+}
+
+void
+cpu_bootothers(void)
+{
+	extern uint8_t _binary_obj_boot_bootother_start[],
+			_binary_obj_boot_bootother_size[];
+
+	if (!cpu_onboot()) {
+		// Just inform the boot cpu we've booted.
+		cpu_cur()->booted = 1;
+		return;
+	}
+	cpu_boot.booted = 1;
+
+	// Write bootstrap code to unused memory at 0x1000.
+	uint8_t *code = (uint8_t*)0x1000;
+	memmove(code, _binary_obj_boot_bootother_start,
+		(uint32_t)_binary_obj_boot_bootother_size);
+
+	cpu *c;
+	for(c = &cpu_boot; c; c = c->next){
+		if(c == cpu_cur())  // We've started already.
+			continue;
+
+		// Fill in %esp, %eip and start code on cpu.
+		*(void**)(code-4) = c->kstackhi;
+		*(void**)(code-8) = init;
+		lapic_startap(c->apicid, mem_phys(code));
+
+		// Answer its clock synchronization queries (see clock_init),
+		// then wait for it to finish initializing.
+		clock_sync_master();
+		while(c->booted == 0)
+			pause();
+	}
+}
+
+void
+cpu_halt(void)
+{
+	assert(!(read_eflags() & FL_IF));
+	cpu *c = cpu_cur();
+
+	c->idle_halts++;
+	sysinfo_page->cpu[c->id].halts++;
+	if (c->idle_start == 0)		// cpu_idle() may have set it already
+		c->idle_start = rdtsc();
+
+	// Once other CPUs can see we're idle, make sure nobody has
+	// kicked us (cpu_kick) before we halt: it may have work for us.
+	mfence();
+	TRACE(halt, 0, 0, 0, 0);
+	if (cpu_mwait) {
+		// Another CPU can wake us just by writing c->idle_wake,
+		// without the cost of an IPI.
+		monitor(&c->idle_wake);
+		if (!c->idle_wake)
+			sti_mwait(0);
+	} else if (!c->idle_wake)
+		sti_hlt();
+	cli();
+	TRACE(wake, 0, 0, 0, 0);
+
+	cpu_wake(c);		// in case no interrupt did it already
+	c->idle_woke = 0;
+	c->idle_wake = 0;
+}
+
+void
+cpu_wake(cpu *c)
+{
+	if (c->idle_start == 0)
+		return;
+	c->idle_cycles += rdtsc() - c->idle_start;
+	c->idle_start = 0;
+	c->idle_woke = 1;
+}
+
+void
+cpu_kick(void)
+{
+	// Make whatever work we just created visible before we look for
+	// idle CPUs; an idle CPU looks for work only after it marks itself
+	// idle, so one of us will always see the other.
+	mfence();
+
+	cpu *self = cpu_cur(), *c;
+	for (c = &cpu_boot; c != NULL; c = c->next) {
+		if (c == self || c->idle_start == 0)
+			continue;	// not idle
+		if (xchg(&c->idle_wake, 1) != 0)
+			continue;	// already kicked by someone else
+		if (!cpu_mwait)
+			lapic_ipi(c->apicid, T_IPI);
+		return;
+	}
+}
+
+void
+cpu_poke(cpu *c)
+{
+	mfence();
+	if (c->idle_start != 0) {
+		if (xchg(&c->idle_wake, 1) == 0 && !cpu_mwait)
+			lapic_ipi(c->apicid, T_IPI);
+	} else
+		lapic_ipi(c->apicid, T_IPI);
+}
+
+void gcc_noreturn
+cpu_idle(void)
+{
+	cpu *c = cpu_cur();
+	cli();
+	c->proc = NULL;
+
+	// Stop using the last process's page tables, which its parent may
+	// change once it's stopped, so no stale TLB entries survive for it.
+	if (rcr3() != mem_phys(pmap_bootpdir))
+		lcr3(mem_phys(pmap_bootpdir));
+
+	while (1) {
+		// Kernel work comes before user processes.
+		work_run();
+
+		// Mark ourselves idle before we look for a process to run
+		// (see cpu_kick), and halt if we don't find one.
+		if (c->idle_start == 0)
+			c->idle_start = rdtsc();
+		mfence();
+		proc_sched();
+		pmap_mergehelp();
+
+		cpu *busy = cpu_busy();
+		if (busy)
+			timer_migrate(busy);
+		cpu_halt();
+	}
+}
+
+cpu *
+cpu_busy(void)
+{
+	cpu *self = cpu_cur(), *c;
+	for (c = &cpu_boot; c != NULL; c = c->next)
+		if (c != self && c->booted && c->idle_start == 0)
+			return c;
+	return NULL;
+}
+
+void
+cpu_idlestats(void)
+{
+	cpu *c = cpu_cur();
+	uint64_t total = rdtsc() - c->idle_base;
+	uint64_t avg = c->wake_timers ? c->wake_lat_total / c->wake_timers : 0;
+	cprintf("cpu %p: idle %d%% over %d halts (%s), "
+		"timer wakeups %d lat avg %dns max %dns\n",
+		c, (int) (c->idle_cycles * 100 / (total ? total : 1)),
+		c->idle_halts, cpu_mwait ? "mwait" : "hlt",
+		c->wake_timers, (int) avg, (int) c->wake_lat_max);
 }
 
 
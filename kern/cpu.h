@@ -23,6 +23,10 @@
 #define CPU_GDT_TSS	0x30	// task state segment
 #define CPU_GDT_NDESC	7	// number of GDT entries used, including null
 
+// User processes can claim I/O ports below this (see kern/udev.h);
+// the TSS I/O permission bitmap denies all the ports above it.
+#define CPU_IOPORTS	0x400
+
 
 #ifndef __ASSEMBLER__
 
@@ -32,6 +36,8 @@
 #include <inc/mmu.h>
 #include <inc/trap.h>
 
+#include <kern/timer.h>
+
 
 // Per-CPU kernel state structure.
 // Exactly one page (4096 bytes) in size.
@@ -48,10 +54,55 @@ typedef struct cpu {
 	// for the higher privilege level from this task state structure.
 	taskstate	tss;
 
+	// The TSS's I/O permission bitmap, granting the process running here
+	// the I/O ports it has claimed (kern/udev.c): a clear bit grants a port.
+	// User mode runs with IOPL 0, so these bits alone decide its access.
+	// The processor may read one byte past the bitmap; it must be 0xff.
+	uint8_t		iomap[CPU_IOPORTS/8 + 1];
+
 	// When non-NULL, all traps get diverted to this handler.
 	gcc_noreturn void (*recover)(trapframe *tf, void *recoverdata);
 	void		*recoverdata;
 
+	// Chain of all CPU structures, starting with cpu_boot.
+	struct cpu	*next;
+
+	// Small integer index of this CPU (cpu_boot is 0),
+	// for finding per-CPU state kept outside of this page.
+	uint8_t		id;
+
+	// Local APIC ID of this CPU, for sending it interrupts.
+	uint8_t		apicid;
+
+	// Set by the CPU itself once it has finished initializing.
+	volatile bool	booted;
+
+	// The process currently running on this CPU, if any.
+	struct proc	*proc;
+
+	// Preemption state for the current process (kern/proc.c).
+	uint32_t	perf_armed;	// Instruction count we armed, if any
+	timer		quantum;	// Time slice timer, without perf_icnt
+	volatile bool	preempt;	// Time slice is up
+	struct proc *volatile gang_next; // Gang member to run here next
+	uint32_t	tls;		// Base of our CPU_GDT_UDTLS segment
+	struct proc	*ioproc;	// Process whose ports iomap grants
+	uint32_t	iogen;		// ... as of this claim generation
+
+	// This CPU's TSC value at clock time zero (kern/clock.c).
+	uint64_t	tsc_base;
+
+	// Idle loop state and statistics.
+	volatile uint32_t idle_wake;	// Write to wake this CPU from MWAIT
+	uint64_t	idle_start;	// TSC when we last halted; 0 if running
+	bool		idle_woke;	// Woken from halt, latency not yet seen
+	uint64_t	idle_base;	// TSC when we started counting
+	uint64_t	idle_cycles;	// Total TSC cycles spent halted
+	uint32_t	idle_halts;	// Number of times we halted
+	uint32_t	wake_timers;	// Timer expiries that woke us up
+	uint64_t	wake_lat_total;	// Sum of timer wakeup latencies in ns
+	uint64_t	wake_lat_max;	// Worst timer wakeup latency in ns
+
 	// Magic verification tag (CPU_MAGIC) to help detect corruption,
 	// e.g., if the CPU's ring 0 stack overflows down onto the cpu struct.
 	uint32_t	magic;
@@ -65,6 +116,8 @@ typedef struct cpu {
 
 #define CPU_MAGIC	0x98765432	// cpu.magic should always = this
 
+#define CPU_MAX		32		// Maximum number of CPUs supported
+
 
 // We have one statically-allocated cpu struct representing the boot CPU;
 // others get chained onto this via cpu_boot.next as we find them.
@@ -95,11 +148,41 @@ void cpu_init(void);
 
 // Allocate an additional cpu struct representing a non-bootstrap processor,
 // and chain it onto the list of all CPUs.
+// Returns NULL if we're out of memory or already have CPU_MAX CPUs.
 cpu *cpu_alloc(void);
 
 // Get any additional processors booted up and running.
 void cpu_bootothers(void);
 
+// Halt the current CPU with interrupts enabled until something wakes it,
+// using MONITOR/MWAIT if the processor supports it and HLT otherwise.
+// Must be called with interrupts disabled; returns with them disabled.
+void cpu_halt(void);
+
+// Called on trap entry to end the idle period of a halted CPU.
+void cpu_wake(cpu *c);
+
+// Make sure some other CPU that is halted, if any, wakes up
+// and looks for something to do, such as a newly ready process.
+void cpu_kick(void);
+
+// Get CPU 'c''s attention, whether it is halted or running,
+// so that it checks its gang_next.
+void cpu_poke(cpu *c);
+
+// Run processes as they become ready, forever, halting in between
+// and letting interrupts and timers do whatever work comes up.
+// Runs the CPU's kernel work queue (kern/work.h) before any process.
+// An idle CPU hands its pending timers to a busy one if it can,
+// so that it stays halted for as long as possible.
+void cpu_idle(void) gcc_noreturn;
+
+// Find some other CPU that is currently busy (not halted), if any.
+cpu *cpu_busy(void);
+
+// Print the current CPU's idle residency and wakeup latency statistics.
+void cpu_idlestats(void);
+
 #endif	// ! __ASSEMBLER__
 
 #endif // PIOS_KERN_CPU_H
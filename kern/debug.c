@@ -16,6 +16,8 @@
 #include <kern/cons.h>
 #include <kern/debug.h>
 #include <kern/init.h>
+#include <kern/log.h>
+#include <kern/trace.h>
 
 
 // Variable panicstr contains argument to first call to panic; used as flag
@@ -39,9 +41,9 @@ debug_panic(const char *file, int line, const char *fmt,...)
 
 	// First print the requested message
 	va_start(ap, fmt);
-	cprintf("kernel panic at %s:%d: ", file, line);
-	vcprintf(fmt, ap);
-	cprintf("\n");
+	log_printf(LOG_PANIC, "kernel panic at %s:%d: ", file, line);
+	vlog_printf(LOG_PANIC, fmt, ap);
+	log_printf(LOG_PANIC, "\n");
 	va_end(ap);
 
 	// Then print a backtrace of the kernel call chain
@@ -51,6 +53,8 @@ debug_panic(const char *file, int line, const char *fmt,...)
 		cprintf("  from %08x\n", eips[i]);
 
 dead:
+	trace_done();
+	cons_flush();
 	done();		// enter infinite loop (see kern/init.c)
 }
 
@@ -61,9 +65,9 @@ debug_warn(const char *file, int line, const char *fmt,...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	cprintf("kernel warning at %s:%d: ", file, line);
-	vcprintf(fmt, ap);
-	cprintf("\n");
+	log_printf(LOG_WARN, "kernel warning at %s:%d: ", file, line);
+	vlog_printf(LOG_WARN, fmt, ap);
+	log_printf(LOG_WARN, "\n");
 	va_end(ap);
 }
 
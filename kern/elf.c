@@ -0,0 +1,360 @@
+/*
+ * Demand-paged loading of ELF executables embedded in the kernel image.
+ *
+ * Loading an executable maps none of it: we just note where each
+ * loadable segment goes, and fill in each page the first time
+ * the process touches it, so startup costs depend on the pages
+ * a program uses, not on the size of its image.
+ *
+ * - A page wholly within a segment's file contents maps the image's
+ *   own page, shared by every process running the executable, with
+ *   no copying at all.  The kernel image is never freed, so we keep an
+ *   extra reference to each such page: a write to a writable one
+ *   then always gets a copy-on-write copy (see pmap_pagefault()).
+ *   For an executable in the initial ramdisk, that's the page as
+ *   initrd_page() decompresses it, which its page cache holds onto.
+ * - A page past the file contents, as in bss or the stack,
+ *   maps the zero page, copied on write like any other.
+ * - A page the process is about to write, or one only partly
+ *   backed by the file, or one whose image page isn't page-aligned
+ *   (when the image isn't), gets a private copy straight away.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/elf.h>
+#include <inc/syscall.h>
+#include <inc/sysinfo.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/proc.h>
+#include <kern/pmap.h>
+#include <kern/trap.h>
+#include <kern/initrd.h>
+#include <kern/elf.h>
+#include <kern/sysinfo.h>
+
+
+// Narrow segment 's' to its part within [lo,hi).
+// Returns false if nothing is left of it.
+static bool
+elf_clip(elfseg *s, uint32_t lo, uint32_t hi)
+{
+	if (s->va < lo) {
+		s->foff += lo - s->va;
+		s->va = lo;
+	}
+	if (s->eva > hi)
+		s->eva = hi;
+	if (s->va >= s->eva)
+		return 0;
+	s->fend = MAX(s->fend, s->va);
+	s->fend = MIN(s->fend, s->eva);
+	return 1;
+}
+
+static bool
+elf_addseg(proc *p, const elfseg *s)
+{
+	int i;
+	for (i = 0; i < ELF_MAXSEG; i++)
+		if (p->elf[i].eva == 0) {
+			p->elf[i] = *s;
+			return 1;
+		}
+	return 0;
+}
+
+// Set up process 'p' to load the executable of 'size' bytes
+// that is either 'img' or 'f', from its headers in the first 'hsize'
+// bytes at 'hdr'.
+static bool
+elf_setup(proc *p, const uint8_t *hdr, size_t hsize, size_t size,
+		const uint8_t *img, const initrd_file *f)
+{
+	const elfhdr *eh = (const elfhdr*) hdr;
+	if (hsize < sizeof(elfhdr) || eh->e_magic != ELF_MAGIC ||
+			eh->e_phentsize != sizeof(proghdr) ||
+			eh->e_phoff > hsize ||
+			eh->e_phnum > (hsize - eh->e_phoff) / sizeof(proghdr))
+		return 0;
+
+	pmap_remove(p->pdir, VM_USERLO, VM_USERHI - VM_USERLO);
+	memset(p->elf, 0, sizeof(p->elf));
+
+	const proghdr *ph = (const proghdr*) (hdr + eh->e_phoff);
+	int i;
+	for (i = 0; i < eh->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD || ph->p_memsz == 0)
+			continue;
+		if (ph->p_va < VM_USERLO || ph->p_va >= ELF_STACKLO ||
+				ph->p_memsz > ELF_STACKLO - ph->p_va ||
+				ph->p_filesz > ph->p_memsz ||
+				ph->p_offset > size ||
+				ph->p_filesz > size - ph->p_offset ||
+				PGOFF(ph->p_offset) != PGOFF(ph->p_va))
+			return 0;
+
+		elfseg s;
+		s.va = ROUNDDOWN(ph->p_va, PAGESIZE);
+		s.eva = ROUNDUP(ph->p_va + ph->p_memsz, PAGESIZE);
+		s.fend = ph->p_va + ph->p_filesz;
+		s.foff = ph->p_offset - PGOFF(ph->p_va);
+		s.image = img;
+		s.file = f;
+		s.perm = ph->p_flags & ELF_PROG_FLAG_WRITE ? SYS_RW : SYS_READ;
+		if (!elf_addseg(p, &s))
+			return 0;
+	}
+
+	elfseg stack = { ELF_STACKLO, ELF_STACKHI, ELF_STACKLO, 0,
+			NULL, NULL, SYS_RW };
+	if (!elf_addseg(p, &stack))
+		return 0;
+
+	p->sv.tf.eip = eh->e_entry;
+	p->sv.tf.esp = ELF_STACKHI;
+	return 1;
+}
+
+bool
+elf_load(proc *p, const void *image, size_t size)
+{
+	// The image must stay where it is for as long as processes
+	// map pages of it, so it must be part of the kernel image.
+	const uint8_t *img = image;
+	if (img < (uint8_t*) start || img > (uint8_t*) end ||
+			size > (uint8_t*) end - img)
+		return 0;
+	return elf_setup(p, img, size, size, img, NULL);
+}
+
+bool
+elf_loadfile(proc *p, const initrd_file *f)
+{
+	// The headers must be in the first page, which we need right away.
+	if (f->size == 0)
+		return 0;
+	pageinfo *pi = initrd_page(f, 0);
+	if (pi == NULL)
+		return 0;
+	return elf_setup(p, mem_pi2ptr(pi), MIN(f->size, PAGESIZE), f->size,
+			NULL, f);
+}
+
+void
+elf_copysegs(proc *sp, uint32_t sva, proc *dp, uint32_t dva, size_t size)
+{
+	uint32_t lo = dva, hi = dva + size;
+	int i;
+
+	// Forget the destination's segments there, but not the parts
+	// outside the region, except for the top part of one that
+	// sticks out both ends when there's no free slot for it.
+	for (i = 0; i < ELF_MAXSEG; i++) {
+		elfseg *s = &dp->elf[i];
+		if (s->eva == 0 || s->eva <= lo || s->va >= hi)
+			continue;
+		elfseg above = *s;
+		if (!elf_clip(s, 0, lo))
+			s->eva = 0;
+		if (elf_clip(&above, hi, VM_USERHI))
+			elf_addseg(dp, &above);
+	}
+
+	if (sp == NULL)
+		return;
+	for (i = 0; i < ELF_MAXSEG; i++) {
+		elfseg s = sp->elf[i];
+		if (s.eva == 0 || !elf_clip(&s, sva, sva + size))
+			continue;
+		s.va += dva - sva;
+		s.eva += dva - sva;
+		s.fend += dva - sva;
+		elf_addseg(dp, &s);
+	}
+}
+
+void
+elf_pagefault(trapframe *tf)
+{
+	uint32_t fva = rcr2();
+	proc *p = proc_cur();
+	if (p == NULL || fva < VM_USERLO || fva >= VM_USERHI)
+		return;
+
+	elfseg *s;
+	int i;
+	for (i = 0; i < ELF_MAXSEG; i++) {
+		s = &p->elf[i];
+		if (fva >= s->va && fva < s->eva)
+			break;
+	}
+	if (i == ELF_MAXSEG)
+		return;
+
+	// Only a page nothing has touched yet is ours to fill in.
+	pte_t *pte = pmap_walk(p->pdir, fva, 1);
+	if (pte == NULL || *pte != PTE_ZERO)
+		return;
+
+	// Find the executable's contents for the page, if any.
+	uint32_t va = ROUNDDOWN(fva, PAGESIZE);
+	uint32_t off = s->foff + (va - s->va);
+	const uint8_t *src = NULL;
+	pageinfo *srcpi = NULL;		// the page 'src' is, if it's a whole one
+	if (va < s->fend && s->file != NULL) {
+		srcpi = initrd_page(s->file, off / PAGESIZE);
+		if (srcpi == NULL)
+			return;		// out of memory: treat it as a real fault
+		src = mem_pi2ptr(srcpi);
+	} else if (va < s->fend) {
+		src = s->image + off;
+		if (PGOFF(src) == 0) {
+			srcpi = mem_ptr2pi(src);
+			if (srcpi->refcount == 0)
+				mem_incref(srcpi);	// the image's own reference
+		}
+	}
+
+	bool writing = (tf->err & PFE_WR) && (s->perm & SYS_WRITE);
+	sysinfo_cpu *sc = &sysinfo_page->cpu[cpu_cur()->id];
+	if (va >= s->fend && !writing)
+		*pte = PTE_ZERO | PTE_P | PTE_U | s->perm;
+	else if (va + PAGESIZE <= s->fend && srcpi != NULL && !writing) {
+		mem_incref(srcpi);
+		*pte = mem_pi2phys(srcpi) | PTE_P | PTE_U | s->perm;
+		sc->pagemaps++;
+	} else {
+		pageinfo *pi = mem_alloc();
+		if (pi == NULL)
+			return;		// out of memory: treat it as a real fault
+		mem_incref(pi);
+		uint8_t *pg = mem_pi2ptr(pi);
+		size_t n = va < s->fend ? MIN(PAGESIZE, s->fend - va) : 0;
+		memmove(pg, src, n);
+		memset(pg + n, 0, PAGESIZE - n);
+		*pte = mem_pi2phys(pi) | PTE_P | PTE_U | s->perm |
+			(s->perm & SYS_WRITE ? PTE_W : 0);
+	}
+	sc->pageins++;
+	pmap_inval(p->pdir, va, PAGESIZE);
+	trap_return(tf);
+}
+
+
+// A tiny executable, built at run time: a text segment much bigger
+// than the one page of it the program runs, and a data segment
+// holding one word, followed by bss.
+#define ELFCHECK_TEXTPAGES	32
+#define ELFCHECK_TEXT		VM_USERLO
+#define ELFCHECK_DATA		(VM_USERLO + PTSIZE)
+#define ELFCHECK_BSS		(ELFCHECK_DATA + PAGESIZE)
+#define ELFCHECK_WORD		0x1234
+#define ELFCHECK_TOUCHED	4	// Pages the program touches
+#define ELFCHECK_RUNS		2
+
+static uint8_t elf_checkimg[(ELFCHECK_TEXTPAGES + 2) * PAGESIZE]
+	gcc_aligned(PAGESIZE);
+
+// Append little-endian word 'w' to the code at 'pc'.
+static uint8_t *
+elf_checkword(uint8_t *pc, uint32_t w)
+{
+	memmove(pc, &w, 4);
+	return pc + 4;
+}
+
+static void
+elf_checkbuild(void)
+{
+	uint8_t *img = elf_checkimg;
+	memset(img, 0, sizeof(elf_checkimg));
+
+	elfhdr *eh = (elfhdr*) img;
+	eh->e_magic = ELF_MAGIC;
+	eh->e_entry = ELFCHECK_TEXT;
+	eh->e_phoff = sizeof(elfhdr);
+	eh->e_phentsize = sizeof(proghdr);
+	eh->e_phnum = 2;
+
+	proghdr *ph = (proghdr*) (img + eh->e_phoff);
+	ph[0].p_type = ELF_PROG_LOAD;
+	ph[0].p_offset = PAGESIZE;
+	ph[0].p_va = ELFCHECK_TEXT;
+	ph[0].p_filesz = ph[0].p_memsz = ELFCHECK_TEXTPAGES * PAGESIZE;
+	ph[0].p_flags = ELF_PROG_FLAG_READ | ELF_PROG_FLAG_EXEC;
+	ph[1].p_type = ELF_PROG_LOAD;
+	ph[1].p_offset = (1 + ELFCHECK_TEXTPAGES) * PAGESIZE;
+	ph[1].p_va = ELFCHECK_DATA;
+	ph[1].p_filesz = 4;
+	ph[1].p_memsz = 2 * PAGESIZE;
+	ph[1].p_flags = ELF_PROG_FLAG_READ | ELF_PROG_FLAG_WRITE;
+	*(uint32_t*) (img + ph[1].p_offset) = ELFCHECK_WORD;
+
+	// Read the data word, store it plus one in bss and on the stack,
+	// and return it in EBX.
+	uint8_t *pc = img + PAGESIZE;
+	*pc++ = 0xa1;					// movl DATA,%eax
+	pc = elf_checkword(pc, ELFCHECK_DATA);
+	*pc++ = 0x83; *pc++ = 0xc0; *pc++ = 0x01;	// addl $1,%eax
+	*pc++ = 0xa3;					// movl %eax,BSS
+	pc = elf_checkword(pc, ELFCHECK_BSS);
+	*pc++ = 0x50;					// pushl %eax
+	*pc++ = 0x89; *pc++ = 0xc3;			// movl %eax,%ebx
+	*pc++ = 0xb8;					// movl $SYS_RET,%eax
+	pc = elf_checkword(pc, SYS_RET);
+	*pc++ = 0xcd; *pc++ = T_SYSCALL;		// int $T_SYSCALL
+}
+
+static void
+elf_checkcounts(uint32_t *ins, uint32_t *maps)
+{
+	const volatile sysinfo *si = SYSINFO;
+	*ins = *maps = 0;
+	int i;
+	for (i = 0; i < si->ncpu; i++) {
+		*ins += si->cpu[i].pageins;
+		*maps += si->cpu[i].pagemaps;
+	}
+}
+
+// Runs in user mode, as part of the root process.
+void
+elf_check_user(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	elf_checkbuild();
+
+	uint64_t cycles = 0;
+	int run;
+	for (run = 0; run < ELFCHECK_RUNS; run++) {
+		uint32_t ins0, maps0, ins1, maps1;
+		elf_checkcounts(&ins0, &maps0);
+		uint64_t t0 = rdtsc();
+		sys_put(SYS_EXEC | SYS_START, 0, NULL,
+			elf_checkimg, NULL, sizeof(elf_checkimg));
+		procstate ps;
+		sys_get(SYS_REGS, 0, &ps, NULL, NULL, 0);
+		cycles += rdtsc() - t0;
+		elf_checkcounts(&ins1, &maps1);
+
+		assert(ps.tf.trapno == T_SYSCALL);
+		assert(ps.tf.regs.ebx == ELFCHECK_WORD + 1);
+		assert(ps.tf.esp == ELF_STACKHI - 4);
+		assert(ins1 - ins0 == ELFCHECK_TOUCHED);
+		assert(maps1 - maps0 == 1);	// just the text page
+	}
+
+	cprintf("elf_check: %d-page executable started and ran in %lldns, "
+		"touching %d pages\n", ELFCHECK_TEXTPAGES + 2,
+		cycles * 1000000000ULL / (si->tsc_hz * ELFCHECK_RUNS),
+		ELFCHECK_TOUCHED);
+	cprintf("elf_check_user() succeeded!\n");
+}
@@ -0,0 +1,68 @@
+/*
+ * Demand-paged loading of ELF executables embedded in the kernel image.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_ELF_H
+#define PIOS_KERN_ELF_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/trap.h>
+#include <inc/vm.h>
+
+struct proc;
+struct initrd_file;
+
+
+#define ELF_MAXSEG	8		// Lazily loaded segments per process
+
+// A loaded executable's stack, demand-zero like its bss.
+#define ELF_STACKHI	VM_USERHI
+#define ELF_STACKLO	(VM_USERHI - PTSIZE)
+
+// A page-aligned region of a process's user space whose pages
+// we fill in from an executable when the process first touches them.
+// The executable is either part of the kernel image or compressed
+// in the initial ramdisk (kern/initrd.c).
+typedef struct elfseg {
+	uint32_t	va;		// Start of the region
+	uint32_t	eva;		// End of the region, or 0 if slot unused
+	uint32_t	fend;		// End of its file-backed part; zeros after
+	uint32_t	foff;		// Offset in the executable of 'va'
+	const uint8_t	*image;		// Executable in the kernel image, or
+	const struct initrd_file *file;	// executable in the initial ramdisk
+	uint32_t	perm;		// SYS_READ or SYS_RW
+} elfseg;
+
+
+// Replace the user space of stopped process 'p' with the ELF executable
+// 'image' of 'size' bytes, which must lie in the kernel image,
+// mapping nothing yet, and set it up to start at the entry point
+// with its stack pointer at ELF_STACKHI.  Returns false if the image
+// isn't a valid executable we can load.
+bool elf_load(struct proc *p, const void *image, size_t size);
+
+// Likewise, but load the executable from the initial ramdisk,
+// decompressing only the pages the process touches.
+bool elf_loadfile(struct proc *p, const struct initrd_file *f);
+
+// Make 'dp's segments in [dva,dva+size) those of 'sp' in [sva,sva+size),
+// or none if 'sp' is NULL, as a memory operation on that region does.
+void elf_copysegs(struct proc *sp, uint32_t sva,
+		struct proc *dp, uint32_t dva, size_t size);
+
+// Handle a page fault on a page of a lazily loaded segment that the
+// current process hasn't touched yet, returning to the faulting code
+// once it's mapped.  Returns to our caller if it's some other fault.
+void elf_pagefault(trapframe *tf);
+
+// Check loading an executable from user mode, showing that its startup
+// cost depends on the pages it touches rather than on its size.
+void elf_check_user(void);
+
+#endif /* !PIOS_KERN_ELF_H */
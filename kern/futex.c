@@ -0,0 +1,227 @@
+/*
+ * Futex wait queues for user-level synchronization.
+ *
+ * A process waits on a futex by giving the address of a word of its
+ * memory and the value it expects to find there; if the word has changed,
+ * the wait returns right away, so the user-level code that set the word
+ * can't miss a wakeup between checking it and calling sys_wait().
+ * Waiters are keyed by the physical address of the word,
+ * so processes wait on the same futex if they map the same page,
+ * whatever virtual address they use for it.
+ *
+ * Waiting processes sit on one of FUTEX_BUCKETS hash chains,
+ * each with its own lock, so that unrelated futexes rarely contend.
+ * The bucket lock orders the waiter's check of the word
+ * against wakers, which take the same lock to find waiters.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/vm.h>
+#include <inc/mmu.h>
+#include <inc/syscall.h>
+#include <inc/sysinfo.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/proc.h>
+#include <kern/pmap.h>
+#include <kern/futex.h>
+#include <kern/sysinfo.h>
+#include <kern/spinlock.h>
+
+
+#define FUTEX_HASHBITS	6
+#define FUTEX_BUCKETS	(1 << FUTEX_HASHBITS)
+
+typedef struct futexbucket {
+	spinlock	lock;		// Protects this bucket's chain
+	proc		*head;		// Waiters, linked through proc.fnext
+} gcc_aligned(64) futexbucket;		// One per cache line
+
+static futexbucket futex_table[FUTEX_BUCKETS];
+
+
+static futexbucket *
+futex_bucket(uint32_t pa)
+{
+	return &futex_table[((pa >> 2) * 2654435761U) >> (32 - FUTEX_HASHBITS)];
+}
+
+void
+futex_init(void)
+{
+	if (!cpu_onboot())
+		return;
+
+	int i;
+	for (i = 0; i < FUTEX_BUCKETS; i++)
+		spinlock_init(&futex_table[i].lock);
+}
+
+uint32_t
+futex_phys(proc *p, uint32_t uva)
+{
+	// Below VM_USERLO, user space maps physical memory one to one.
+	if (uva < VM_USERLO)
+		return uva;
+	pte_t *pte = pmap_walk(p->pdir, uva, 0);
+	assert(pte != NULL && (*pte & PTE_P));
+	return PGADDR(*pte) | PGOFF(uva);
+}
+
+void
+futex_wait(proc *p, trapframe *tf, uint32_t pa, uint32_t val)
+{
+	assert((pa & 3) == 0);
+	futexbucket *b = futex_bucket(pa);
+	spinlock_acquire(&b->lock);
+	if (*(volatile uint32_t*) mem_ptr(pa) != val) {
+		spinlock_release(&b->lock);
+		return;
+	}
+
+	p->fkey = pa;
+	p->fnext = b->head;
+	b->head = p;
+	sysinfo_page->cpu[cpu_cur()->id].futex_waits++;
+	proc_block(p, tf, &b->lock);
+}
+
+int
+futex_wake(uint32_t pa, int n)
+{
+	futexbucket *b = futex_bucket(pa);
+	proc *woken = NULL;
+	int nwoken = 0;
+
+	spinlock_acquire(&b->lock);
+	proc **pp = &b->head;
+	while (*pp != NULL && nwoken < n) {
+		proc *p = *pp;
+		if (p->fkey != pa) {
+			pp = &p->fnext;
+			continue;
+		}
+		*pp = p->fnext;
+		p->fnext = woken;
+		woken = p;
+		nwoken++;
+	}
+	spinlock_release(&b->lock);
+
+	// Make them ready only after we let go of the bucket,
+	// since they may run on another CPU right away.
+	while (woken != NULL) {
+		proc *p = woken;
+		woken = p->fnext;
+		p->fnext = NULL;
+		proc_ready(p);
+	}
+	sysinfo_page->cpu[cpu_cur()->id].futex_wakes += nwoken;
+	return nwoken;
+}
+
+
+#define FUTEX_CHECK_NCHILD	16
+#define FUTEX_CHECK_ITERS	2000	// Lock/unlock rounds per child
+#define FUTEX_CHECK_HOLD	200	// Loop iterations holding the lock
+
+static char futex_check_stack[FUTEX_CHECK_NCHILD][PAGESIZE]
+	gcc_aligned(PAGESIZE);
+
+// A mutex that only makes system calls when contended:
+// 0 is unlocked, 1 locked, 2 locked with (possibly) waiters.
+static volatile uint32_t futex_check_mutex;
+static volatile uint32_t futex_check_count;
+
+static void
+futex_check_lock(volatile uint32_t *m)
+{
+	uint32_t c = cmpxchg(m, 0, 1);
+	if (c == 0)
+		return;			// the fast path
+	if (c != 2)
+		c = xchg(m, 2);
+	while (c != 0) {
+		sys_wait(m, 2);
+		c = xchg(m, 2);
+	}
+}
+
+static void
+futex_check_unlock(volatile uint32_t *m)
+{
+	if (xadd(m, -1) != 1) {
+		*m = 0;
+		sys_wake(m, 1);
+	}
+}
+
+static void gcc_noreturn
+futex_check_child(int n)
+{
+	int i;
+	for (i = 0; i < FUTEX_CHECK_ITERS; i++) {
+		futex_check_lock(&futex_check_mutex);
+		uint32_t count = futex_check_count;
+		volatile int j;
+		for (j = 0; j < FUTEX_CHECK_HOLD; j++)
+			;
+		futex_check_count = count + 1;
+		futex_check_unlock(&futex_check_mutex);
+	}
+	while (1)
+		sys_ret();
+}
+
+// Runs in user mode, as part of the root process.
+void
+futex_check_user(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	int ncpu = si->ncpu;
+	int n, i;
+
+	// Waiting on a word that doesn't hold the value returns right away,
+	// and waking a futex nobody waits on wakes nobody.
+	volatile uint32_t word = 1;
+	sys_wait(&word, 0);
+	assert(sys_wake(&word, 1) == 0);
+
+	// More children than CPUs contend for one mutex,
+	// so some get preempted holding it and the rest have to wait.
+	int nchild = MIN(2 * ncpu + 1, FUTEX_CHECK_NCHILD);
+	uint32_t w0 = 0, k0 = 0;
+	for (i = 0; i < ncpu; i++) {
+		w0 += si->cpu[i].futex_waits;
+		k0 += si->cpu[i].futex_wakes;
+	}
+	futex_check_mutex = 0;
+	futex_check_count = 0;
+	uint64_t t0 = rdtsc();
+	for (n = 0; n < nchild; n++)
+		spawn(0, n, NULL, &futex_check_stack[n][PAGESIZE],
+			futex_check_child, n, NULL, NULL, 0);
+	for (n = 0; n < nchild; n++)
+		sys_get(0, n, NULL, NULL, NULL, 0);
+	uint64_t cycles = rdtsc() - t0;
+	assert(futex_check_count == nchild * FUTEX_CHECK_ITERS);
+	assert(futex_check_mutex == 0);
+
+	uint32_t waits = 0, wakes = 0;
+	for (i = 0; i < ncpu; i++) {
+		waits += si->cpu[i].futex_waits;
+		wakes += si->cpu[i].futex_wakes;
+	}
+	cprintf("futex_check: %d children, %d cycles per critical section, "
+		"%d waits, %d wakes\n", nchild,
+		(int) (cycles / (nchild * FUTEX_CHECK_ITERS)),
+		waits - w0, wakes - k0);
+	cprintf("futex_check_user() succeeded!\n");
+}
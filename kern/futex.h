@@ -0,0 +1,40 @@
+/*
+ * Futex wait queues for user-level synchronization.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_FUTEX_H
+#define PIOS_KERN_FUTEX_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+
+struct proc;
+
+
+// Initialize the futex hash table, on the boot CPU.
+void futex_init(void);
+
+// Find the physical address identifying the futex at user address 'uva'
+// of process 'p', which must be mapped, as it is once 'p' has touched it.
+uint32_t futex_phys(struct proc *p, uint32_t uva);
+
+// Block the current process 'p' on the futex at physical address 'pa',
+// which it made system call 'tf' to wait on, if the word there is 'val'.
+// Returns if it isn't; otherwise the system call completes once
+// another process wakes the futex.
+void futex_wait(struct proc *p, trapframe *tf, uint32_t pa, uint32_t val);
+
+// Wake up to 'n' processes waiting on the futex at physical address 'pa',
+// returning how many there were.
+int futex_wake(uint32_t pa, int n);
+
+// Check futexes from user mode, with a futex-based mutex
+// contended by more processes than there are CPUs.
+void futex_check_user(void);
+
+#endif /* !PIOS_KERN_FUTEX_H */
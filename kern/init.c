@@ -12,6 +12,9 @@
 #include <inc/string.h>
 #include <inc/assert.h>
 #include <inc/cdefs.h>
+#include <inc/syscall.h>
+#include <inc/thread.h>
+#include <inc/boot.h>
 
 #include <kern/init.h>
 #include <kern/cons.h>
@@ -19,12 +22,42 @@
 #include <kern/mem.h>
 #include <kern/cpu.h>
 #include <kern/trap.h>
+#include <kern/clock.h>
+#include <kern/timer.h>
+#include <kern/work.h>
+#include <kern/sysinfo.h>
+#include <kern/pmap.h>
+#include <kern/mp.h>
+#include <kern/proc.h>
+#include <kern/futex.h>
+#include <kern/udev.h>
+#include <kern/elf.h>
+#include <kern/initrd.h>
+#include <kern/log.h>
+#include <kern/trace.h>
+#include <kern/perf.h>
+
+#include <dev/pic.h>
+#include <dev/lapic.h>
+#include <dev/serial.h>
 
 
 
 // User-mode stack for user(), below, to run on.
 static char gcc_aligned(16) user_stack[PAGESIZE];
 
+// What the boot loader left us, saved before anything can overwrite it.
+static bootinfo boot_info;
+
+// Boot timeline: the TSC when each phase of booting finished,
+// from the boot loader on, as seen by the boot CPU.
+#define BOOT_MAXPHASES	32
+static struct {
+	const char	*name;
+	uint64_t	tsc;
+} boot_phases[BOOT_MAXPHASES];
+static int boot_nphases;
+
 #define ROOTEXE_START _binary_obj_user_sh_start
 
 // Lab 3: ELF executable containing root process, linked into the kernel
@@ -33,6 +66,50 @@ static char gcc_aligned(16) user_stack[PAGESIZE];
 extern char ROOTEXE_START[];
 
 
+// Report how long the boot loader took to load a kernel of 'size' bytes.
+static void
+boot_report(size_t size)
+{
+	const bootinfo *bi = &boot_info;
+	if (bi->tsc_loaded <= bi->tsc_start)
+		return;		// not booted by our boot loader
+	uint64_t us = (bi->tsc_loaded - bi->tsc_start) * 1000000 / clock_tsc_hz;
+	cprintf("boot: loaded %dKB kernel in %lldus\n", size / 1024, us);
+}
+
+// Note that boot phase 'name' finished at TSC 'tsc'.
+static void
+boot_stamp(const char *name, uint64_t tsc)
+{
+	if (boot_nphases < BOOT_MAXPHASES) {
+		boot_phases[boot_nphases].name = name;
+		boot_phases[boot_nphases++].tsc = tsc;
+	}
+}
+
+// Note that boot phase 'name' just finished, if we're the boot CPU.
+static void
+boot_phase(const char *name)
+{
+	if (cpu_onboot())
+		boot_stamp(name, rdtsc());
+}
+
+// Print the boot timeline, one phase per line, for grade scripts to parse:
+//	boottime: <phase> <end> <duration>
+// both in microseconds, 'end' counting from the start of the timeline.
+static void
+boot_timeline(void)
+{
+	uint64_t t0 = boot_phases[0].tsc;
+	int i;
+	for (i = 1; i < boot_nphases; i++)
+		cprintf("boottime: %s %lld %lld\n", boot_phases[i].name,
+			(boot_phases[i].tsc - t0) * 1000000 / clock_tsc_hz,
+			(boot_phases[i].tsc - boot_phases[i-1].tsc) * 1000000
+				/ clock_tsc_hz);
+}
+
 // Called first from entry.S on the bootstrap processor,
 // and later from boot/bootother.S on all other processors.
 // As a rule, "init" functions in PIOS are called once on EACH processor.
@@ -40,48 +117,106 @@ void
 init(void)
 {
 	extern char start[], edata[], end[];
+	uint64_t tsc_init = rdtsc();
 
 	// Before anything else, complete the ELF loading process.
 	// Clear all uninitialized global data (BSS) in our program,
 	// ensuring that all static/global variables start out zero.
-	if (cpu_onboot())
+	// Then start the boot timeline with the boot loader's timestamps.
+	if (cpu_onboot()) {
 		memset(edata, 0, end - edata);
+		boot_info = *BOOTINFO;
+		const bootinfo *bi = &boot_info;
+		if (bi->tsc_start < bi->tsc_loaded && bi->tsc_loaded < tsc_init) {
+			boot_stamp("bootmain", bi->tsc_start);
+			boot_stamp("diskload", bi->tsc_loaded);
+		}
+		boot_stamp("entry", tsc_init);
+		boot_phase("bss");
+	}
 
-	// Initialize the console.
+	// Initialize the kernel log and the console.
 	// Can't call cprintf until after we do this!
+	log_init();
 	cons_init();
+	boot_phase("cons_init");
 
 	// Lab 1: test cprintf and debug_trace
-	cprintf("1234 decimal is %o octal!\n", 1234);
-	debug_check();
+	if (cpu_onboot()) {
+		cprintf("1234 decimal is %o octal!\n", 1234);
+		debug_check();
+		boot_phase("debug_check");
+	}
 
-	// Initialize and load the bootstrap CPU's GDT, TSS, and IDT.
+	// Initialize and load the bootstrap CPU's GDT, TSS, and IDT,
+	// and switch to our own page tables.
 	cpu_init();
+	pmap_init();
+	sysinfo_init();
+	boot_phase("pmap_init");
 	trap_init();
+	boot_phase("trap_init");
 
 	// Physical memory detection/initialization.
 	// Can't call mem_alloc until after we do this!
 	mem_init();
+	boot_phase("mem_init");
+
+	// Find all processors in the system.
+	mp_init();
+	trace_init();
+	boot_phase("mp_init");
 
+	// Set up interrupt controllers, calibrate the clock and APIC timer,
+	// and make sure the idle loop wakes up when timers expire.
+	pic_init();
+	lapic_init();
+	cons_intenable();
+	clock_init();
+	boot_phase("clock_init");
+	perf_init();
+	timer_init();
+	proc_init();
+	futex_init();
+	udev_init();
+	initrd_init();
+	sysinfo_setclock();
+	boot_phase("subsys_init");
+	if (cpu_onboot()) {
+		boot_report(edata - start);
+		timer_check();
+		work_check();
+		initrd_check();
+		serial_check();
+		cons_check();
+		log_check();
+		trace_check();
+		boot_phase("kernel_checks");
 
+		// From here on, console output needn't hold up the kernel.
+		log_async();
+	}
 
-	// Lab 1: change this so it enters user() in user mode,
-	// running on the user_stack declared above,
-	// instead of just calling user() directly.
-    trapframe tf = {
-        gs: CPU_GDT_UDATA | 3,
-        fs: CPU_GDT_UDATA | 3,
-        es: CPU_GDT_UDATA | 3,
-        ds: CPU_GDT_UDATA | 3,
-        cs: CPU_GDT_UCODE | 3,
-        ss: CPU_GDT_UDATA | 3,
-        eflags: FL_IOPL_3,
-        eip: (uint32_t)user,
-        esp: (uint32_t)&user_stack[PAGESIZE]
-    };
-    trap_return(&tf);
-    cprintf("out user\n");
-	user();
+	// Boot other CPUs
+	cpu_bootothers();
+	cprintf("CPU %d (%s) has booted\n", cpu_cur()->id,
+		cpu_onboot() ? "BP" : "AP");
+
+	// Other CPUs just run whatever processes become ready.
+	if (!cpu_onboot())
+		cpu_idle();
+	boot_phase("bootothers");
+	boot_timeline();
+
+	// Create our first process, the root process, to run user()
+	// in user mode on the user_stack declared above.
+	// It runs right here on the boot CPU, which trap_check_user() expects.
+	proc_root = proc_alloc(NULL, 0);
+	if (proc_root == NULL)
+		panic("init: no memory for the root process");
+	proc_root->sv.tf.eip = (uint32_t) user;
+	proc_root->sv.tf.esp = (uint32_t) &user_stack[PAGESIZE];
+	proc_run(proc_root);
 }
 
 // This is the first function that gets run in user mode (ring 3).
@@ -97,17 +232,46 @@ user()
 	// Check that we're in user mode and can handle traps from there.
 	trap_check_user();
 
+	// Check that we can read the clock and kernel statistics directly.
+	sysinfo_check_user();
+
+	// Check the scheduler: switch latency and load balancing.
+	proc_check();
+
+	// Check copy-on-write fork and merging join.
+	pmap_check_user();
+
+	// Check futexes with a contended user-level mutex.
+	futex_check_user();
+
+	// Check user-level threads on top of all that.
+	thread_check();
+
+	// Check traps reflected to a process's own handler.
+	utrap_check();
+
+	// Check a user-level polled driver and the devices it claims.
+	udev_check_user();
+
+	// Check demand-paged loading of executables.
+	elf_check_user();
+
 	done();
 }
 
 // This is a function that we call when the kernel is "done" -
-// it just puts the processor into an infinite loop.
+// it just puts the processor into the idle loop for good,
+// halted except when an interrupt or timer needs servicing.
 // We make this a function so that we can set a breakpoints on it.
-// Our grade scripts use this breakpoint to know when to stop QEMU.
+// Our grade scripts use this breakpoint to know when to stop QEMU,
+// so flush the console (cons_flush) before calling it.
 void gcc_noreturn
 done()
 {
-	while (1)
-		;	// just spin
+	// Only the kernel may halt the processor;
+	// from user mode (e.g., user() above), ask the kernel to do it.
+	if (read_cs() & 3)
+		sys_ret();
+	cpu_idle();
 }
 
@@ -0,0 +1,238 @@
+/*
+ * Compressed initial ramdisk linked into the kernel.
+ *
+ * The build packs files into an archive with misc/mkinitrd.c,
+ * compressing each page of each file separately (see inc/initrd.h),
+ * and links the archive into the kernel image as it is.  The kernel
+ * decompresses a page only when something first asks for it,
+ * and keeps it in a page cache from then on, so that neither the
+ * kernel image the boot loader reads nor resident memory pays for
+ * files, or parts of files, that nobody uses.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/clock.h>
+#include <kern/initrd.h>
+
+
+extern uint8_t _binary_obj_initrd_start[], _binary_obj_initrd_size[];
+extern uint8_t _binary_obj_boot_bootother_start[],
+		_binary_obj_boot_bootother_size[];
+
+static const initrd_file *initrd_files;
+static uint32_t initrd_nfiles;
+
+// Decompressed pages, from initrd_cachebase[n] on for file n.
+static uint32_t initrd_cachebase[INITRD_MAXFILES];
+static pageinfo *volatile initrd_cache[INITRD_MAXPAGES];
+
+
+void
+initrd_init(void)
+{
+	static_assert(INITRD_BLOCK == PAGESIZE);
+	if (!cpu_onboot())
+		return;
+
+	const uint8_t *ar = _binary_obj_initrd_start;
+	uint32_t size = (uint32_t) _binary_obj_initrd_size;
+	const initrd_hdr *hdr = (const initrd_hdr*) ar;
+	if (size < sizeof(initrd_hdr) || hdr->magic != INITRD_MAGIC ||
+			hdr->nfiles > INITRD_MAXFILES ||
+			hdr->nfiles * sizeof(initrd_file) >
+				size - sizeof(initrd_hdr))
+		panic("initrd_init: bad archive header");
+	initrd_files = (const initrd_file*) (hdr + 1);
+	initrd_nfiles = hdr->nfiles;
+
+	// Make sure each block table and the blocks it points to
+	// lie within the archive, so decompressing can trust them.
+	uint32_t npages = 0;
+	int i, j;
+	for (i = 0; i < initrd_nfiles; i++) {
+		const initrd_file *f = &initrd_files[i];
+		uint32_t nb = INITRD_NPAGES(f);
+		if (f->name[INITRD_NAMELEN-1] != 0 ||
+				nb > INITRD_MAXPAGES - npages ||
+				f->blocks > size ||
+				(nb + 1) * 4 > size - f->blocks)
+			panic("initrd_init: bad entry for file %d", i);
+		const uint32_t *tab = (const uint32_t*) (ar + f->blocks);
+		for (j = 0; j < nb; j++)
+			if (tab[j] > tab[j+1] || tab[j+1] > size)
+				panic("initrd_init: bad block table for %s",
+					f->name);
+		initrd_cachebase[i] = npages;
+		npages += nb;
+	}
+}
+
+const initrd_file *
+initrd_lookup(const char *name)
+{
+	int i;
+	for (i = 0; i < initrd_nfiles; i++)
+		if (strcmp(initrd_files[i].name, name) == 0)
+			return &initrd_files[i];
+	return NULL;
+}
+
+// Decompress an LZ4 block of 'n' bytes at 'src' into 'cap' bytes at 'dst',
+// returning the decompressed size, or -1 if the block is corrupt.
+static int
+initrd_unlz4(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+	const uint8_t *ip = src, *iend = src + n;
+	uint8_t *op = dst, *oend = dst + cap;
+	while (ip < iend) {
+		uint32_t token = *ip++;
+
+		size_t len = token >> 4;
+		if (len == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend)
+					return -1;
+				len += b = *ip++;
+			} while (b == 255);
+		}
+		if (len > iend - ip || len > oend - op)
+			return -1;
+		memmove(op, ip, len);
+		op += len;
+		ip += len;
+		if (ip == iend)
+			break;		// the last sequence has no match
+
+		if (iend - ip < 2)
+			return -1;
+		size_t off = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (off == 0 || off > op - dst)
+			return -1;
+		len = (token & 15) + 4;
+		if ((token & 15) == 15) {
+			uint8_t b;
+			do {
+				if (ip >= iend)
+					return -1;
+				len += b = *ip++;
+			} while (b == 255);
+		}
+		if (len > oend - op)
+			return -1;
+
+		// A match may overlap the bytes it produces.
+		const uint8_t *m = op - off;
+		if (off >= len)
+			memmove(op, m, len);
+		else {
+			size_t k;
+			for (k = 0; k < len; k++)
+				op[k] = m[k];
+		}
+		op += len;
+	}
+	return op - dst;
+}
+
+void
+initrd_readpage(const initrd_file *f, uint32_t i, void *dst)
+{
+	assert(i < INITRD_NPAGES(f));
+	const uint8_t *ar = _binary_obj_initrd_start;
+	const uint32_t *tab = (const uint32_t*) (ar + f->blocks);
+	size_t n = MIN(PAGESIZE, f->size - i * PAGESIZE);
+	size_t clen = tab[i+1] - tab[i];
+
+	if (clen == n)
+		memmove(dst, ar + tab[i], n);		// stored as is
+	else if (initrd_unlz4(ar + tab[i], clen, dst, n) != n)
+		panic("initrd_readpage: %s page %d is corrupt", f->name, i);
+	memset((uint8_t*) dst + n, 0, PAGESIZE - n);
+}
+
+pageinfo *
+initrd_page(const initrd_file *f, uint32_t i)
+{
+	assert(i < INITRD_NPAGES(f));
+	pageinfo *volatile *slot =
+		&initrd_cache[initrd_cachebase[f - initrd_files] + i];
+	pageinfo *pi = *slot;
+	if (pi != NULL)
+		return pi;
+
+	pi = mem_alloc();
+	if (pi == NULL)
+		return NULL;
+	mem_incref(pi);			// the cache's reference
+	initrd_readpage(f, i, mem_pi2ptr(pi));
+
+	// If another CPU beat us to it, use its copy.
+	pageinfo *old = (pageinfo*) cmpxchg((volatile uint32_t*) slot,
+					0, (uint32_t) pi);
+	if (old != NULL) {
+		mem_decref(pi, mem_free);
+		return old;
+	}
+	return pi;
+}
+
+
+void
+initrd_check(void)
+{
+	pageinfo *scratch = mem_alloc();
+	assert(scratch != NULL);
+	uint8_t *buf = mem_pi2ptr(scratch);
+
+	// Decompress everything, checking it against the packer's hashes.
+	uint32_t total = 0;
+	uint64_t cycles = 0;
+	int i, j, k;
+	for (i = 0; i < initrd_nfiles; i++) {
+		const initrd_file *f = &initrd_files[i];
+		uint32_t sum = INITRD_FNVBASIS;
+		for (j = 0; j < INITRD_NPAGES(f); j++) {
+			uint64_t t0 = rdtsc();
+			initrd_readpage(f, j, buf);
+			cycles += rdtsc() - t0;
+			uint32_t n = MIN(PAGESIZE, f->size - j * PAGESIZE);
+			for (k = 0; k < n; k++)
+				sum = (sum ^ buf[k]) * INITRD_FNVPRIME;
+		}
+		assert(sum == f->sum);
+		total += f->size;
+	}
+
+	// The AP bootstrap code is also linked in raw, to compare against.
+	const initrd_file *f = initrd_lookup("boot/bootother");
+	assert(f != NULL);
+	assert(f->size == (uint32_t) _binary_obj_boot_bootother_size);
+	initrd_readpage(f, 0, buf);
+	assert(memcmp(buf, _binary_obj_boot_bootother_start, f->size) == 0);
+	assert(initrd_lookup("no/such/file") == NULL);
+
+	// The page cache decompresses a page once, then hands out that copy.
+	pageinfo *pi = initrd_page(f, 0);
+	assert(pi != NULL && pi->refcount == 1);
+	assert(initrd_page(f, 0) == pi);
+	assert(memcmp(mem_pi2ptr(pi), buf, PAGESIZE) == 0);
+	mem_free(scratch);
+
+	uint32_t packed = (uint32_t) _binary_obj_initrd_size;
+	cprintf("initrd_check: %d files, %d bytes packed into %d (%d%%), "
+		"decompressed at %lldMB/s\n", initrd_nfiles, total, packed,
+		packed * 100 / total,
+		cycles ? total * clock_tsc_hz / cycles / 1000000 : 0);
+	cprintf("initrd_check() succeeded!\n");
+}
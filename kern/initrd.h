@@ -0,0 +1,46 @@
+/*
+ * Compressed initial ramdisk linked into the kernel.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_INITRD_H
+#define PIOS_KERN_INITRD_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/initrd.h>
+
+#include <kern/mem.h>
+
+
+#define INITRD_MAXFILES	64		// Max files in the archive
+#define INITRD_MAXPAGES	4096		// Max pages of them all together
+
+// Number of pages in file 'f'.
+#define INITRD_NPAGES(f)	(((f)->size + PAGESIZE - 1) / PAGESIZE)
+
+
+// Check the archive's structure, on the boot CPU.
+void initrd_init(void);
+
+// Find the file of a given name, or return NULL if there is none.
+const initrd_file *initrd_lookup(const char *name);
+
+// Decompress page 'i' of file 'f' into 'dst', zero-filling past the end.
+void initrd_readpage(const initrd_file *f, uint32_t i, void *dst);
+
+// Return page 'i' of file 'f', decompressing it on first use.
+// The archive keeps a reference to the page from then on,
+// so that anyone mapping it must copy it before writing to it.
+// Returns NULL if out of memory.
+pageinfo *initrd_page(const initrd_file *f, uint32_t i);
+
+// Check that everything in the archive decompresses correctly,
+// and report how well it compressed and how fast it decompresses.
+void initrd_check(void);
+
+#endif /* !PIOS_KERN_INITRD_H */
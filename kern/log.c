@@ -0,0 +1,276 @@
+/*
+ * Kernel log: per-CPU rings of console output, flushed asynchronously.
+ *
+ * cputs() in the kernel just appends to the current CPU's ring,
+ * which only that CPU ever appends to, with interrupts off,
+ * so logging takes no lock and never waits for the console devices.
+ * Each record gets a sequence number from a shared counter as it is
+ * logged, so that whoever flushes the rings, holding log_lock,
+ * can merge them back into the order they were logged in.
+ *
+ * Until init() calls log_async(), and for warnings and panics from then
+ * on, log_write() flushes before it returns, as cputs() always used to.
+ * Otherwise it leaves that to the CPU's kernel worker, which runs from
+ * the idle loop or before the CPU goes back to a user process;
+ * a CPU that fills its ring flushes it itself.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/syscall.h>
+
+#include <kern/cpu.h>
+#include <kern/cons.h>
+#include <kern/work.h>
+#include <kern/spinlock.h>
+#include <kern/log.h>
+
+
+#define LOG_GAPWAIT	1000	// Pauses to wait for a record being logged
+
+typedef struct logring {
+	logrec		rec[LOG_NREC];
+	volatile uint32_t head;		// Next record to fill; only its CPU
+	volatile uint32_t tail;		// Next record to flush; only log_lock
+	work		flush;		// Worker item to flush the log
+} logring;
+
+static logring log_rings[CPU_MAX];
+static volatile uint32_t log_seq;	// Next sequence number to hand out
+static uint32_t log_next;		// Next one to flush, under log_lock
+static spinlock log_lock;		// Held by whoever is flushing
+static bool log_asyncmode;
+static uint32_t log_nflushed;		// Records flushed, for log_check()
+
+int log_conslevel = LOG_INFO;
+
+
+void
+log_init(void)
+{
+	if (!cpu_onboot())
+		return;
+	spinlock_init(&log_lock);
+}
+
+void
+log_async(void)
+{
+	log_asyncmode = 1;
+}
+
+// Flush the rings with log_lock held, oldest record first.
+static void
+log_drain(void)
+{
+	int waited = 0;
+	while (1) {
+		logring *oldr = NULL;
+		logrec *old = NULL;
+		cpu *c;
+		for (c = &cpu_boot; c != NULL; c = c->next) {
+			logring *r = &log_rings[c->id];
+			if (r->tail == r->head)
+				continue;
+			logrec *lr = &r->rec[r->tail % LOG_NREC];
+			if (old == NULL || (int32_t) (lr->seq - old->seq) < 0)
+				oldr = r, old = lr;
+		}
+		if (old == NULL)
+			return;
+
+		// If an earlier record is still being logged, give it a moment.
+		if ((int32_t) (old->seq - log_next) > 0 &&
+				waited++ < LOG_GAPWAIT) {
+			pause();
+			continue;
+		}
+		waited = 0;
+		if ((int32_t) (old->seq - log_next) >= 0)
+			log_next = old->seq + 1;
+		if (old->level <= log_conslevel)
+			cons_write(old->text, old->len);
+		log_nflushed++;
+		oldr->tail++;
+	}
+}
+
+void
+log_flush(void)
+{
+	if (spinlock_holding(&log_lock))
+		return;		// we're flushing already, further up
+	spinlock_acquire(&log_lock);
+	log_drain();
+	spinlock_release(&log_lock);
+}
+
+void
+log_hold(void)
+{
+	spinlock_acquire(&log_lock);
+	log_drain();
+}
+
+void
+log_release(void)
+{
+	spinlock_release(&log_lock);
+}
+
+static void
+log_flushwork(work *w)
+{
+	log_flush();
+}
+
+void
+log_write(int level, const char *str)
+{
+	// User-mode code (such as user() in init.c) can't use the rings.
+	if (read_cs() & 3) {
+		sys_cputs(str);
+		return;
+	}
+
+	// If we get here while flushing, as from a panic in a console driver,
+	// the rings can wait: the console can't.
+	if (spinlock_holding(&log_lock)) {
+		cons_write(str, strlen(str));
+		return;
+	}
+
+	cpu *c = cpu_cur();
+	logring *r = &log_rings[c->id];
+	size_t len = strlen(str);
+	while (len > 0) {
+		while (r->head - r->tail == LOG_NREC)
+			log_flush();	// full, so don't wait for the worker
+
+		size_t n = MIN(len, LOG_TEXTMAX);
+		logrec *lr = &r->rec[r->head % LOG_NREC];
+		lr->level = level;
+		lr->cpu = c->id;
+		lr->len = n;
+		lr->tsc = rdtsc();
+		memmove(lr->text, str, n);
+		lr->seq = xadd(&log_seq, 1);
+
+		// Don't let the compiler publish the record before filling it;
+		// the processor itself keeps stores in order.
+		asm volatile("" : : : "memory");
+		r->head++;
+		str += n;
+		len -= n;
+	}
+
+	if (!log_asyncmode || level <= LOG_WARN)
+		log_flush();
+	else
+		work_queue(&r->flush, log_flushwork, NULL);
+}
+
+
+// Collect formatted output into records' worth of text for log_write().
+typedef struct logbuf {
+	int		level;
+	int		idx;		// Bytes in buf
+	int		cnt;		// Bytes printed in all
+	char		buf[LOG_TEXTMAX+1];
+} logbuf;
+
+static void
+log_putch(int ch, logbuf *b)
+{
+	b->buf[b->idx++] = ch;
+	if (b->idx == LOG_TEXTMAX) {
+		b->buf[b->idx] = 0;
+		log_write(b->level, b->buf);
+		b->idx = 0;
+	}
+	b->cnt++;
+}
+
+int
+vlog_printf(int level, const char *fmt, va_list ap)
+{
+	logbuf b;
+	b.level = level;
+	b.idx = 0;
+	b.cnt = 0;
+	vprintfmt((void*) log_putch, &b, fmt, ap);
+
+	b.buf[b.idx] = 0;
+	log_write(level, b.buf);
+	return b.cnt;
+}
+
+int
+log_printf(int level, const char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	int cnt = vlog_printf(level, fmt, ap);
+	va_end(ap);
+	return cnt;
+}
+
+
+#define LOG_CHECKRECS	(LOG_NREC * 3)	// Enough to fill the ring twice
+
+void
+log_check(void)
+{
+	assert(cpu_onboot());
+	log_flush();
+	logring *r = &log_rings[cpu_cur()->id];
+	assert(r->head == r->tail);
+
+	// Log below the console's level, so nothing actually shows,
+	// and asynchronously, so it all stays in the ring until it's full.
+	bool async = log_asyncmode;
+	log_asyncmode = 1;
+	uint32_t seq = log_seq, head = r->head, flushed = log_nflushed;
+	uint64_t t0 = rdtsc();
+	log_printf(LOG_DEBUG, "log_check %d\n", 0);
+	uint64_t t1 = rdtsc();
+	assert(r->head == head + 1 && log_seq == seq + 1);
+	logrec *lr = &r->rec[head % LOG_NREC];
+	assert(lr->seq == seq && lr->level == LOG_DEBUG && lr->cpu == 0);
+	assert(lr->len == 12 && memcmp(lr->text, "log_check 0\n", 12) == 0);
+	assert(lr->tsc >= t0 && lr->tsc <= t1);
+
+	// A long line takes several records, in order.
+	char line[LOG_TEXTMAX * 2 + 10 + 1];
+	memset(line, 'x', sizeof(line) - 1);
+	line[sizeof(line) - 1] = 0;
+	log_write(LOG_DEBUG, line);
+	assert(r->head == head + 4 && log_seq == seq + 4);
+	assert(r->rec[(head + 3) % LOG_NREC].len == 10);
+	assert(r->rec[(head + 3) % LOG_NREC].seq == seq + 3);
+
+	// Filling the ring flushes it rather than losing anything.
+	int i;
+	for (i = 4; i < LOG_CHECKRECS; i++)
+		log_printf(LOG_DEBUG, "log_check %d\n", i);
+	assert(r->head - r->tail <= LOG_NREC);
+	log_flush();
+	assert(r->head == r->tail);
+	assert(log_nflushed - flushed == LOG_CHECKRECS);
+	assert(log_next == log_seq);
+
+	// Otherwise the worker flushes what we log.
+	log_printf(LOG_DEBUG, "log_check %d\n", i);
+	assert(r->head == r->tail + 1 && r->flush.queued);
+	work_run();
+	assert(r->head == r->tail && !r->flush.queued);
+	log_asyncmode = async;
+
+	cprintf("log_check: %lld cycles to log a line\n", t1 - t0);
+	cprintf("log_check() succeeded!\n");
+}
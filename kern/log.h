@@ -0,0 +1,70 @@
+/*
+ * Kernel log: per-CPU rings of console output, flushed asynchronously.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_LOG_H
+#define PIOS_KERN_LOG_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/stdarg.h>
+
+
+// Log levels, most urgent first.  Records at LOG_WARN or more urgent
+// go out to the console before log_write() returns.
+#define LOG_PANIC	0	// The kernel is going down
+#define LOG_WARN	1	// Something's wrong, but we carry on
+#define LOG_INFO	2	// Ordinary console output: cprintf()
+#define LOG_DEBUG	3	// Kept in the log but not shown, by default
+
+#define LOG_TEXTMAX	112	// Bytes of text per record
+#define LOG_NREC	32	// Records in each CPU's ring; a power of 2
+
+// One record: a piece of console output up to LOG_TEXTMAX bytes long.
+typedef struct logrec {
+	uint32_t	seq;		// Order logged in, across all CPUs
+	uint8_t		level;		// LOG_PANIC..LOG_DEBUG
+	uint8_t		cpu;		// Index of the CPU that logged it
+	uint16_t	len;		// Bytes in text[], which isn't 0-ended
+	uint64_t	tsc;		// When, by that CPU's TSC
+	char		text[LOG_TEXTMAX];
+} logrec;
+
+// Records up to this level go to the console; the rest are just dropped
+// when their ring is flushed.
+extern int log_conslevel;
+
+
+void log_init(void);
+
+// Log the string 'str' at 'level' in the current CPU's ring,
+// without waiting for the console unless the ring is full.
+// From user mode, just hands it to sys_cputs().
+void log_write(int level, const char *str);
+
+// Like cprintf(), but at a given log level.
+int log_printf(int level, const char *fmt, ...);
+int vlog_printf(int level, const char *fmt, va_list ap);
+
+// Write everything logged so far out to the console, in order,
+// waiting for any other CPU in the middle of doing so.
+void log_flush(void);
+
+// Flush the log and keep the console to ourselves until log_release(),
+// for output that mustn't get mixed up with anyone else's.
+// Meanwhile, whatever we log ourselves goes straight to the console.
+void log_hold(void);
+void log_release(void);
+
+// From now on, leave flushing to each CPU's kernel worker (kern/work.h),
+// instead of flushing on every log_write().
+void log_async(void);
+
+void log_check(void);
+
+#endif // !PIOS_KERN_LOG_H
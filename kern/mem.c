@@ -15,6 +15,8 @@
 
 #include <kern/cpu.h>
 #include <kern/mem.h>
+#include <kern/sysinfo.h>
+#include <kern/spinlock.h>
 
 #include <dev/nvram.h>
 
@@ -25,6 +27,7 @@ size_t mem_npage;		// Total number of physical memory pages
 pageinfo *mem_pageinfo;		// Metadata array indexed by page number
 
 pageinfo *mem_freelist;		// Start of free page list
+spinlock mem_freelock;		// Spinlock protecting the free page list
 
 pageinfo tmp_mem_pageinfo[1024*1024*1024/PAGESIZE];
 
@@ -36,6 +39,8 @@ mem_init(void)
 	if (!cpu_onboot())	// only do once, on the boot CPU
 		return;
 
+	spinlock_init(&mem_freelock);
+
 	// Determine how much base (<640K) and extended (>1MB) memory
 	// is available in the system (in bytes),
 	// by reading the PC's BIOS-managed nonvolatile RAM (NVRAM).
@@ -71,6 +76,8 @@ mem_init(void)
 	//  1) Reserve page 0 for the real-mode IDT and BIOS structures
 	//     (do not allow this page to be used for anything else).
 	//  2) Reserve page 1 for the AP bootstrap code (boot/bootother.S).
+	//     Pages 2 and 3 are likewise reserved for the sysinfo page
+	//     (inc/sysinfo.h) and its kernel alias (kern/sysinfo.h).
 	//  3) Mark the rest of base memory as free.
 	//  4) Then comes the IO hole [MEM_IO, MEM_EXT).
 	//     Mark it as in-use so that it can never be allocated.      
@@ -90,7 +97,8 @@ mem_init(void)
 		// A free page has no references to it.
 		mem_pageinfo[i].refcount = 0;
 
-        if (i == 0 || i == 1) {
+        if (i == 0 || i == 1 || i == SYSINFO_ADDR / PAGESIZE ||
+            i == SYSINFO_KADDR / PAGESIZE) {
             continue;
         }
         page_start = mem_pi2phys(mem_pageinfo + i);
@@ -106,7 +114,9 @@ mem_init(void)
 		// Add the page to the end of the free list.
 		*freetail = &mem_pageinfo[i];
 		freetail = &mem_pageinfo[i].free_next;
+		sysinfo_page->mem_nfree++;
 	}
+	sysinfo_page->mem_npage = mem_npage;
 	*freetail = NULL;	// null-terminate the freelist
 
 	// ...and remove this when you're ready.
@@ -133,10 +143,14 @@ mem_alloc(void)
 	// Fill this function in
 	// Fill this function in.
 
-    if (mem_freelist == NULL)
-        return NULL;
+    spinlock_acquire(&mem_freelock);
     pageinfo * result = mem_freelist;
-    mem_freelist = mem_freelist->free_next;
+    if (result != NULL) {
+        mem_freelist = result->free_next;
+        sysinfo_page->mem_nfree--;
+        sysinfo_page->mem_nalloc++;
+    }
+    spinlock_release(&mem_freelock);
     return result;
 	//panic("mem_alloc not implemented.");
 }
@@ -151,8 +165,12 @@ mem_free(pageinfo *pi)
 	// Fill this function in.
 
     assert(pi->refcount == 0);
+    spinlock_acquire(&mem_freelock);
     pi->free_next = mem_freelist;
     mem_freelist = pi;
+    sysinfo_page->mem_nfree++;
+    sysinfo_page->mem_nfreed++;
+    spinlock_release(&mem_freelock);
 	//panic("mem_free not implemented.");
 }
 
@@ -81,11 +81,12 @@ void mem_free(pageinfo *pi);
 
 
 // Atomically increment the reference count on a page.
+// Pages of the kernel image may be counted too, as long as whoever
+// first counts one keeps a reference to it for good (see kern/elf.c).
 static gcc_inline void
 mem_incref(pageinfo *pi)
 {
 	assert(pi > &mem_pageinfo[1] && pi < &mem_pageinfo[mem_npage]);
-	assert(pi < mem_ptr2pi(start) || pi > mem_ptr2pi(end-1));
 
 	lockadd(&pi->refcount, 1);
 }
@@ -96,10 +97,11 @@ static gcc_inline void
 mem_decref(pageinfo* pi, void (*freefun)(pageinfo *pi))
 {
 	assert(pi > &mem_pageinfo[1] && pi < &mem_pageinfo[mem_npage]);
-	assert(pi < mem_ptr2pi(start) || pi > mem_ptr2pi(end-1));
 
-	if (lockaddz(&pi->refcount, -1))
-			freefun(pi);
+	if (lockaddz(&pi->refcount, -1)) {
+		assert(pi < mem_ptr2pi(start) || pi > mem_ptr2pi(end-1));
+		freefun(pi);
+	}
 	assert(pi->refcount >= 0);
 }
 
@@ -0,0 +1,158 @@
+/*
+ * Multiprocessor bootstrap: find the MP configuration table,
+ * which the BIOS sets up to describe the machine's processors.
+ * See MultiProcessor Specification Version 1.[14].
+ *
+ * Copyright (c) 2010 Yale University.
+ * Copyright (c) 2006-2009 Frans Kaashoek, Robert Morris, Russ Cox,
+ *                         Massachusetts Institute of Technology
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ *
+ * Derived from xv6.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/mp.h>
+
+
+bool mp_ismp;
+int mp_ncpu = 1;
+uint8_t mp_ioapicid;
+uint32_t mp_ioapicaddr;
+
+
+static uint8_t
+sum(uint8_t * addr, int len)
+{
+	int i, sum;
+
+	sum = 0;
+	for (i = 0; i < len; i++)
+		sum += addr[i];
+	return sum;
+}
+
+// Look for an MP structure in the len bytes at physical address addr.
+static mp *
+mpsearch1(uint32_t a, int len)
+{
+	uint8_t *e, *p, *addr = mem_ptr(a);
+
+	e = addr + len;
+	for (p = addr; p < e; p += sizeof(mp))
+		if (memcmp(p, "_MP_", 4) == 0 && sum(p, sizeof(mp)) == 0)
+			return (mp *) p;
+	return 0;
+}
+
+// Search for the MP Floating Pointer Structure, which according to the
+// spec is in one of the following three locations:
+// 1) in the first KB of the EBDA;
+// 2) in the last KB of system base memory;
+// 3) in the BIOS ROM between 0xF0000 and 0xFFFFF.
+static mp *
+mpsearch(void)
+{
+	uint8_t *bda;
+	uint32_t p;
+	mp *m;
+
+	bda = mem_ptr(0x400);
+	if ((p = ((bda[0x0F] << 8) | bda[0x0E]) << 4)) {
+		if ((m = mpsearch1(p, 1024)))
+			return m;
+	} else {
+		p = ((bda[0x14] << 8) | bda[0x13]) * 1024;
+		if ((m = mpsearch1(p - 1024, 1024)))
+			return m;
+	}
+	return mpsearch1(0xF0000, 0x10000);
+}
+
+// Search for an MP configuration table.  For now,
+// don't accept the default configurations (physaddr == 0).
+// Check for correct signature, calculate the checksum and,
+// if correct, check the version.
+static mpconf *
+mpconfig(mp **pmp)
+{
+	mpconf *conf;
+	mp *m;
+
+	if ((m = mpsearch()) == 0 || m->physaddr == 0)
+		return 0;
+	conf = mem_ptr(m->physaddr);
+	if (memcmp(conf, "PCMP", 4) != 0)
+		return 0;
+	if (conf->version != 1 && conf->version != 4)
+		return 0;
+	if (sum((uint8_t *) conf, conf->length) != 0)
+		return 0;
+	*pmp = m;
+	return conf;
+}
+
+void
+mp_init(void)
+{
+	uint8_t *p, *e;
+	mp *m;
+	mpconf *conf;
+	mpproc *proc;
+	mpioapic *mpio;
+
+	if (!cpu_onboot())	// only do once, on the boot CPU
+		return;
+
+	if ((conf = mpconfig(&m)) == 0)
+		return;		// Not a multiprocessor machine - just use boot CPU.
+
+	mp_ismp = 1;
+	for (p = conf->entries, e = (uint8_t *) conf + conf->length; p < e; ) {
+		switch (*p) {
+		case MPPROC:
+			proc = (mpproc *) p;
+			p += sizeof(mpproc);
+			if (!(proc->flags & MPENAB))
+				continue;	// processor disabled
+
+			// Get a cpu struct and kernel stack for this CPU.
+			cpu *c = (proc->flags & MPBOOT)
+					? &cpu_boot : cpu_alloc();
+			if (c == NULL) {
+				warn("mp_init: too many CPUs; ignoring APIC %d",
+					proc->apicid);
+				continue;
+			}
+			c->apicid = proc->apicid;
+			if (c != &cpu_boot)
+				mp_ncpu++;
+			continue;
+		case MPIOAPIC:
+			mpio = (mpioapic *) p;
+			p += sizeof(mpioapic);
+			mp_ioapicid = mpio->apicno;
+			mp_ioapicaddr = mpio->addr;
+			continue;
+		case MPBUS:
+		case MPIOINTR:
+		case MPLINTR:
+			p += 8;
+			continue;
+		default:
+			panic("mp_init: unknown config type %x\n", *p);
+		}
+	}
+	if (m->imcrp) {
+		// Bochs doesn't support IMCR, so this doesn't run on Bochs.
+		// But it would on real hardware.
+		outb(0x22, 0x70);		// Select IMCR
+		outb(0x23, inb(0x23) | 1);	// Mask external interrupts.
+	}
+}
@@ -0,0 +1,92 @@
+/*
+ * Retired-instruction counting with the architectural performance counters.
+ *
+ * We use only general-purpose counter 0, counting the "instructions
+ * retired" architectural event in user mode, so kernel work on behalf of
+ * a process never counts against it.  We arm the counter at -count, so it
+ * overflows, raising an interrupt through the local APIC, after 'count'
+ * instructions.  Writes to the counter MSR sign-extend bit 31,
+ * which is why counts must stay below 2^31.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/cpu.h>
+#include <kern/perf.h>
+
+#include <dev/lapic.h>
+
+
+bool perf_icnt;
+
+static int perf_version;	// Architectural perfmon version
+static uint64_t perf_mask;	// Mask for the counter's width
+
+
+void
+perf_init(void)
+{
+	if (cpu_onboot()) {
+		cpuinfo inf;
+		cpuid(0, &inf);
+		if (inf.eax < 0xa || !lapic)
+			return;
+		cpuid(0xa, &inf);
+		perf_version = inf.eax & 0xff;
+		int ncounters = (inf.eax >> 8) & 0xff;
+		int width = (inf.eax >> 16) & 0xff;
+		int nevents = (inf.eax >> 24) & 0xff;
+		// EBX bit 1 set means "instructions retired" is unavailable.
+		if (perf_version < 1 || ncounters < 1 || width < 32 ||
+				nevents < 2 || (inf.ebx & 0x2))
+			return;
+		perf_mask = (width < 64) ? (1ULL << width) - 1 : ~0ULL;
+		perf_icnt = 1;
+	}
+	if (!perf_icnt)
+		return;
+
+	wrmsr(MSR_PERFEVTSEL0, 0);
+	if (perf_version >= 2)
+		wrmsr(MSR_PERF_GLOBAL_CTRL, 1);	// enable counter 0 only
+	lapic_perfintr(T_PERFCTR);
+}
+
+void
+perf_arm(uint32_t count)
+{
+	assert(count > 0 && count < 0x80000000);
+	wrmsr(MSR_PERFEVTSEL0, 0);
+	wrmsr(MSR_PMC0, (uint64_t) -(int64_t) count);
+	cpu_cur()->perf_armed = count;
+	wrmsr(MSR_PERFEVTSEL0, PERFEVT_INSNS | PERFEVT_USR |
+				PERFEVT_INT | PERFEVT_EN);
+}
+
+uint32_t
+perf_stop(void)
+{
+	wrmsr(MSR_PERFEVTSEL0, 0);
+	cpu *c = cpu_cur();
+	uint64_t start = (uint64_t) -(int64_t) c->perf_armed & perf_mask;
+	uint64_t now = rdmsr(MSR_PMC0) & perf_mask;
+	c->perf_armed = 0;
+	return (now - start) & perf_mask;
+}
+
+void
+perf_intr(void)
+{
+	// Stop the counter so it can't overflow again before we re-arm it,
+	// clear the overflow, and unmask the APIC's performance interrupt.
+	uint64_t evtsel = rdmsr(MSR_PERFEVTSEL0);
+	wrmsr(MSR_PERFEVTSEL0, evtsel & ~PERFEVT_EN);
+	if (perf_version >= 2)
+		wrmsr(MSR_PERF_GLOBAL_OVF_CTRL, 1);
+	lapic_perfintr(T_PERFCTR);
+	lapic_eoi();
+}
@@ -0,0 +1,38 @@
+/*
+ * Retired-instruction counting with the architectural performance counters.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_PERF_H
+#define PIOS_KERN_PERF_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+
+// True if every CPU can count user-mode instructions and interrupt us
+// when a count runs out; set up by perf_init() on the boot CPU.
+extern bool perf_icnt;
+
+
+// Detect the performance monitoring unit, and point this CPU's
+// counter overflow interrupt at T_PERFCTR.
+void perf_init(void);
+
+// Start counting the current CPU's user-mode instructions,
+// raising T_PERFCTR after about 'count' of them (0 < count < 2^31).
+// The interrupt arrives a few instructions late ("skid").
+void perf_arm(uint32_t count);
+
+// Stop counting, returning the number of user-mode instructions
+// retired since perf_arm().
+uint32_t perf_stop(void);
+
+// Acknowledge a T_PERFCTR interrupt and re-enable the next one.
+void perf_intr(void);
+
+#endif /* !PIOS_KERN_PERF_H */
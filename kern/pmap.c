@@ -0,0 +1,686 @@
+/*
+ * Page mapping and page directory/table management.
+ *
+ * Physical memory below VM_USERLO, and I/O space above VM_USERHI,
+ * are identity-mapped in every address space with 4MB superpages,
+ * so the kernel can go on using physical addresses as pointers.
+ * Only the user region in between differs between processes,
+ * so switching address spaces costs a CR3 load and no more:
+ * the kernel's mappings are global and stay in the TLB.
+ *
+ * User space is managed PIOS-style: SYS_COPY shares pages copy-on-write,
+ * and SYS_MERGE brings a child's changes since its snapshot back into its
+ * parent by comparing each changed page against the snapshot,
+ * spreading the work across whatever CPUs are idle at the time.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/vm.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/sysinfo.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/pmap.h>
+#include <kern/sysinfo.h>
+#include <kern/trap.h>
+#include <kern/proc.h>
+
+#include <inc/syscall.h>
+
+
+pde_t pmap_bootpdir[NPDENTRIES] gcc_aligned(PAGESIZE);
+
+// The first 4MB uses a page table rather than a superpage,
+// so that the sysinfo page can have different permissions.
+static pte_t pmap_lowpt[NPTENTRIES] gcc_aligned(PAGESIZE);
+
+static bool pmap_pge;		// Processor supports global pages
+
+// A page of zeros that all unused user pages, and page directory entries
+// with no page table, refer to; PTE_ZERO is its physical address.
+// It is never written, and not reference counted.
+uint8_t pmap_zero[PAGESIZE] gcc_aligned(PAGESIZE);
+
+// A page table of nothing but PTE_ZERO entries,
+// which stands in for a missing page table when we're only reading.
+static pte_t pmap_zeropt[NPTENTRIES] gcc_aligned(PAGESIZE);
+
+
+void
+pmap_init(void)
+{
+	if (cpu_onboot()) {
+		cpuinfo inf;
+		cpuid(1, &inf);
+		if (!(inf.edx & CPUID_EDX_PSE))
+			panic("pmap_init: processor lacks 4MB pages");
+		pmap_pge = (inf.edx & CPUID_EDX_PGE) != 0;
+
+		// Physical memory is user-accessible, as the user segments
+		// always made it, except that user code can only read
+		// the sysinfo page; the kernel writes it through an alias.
+		int i;
+		for (i = 0; i < NPTENTRIES; i++)
+			pmap_lowpt[i] = (i << PAGESHIFT) |
+					PTE_P | PTE_W | PTE_U | PTE_G;
+		pmap_lowpt[PTX(SYSINFO_ADDR)] &= ~PTE_W;
+		pmap_lowpt[PTX(SYSINFO_KADDR)] = SYSINFO_ADDR |
+					PTE_P | PTE_W | PTE_G;
+		pmap_bootpdir[0] = mem_phys(pmap_lowpt) | PTE_P | PTE_W | PTE_U;
+		for (i = 1; i < PDX(VM_USERLO); i++)
+			pmap_bootpdir[i] = (i << PDXSHIFT) |
+				PTE_P | PTE_W | PTE_U | PTE_PS | PTE_G;
+
+		// User space starts out empty.
+		for (i = PDX(VM_USERLO); i < PDX(VM_USERHI); i++)
+			pmap_bootpdir[i] = PTE_ZERO;
+		for (i = 0; i < NPTENTRIES; i++)
+			pmap_zeropt[i] = PTE_ZERO;
+
+		// I/O space at the top, such as the LAPIC, is kernel-only.
+		for (i = PDX(VM_USERHI); i < NPDENTRIES; i++)
+			pmap_bootpdir[i] = (i << PDXSHIFT) |
+				PTE_P | PTE_W | PTE_PS | PTE_G;
+	}
+
+	// Enable 4MB pages and global pages, load the bootstrap page directory,
+	// and turn on paging.  With CR0_WP set, page protections apply to
+	// the kernel too, so kernel writes to read-only user pages will fault.
+	uint32_t cr4 = rcr4() | CR4_PSE;
+	if (pmap_pge)
+		cr4 |= CR4_PGE;
+	lcr4(cr4);
+	lcr3(mem_phys(pmap_bootpdir));
+	uint32_t cr0 = rcr0();
+	cr0 |= CR0_PE|CR0_PG|CR0_AM|CR0_WP|CR0_NE|CR0_MP;
+	cr0 &= ~(CR0_TS|CR0_EM);
+	lcr0(cr0);
+}
+
+pde_t *
+pmap_newpdir(void)
+{
+	pageinfo *pi = mem_alloc();
+	if (pi == NULL)
+		return NULL;
+	mem_incref(pi);
+	pde_t *pdir = mem_pi2ptr(pi);
+
+	// Initialize it from the bootstrap page directory
+	assert(sizeof(pmap_bootpdir) == PAGESIZE);
+	memmove(pdir, pmap_bootpdir, PAGESIZE);
+
+	return pdir;
+}
+
+void
+pmap_freepdir(pageinfo *pdirpi)
+{
+	pmap_remove(mem_pi2ptr(pdirpi), VM_USERLO, VM_USERHI-VM_USERLO);
+	mem_free(pdirpi);
+}
+
+// Take or drop a reference to the page a PTE maps,
+// unless it's the zero page or a device page.
+static void
+pmap_incref(pte_t pte)
+{
+	if (PGADDR(pte) != PTE_ZERO && !(pte & PTE_DEV))
+		mem_incref(mem_phys2pi(PGADDR(pte)));
+}
+
+static void
+pmap_decref(pte_t pte)
+{
+	if (PGADDR(pte) != PTE_ZERO && !(pte & PTE_DEV))
+		mem_decref(mem_phys2pi(PGADDR(pte)), mem_free);
+}
+
+// Return the page table a PDE refers to, or pmap_zeropt if there is none.
+static pte_t *
+pmap_ptab(pde_t pde)
+{
+	if (pde == PTE_ZERO)
+		return pmap_zeropt;
+	return mem_ptr(PGADDR(pde));
+}
+
+pte_t *
+pmap_walk(pde_t *pdir, uint32_t va, bool writing)
+{
+	assert(va >= VM_USERLO && va < VM_USERHI);
+	pde_t *pde = &pdir[PDX(va)];
+	if (*pde == PTE_ZERO) {
+		if (!writing)
+			return NULL;
+		pageinfo *pi = mem_alloc();
+		if (pi == NULL)
+			return NULL;
+		mem_incref(pi);
+		pte_t *ptab = mem_pi2ptr(pi);
+		memmove(ptab, pmap_zeropt, PAGESIZE);
+		*pde = mem_pi2phys(pi) | PTE_P | PTE_W | PTE_U;
+	}
+	return &pmap_ptab(*pde)[PTX(va)];
+}
+
+// Drop all the mappings in a page table, and then the page table itself.
+static void
+pmap_freeptab(pageinfo *ptabpi)
+{
+	pte_t *ptab = mem_pi2ptr(ptabpi);
+	int i;
+	for (i = 0; i < NPTENTRIES; i++)
+		pmap_decref(ptab[i]);
+	mem_free(ptabpi);
+}
+
+void
+pmap_remove(pde_t *pdir, uint32_t va, size_t size)
+{
+	assert(PGOFF(size) == 0);	// must be page-aligned
+	assert(va >= VM_USERLO && va < VM_USERHI);
+	assert(size <= VM_USERHI - va);
+
+	uint32_t eva = va + size;
+	while (va < eva) {
+		pde_t *pde = &pdir[PDX(va)];
+		if (*pde == PTE_ZERO) {		// nothing mapped here
+			va = ROUNDDOWN(va, PTSIZE) + PTSIZE;
+			continue;
+		}
+		if (PTOFF(va) == 0 && eva - va >= PTSIZE) {
+			// Removing the whole page table: just drop it.
+			mem_decref(mem_phys2pi(PGADDR(*pde)), pmap_freeptab);
+			*pde = PTE_ZERO;
+			va += PTSIZE;
+			continue;
+		}
+		pte_t *pte = &pmap_ptab(*pde)[PTX(va)];
+		pmap_decref(*pte);
+		*pte = PTE_ZERO;
+		va += PAGESIZE;
+	}
+}
+
+bool
+pmap_mapdev(pde_t *pdir, uint32_t va, uint32_t pa, size_t size, int perm)
+{
+	assert(PGOFF(va | pa | size) == 0);
+	assert(va >= VM_USERLO && va < VM_USERHI);
+	assert(size <= VM_USERHI - va);
+
+	uint32_t eva = va + size;
+	for (; va < eva; va += PAGESIZE, pa += PAGESIZE) {
+		pte_t *pte = pmap_walk(pdir, va, 1);
+		if (pte == NULL)
+			return 0;
+		pmap_decref(*pte);
+		*pte = pa | PTE_P | PTE_U | PTE_W | PTE_DEV | perm;
+	}
+	pmap_inval(pdir, eva - size, size);
+	return 1;
+}
+
+void
+pmap_inval(pde_t *pdir, uint32_t va, size_t size)
+{
+	// Only a running process's page tables can be cached in a TLB:
+	// stopped processes' tables are never loaded on any CPU (cpu_idle).
+	if (rcr3() != mem_phys(pdir))
+		return;
+	if (size == PAGESIZE)
+		invlpg(mem_ptr(va));
+	else
+		lcr3(mem_phys(pdir));
+}
+
+bool
+pmap_copy(pde_t *spdir, uint32_t sva, pde_t *dpdir, uint32_t dva, size_t size)
+{
+	assert(PTOFF(sva) == 0);	// must be 4MB-aligned
+	assert(PTOFF(dva) == 0);
+	assert(PTOFF(size) == 0);
+	assert(sva >= VM_USERLO && sva < VM_USERHI);
+	assert(dva >= VM_USERLO && dva < VM_USERHI);
+	assert(size <= VM_USERHI - sva && size <= VM_USERHI - dva);
+
+	pmap_remove(dpdir, dva, size);
+
+	// Share all the pages, read-only in both address spaces,
+	// so that either one gets its own copy when it writes to it.
+	uint32_t off;
+	for (off = 0; off < size; off += PTSIZE) {
+		pde_t spde = spdir[PDX(sva + off)];
+		if (spde == PTE_ZERO)
+			continue;
+		pte_t *spt = pmap_ptab(spde);
+		pte_t *dpt = pmap_walk(dpdir, dva + off, 1);
+		if (dpt == NULL)
+			return 0;
+		int i;
+		for (i = 0; i < NPTENTRIES; i++) {
+			if (spt[i] & PTE_DEV)
+				continue;	// devices stay with their driver
+			pte_t pte = spt[i] & ~PTE_W;
+			pmap_incref(pte);
+			spt[i] = dpt[i] = pte;
+		}
+	}
+
+	pmap_inval(spdir, sva, size);
+	pmap_inval(dpdir, dva, size);
+	return 1;
+}
+
+// Give a page table entry a private, writable page of its own,
+// copying the contents of the page it maps now.
+// Returns false if we're out of memory.
+static bool
+pmap_private(pte_t *pte)
+{
+	pageinfo *opi = mem_phys2pi(PGADDR(*pte));
+	if (PGADDR(*pte) == PTE_ZERO || opi->refcount > 1) {
+		pageinfo *pi = mem_alloc();
+		if (pi == NULL)
+			return 0;
+		mem_incref(pi);
+		memmove(mem_pi2ptr(pi), mem_ptr(PGADDR(*pte)), PAGESIZE);
+		pmap_decref(*pte);
+		*pte = mem_pi2phys(pi) | (*pte & PTE_AVAIL);
+	}
+	return 1;
+}
+
+void
+pmap_pagefault(trapframe *tf)
+{
+	// Only write faults on nominally writable user pages
+	// are copy-on-write faults; leave anything else to our caller.
+	uint32_t fva = rcr2();
+	if (fva < VM_USERLO || fva >= VM_USERHI || !(tf->err & PFE_WR))
+		return;
+	proc *p = proc_cur();
+	if (p == NULL)
+		return;
+	pte_t *pte = pmap_walk(p->pdir, fva, 0);
+	if (pte == NULL || !(*pte & SYS_WRITE))
+		return;
+
+	if (!pmap_private(pte))
+		return;		// out of memory: treat it as a real fault
+	*pte |= PTE_P | PTE_U | PTE_W;
+	pmap_inval(p->pdir, PGADDR(fva), PAGESIZE);
+	trap_return(tf);
+}
+
+bool
+pmap_setperm(pde_t *pdir, uint32_t va, uint32_t size, int perm)
+{
+	assert(PGOFF(va) == 0);
+	assert(PGOFF(size) == 0);
+	assert(va >= VM_USERLO && va < VM_USERHI);
+	assert(size <= VM_USERHI - va);
+	assert((perm & ~SYS_RW) == 0);
+
+	// Write access is only a nominal permission until the first write,
+	// when pmap_pagefault() makes sure the page is ours alone.
+	uint32_t pteperm = perm ? perm | PTE_P | PTE_U : 0;
+	uint32_t eva = va + size;
+	for (; va < eva; va += PAGESIZE) {
+		pte_t *pte = pmap_walk(pdir, va, perm != 0);
+		if (pte == NULL) {
+			if (perm != 0)
+				return 0;	// out of memory
+			va = ROUNDDOWN(va, PTSIZE) + PTSIZE - PAGESIZE;
+			continue;
+		}
+		if (*pte & PTE_DEV)
+			continue;	// device pages keep their access
+		*pte = PGADDR(*pte) | pteperm;
+	}
+	pmap_inval(pdir, eva - size, size);
+	return 1;
+}
+
+
+// Merge the changes from one source page, which has changed since the
+// reference snapshot, into the destination page, byte by byte.
+// Compares a word at a time, since most words won't have changed,
+// and looks at individual bytes only in words both sides changed.
+// Returns false if the source and destination changed the same byte
+// in different ways.
+static bool
+pmap_mergebytes(const uint32_t *rp, const uint32_t *sp, uint32_t *dp)
+{
+	int i;
+	for (i = 0; i < PAGESIZE/4; i++) {
+		uint32_t r = rp[i], s = sp[i], d = dp[i];
+		if (s == r || d == s)
+			continue;		// no change, or same change
+		if (d == r) {
+			dp[i] = s;		// only the source changed it
+			continue;
+		}
+		const uint8_t *rb = (const uint8_t*) &rp[i];
+		const uint8_t *sb = (const uint8_t*) &sp[i];
+		uint8_t *db = (uint8_t*) &dp[i];
+		int j;
+		for (j = 0; j < 4; j++) {
+			if (sb[j] == rb[j] || db[j] == sb[j])
+				continue;
+			if (db[j] != rb[j])
+				return 0;	// write/write conflict
+			db[j] = sb[j];
+		}
+	}
+	return 1;
+}
+
+// Merge one page.  On a write/write conflict the destination page
+// becomes inaccessible, so that the parent can't go on with
+// inconsistent data.  Returns false if out of memory.
+static bool
+pmap_mergepage(pte_t rpte, pte_t *spte, pte_t *dpte, sysinfo_cpu *sc)
+{
+	if (PGADDR(*spte) == PGADDR(rpte) || (*spte | *dpte) & PTE_DEV)
+		return 1;		// source didn't change it, or a device
+
+	if (PGADDR(*dpte) == PGADDR(rpte)) {
+		// Only the source changed the page: just share its copy.
+		*spte &= ~PTE_W;
+		pmap_incref(*spte);
+		pmap_decref(*dpte);
+		*dpte = *spte;
+		return 1;
+	}
+
+	// Both changed it, so merge at byte granularity into a private copy.
+	sc->merges++;
+	if (!pmap_private(dpte))
+		return 0;
+	if (*dpte & SYS_RW)
+		*dpte |= PTE_P | PTE_U;
+	if (*dpte & SYS_WRITE)
+		*dpte |= PTE_W;
+	if (!pmap_mergebytes(mem_ptr(PGADDR(rpte)), mem_ptr(PGADDR(*spte)),
+				mem_ptr(PGADDR(*dpte)))) {
+		sc->conflicts++;
+		pmap_decref(*dpte);
+		*dpte = PTE_ZERO;
+	}
+	return 1;
+}
+
+
+// A merge in progress, whose chunks any idle CPU can help with.
+// There's only one at a time; other merges just run on their own CPU.
+#define PMAP_MERGECHUNK	(64*PAGESIZE)	// Merge work unit: 256KB
+
+typedef struct pmap_mergejob {
+	volatile uint32_t busy;		// Someone is using this job struct
+	volatile uint32_t posted;	// Chunks are available to helpers
+	volatile uint32_t users;	// CPUs looking at the job
+	volatile uint32_t next;		// Next chunk to claim
+	volatile uint32_t done;		// Chunks completed
+	volatile bool	nomem;		// Some page ran out of memory
+	uint32_t	nchunk;
+	pde_t		*rpdir, *spdir, *dpdir;
+	uint32_t	sva, dva;
+} pmap_mergejob;
+
+static pmap_mergejob pmap_merger;
+
+// Claim and merge chunks of a job until there are none left.
+static void
+pmap_mergework(pmap_mergejob *j)
+{
+	sysinfo_cpu *sc = &sysinfo_page->cpu[cpu_cur()->id];
+	uint32_t n;
+	while ((n = xadd(&j->next, 1)) < j->nchunk) {
+		uint32_t off = n * PMAP_MERGECHUNK;
+		pde_t spde = j->spdir[PDX(j->sva + off)];
+		pde_t rpde = j->rpdir[PDX(j->sva + off)];
+		if (spde != rpde) {	// else neither has a page table
+			pte_t *rpt = pmap_ptab(rpde);
+			pte_t *spt = pmap_ptab(spde);
+			pte_t *dpt = pmap_ptab(j->dpdir[PDX(j->dva + off)]);
+			assert(dpt != pmap_zeropt);
+			int si = PTX(j->sva + off), di = PTX(j->dva + off);
+			int i;
+			for (i = 0; i < PMAP_MERGECHUNK/PAGESIZE; i++)
+				if (!pmap_mergepage(rpt[si+i], &spt[si+i],
+						&dpt[di+i], sc))
+					j->nomem = 1;
+		}
+		lockadd((volatile int32_t*) &j->done, 1);
+	}
+}
+
+void
+pmap_mergehelp(void)
+{
+	pmap_mergejob *j = &pmap_merger;
+	if (!j->posted)
+		return;
+
+	// Register ourselves first, so the job can't end and get reused
+	// while we're still looking at it.
+	lockadd((volatile int32_t*) &j->users, 1);
+	if (j->posted)
+		pmap_mergework(j);
+	lockadd((volatile int32_t*) &j->users, -1);
+}
+
+bool
+pmap_merge(pde_t *rpdir, pde_t *spdir, uint32_t sva,
+		pde_t *dpdir, uint32_t dva, size_t size)
+{
+	assert(PTOFF(sva) == 0);	// must be 4MB-aligned
+	assert(PTOFF(dva) == 0);
+	assert(PTOFF(size) == 0);
+	assert(sva >= VM_USERLO && sva < VM_USERHI);
+	assert(dva >= VM_USERLO && dva < VM_USERHI);
+	assert(size <= VM_USERHI - sva && size <= VM_USERHI - dva);
+
+	// Make sure the destination has page tables wherever there might be
+	// changes, so chunks of the same page table can be merged in parallel.
+	uint32_t off;
+	for (off = 0; off < size; off += PTSIZE)
+		if (spdir[PDX(sva + off)] != rpdir[PDX(sva + off)] &&
+				pmap_walk(dpdir, dva + off, 1) == NULL)
+			return 0;	// out of memory
+
+	// Post the job for idle CPUs to help with, unless it's in use.
+	pmap_mergejob *j = &pmap_merger;
+	pmap_mergejob local;
+	bool shared = xchg(&j->busy, 1) == 0;
+	if (!shared)
+		j = &local;
+	j->rpdir = rpdir;
+	j->spdir = spdir;
+	j->dpdir = dpdir;
+	j->sva = sva;
+	j->dva = dva;
+	j->nchunk = size / PMAP_MERGECHUNK;
+	j->next = 0;
+	j->done = 0;
+	j->nomem = 0;
+	if (shared) {
+		mfence();
+		j->posted = 1;
+		int i;
+		for (i = 1; i < j->nchunk && i < sysinfo_page->ncpu; i++)
+			cpu_kick();	// wake up idle CPUs to help
+	}
+
+	// Do our share, then wait for the helpers to finish theirs.
+	pmap_mergework(j);
+	while (j->done < j->nchunk)
+		pause();
+	bool ok = !j->nomem;
+
+	if (shared) {
+		j->posted = 0;
+		mfence();
+		while (j->users != 0)
+			pause();
+		j->busy = 0;
+	}
+
+	pmap_inval(spdir, sva, size);
+	pmap_inval(dpdir, dva, size);
+	return ok;
+}
+
+
+#define PMAP_CHECK_BASE		VM_USERLO	// Region we fork and merge
+#define PMAP_CHECK_SIZE		(2*PTSIZE)
+#define PMAP_CHECK_NCHILD	4
+#define PMAP_CHECK_DIRTY	(16*PAGESIZE)	// Bytes children interleave
+
+static char pmap_check_stack[PMAP_CHECK_NCHILD][PAGESIZE]
+	gcc_aligned(PAGESIZE);
+
+// Each child writes every PMAP_CHECK_NCHILD'th byte, starting at byte n,
+// so all the children change every word of the same pages.
+static void gcc_noreturn
+pmap_check_interleave(int n)
+{
+	uint8_t *p = (uint8_t*) PMAP_CHECK_BASE;
+	int i;
+	for (i = n; i < PMAP_CHECK_DIRTY; i += PMAP_CHECK_NCHILD)
+		p[i] = i % 255 + 1;
+	while (1)
+		sys_ret();
+}
+
+// Children 0 and 1 write the same byte differently.
+static void gcc_noreturn
+pmap_check_conflict(int n)
+{
+	*(volatile uint8_t*) PMAP_CHECK_BASE = n + 1;
+	while (1)
+		sys_ret();
+}
+
+// Try to read the page that had the conflict.
+static void gcc_noreturn
+pmap_check_touch(int n)
+{
+	(void) *(volatile uint8_t*) PMAP_CHECK_BASE;
+	while (1)
+		sys_ret();
+}
+
+// Change the second byte of every page, while our parent changes the first.
+static void gcc_noreturn
+pmap_check_dirty(int n)
+{
+	uint8_t *p = (uint8_t*) PMAP_CHECK_BASE;
+	int i;
+	for (i = 0; i < PMAP_CHECK_SIZE; i += PAGESIZE)
+		p[i+1] = 2;
+	while (1)
+		sys_ret();
+}
+
+// Fork child n with a snapshot of the check region, to run fn(n).
+static void
+pmap_check_fork(int n, void (*fn)(int))
+{
+	spawn(SYS_COPY | SYS_SNAP, n, NULL, &pmap_check_stack[n][PAGESIZE],
+		fn, n, (void*)PMAP_CHECK_BASE, (void*)PMAP_CHECK_BASE,
+		PMAP_CHECK_SIZE);
+}
+
+// Wait for child n and merge its changes back, returning its trap number.
+static int
+pmap_check_join(int n)
+{
+	procstate ps;
+	sys_get(SYS_REGS | SYS_MERGE, n, &ps,
+		(void*)PMAP_CHECK_BASE, (void*)PMAP_CHECK_BASE, PMAP_CHECK_SIZE);
+	return ps.tf.trapno;
+}
+
+static uint32_t
+pmap_check_conflicts(const volatile sysinfo *si)
+{
+	uint32_t sum = 0;
+	int i;
+	for (i = 0; i < si->ncpu; i++)
+		sum += si->cpu[i].conflicts;
+	return sum;
+}
+
+// Runs in user mode, as part of the root process.
+void
+pmap_check_user(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	uint8_t *p = (uint8_t*) PMAP_CHECK_BASE;
+	int i, n;
+
+	// Give ourselves a zero-filled region to work in.
+	sys_get(SYS_ZERO | SYS_PERM | SYS_RW, 0, NULL, NULL,
+		(void*)PMAP_CHECK_BASE, PMAP_CHECK_SIZE);
+	assert(p[0] == 0 && p[PMAP_CHECK_SIZE-1] == 0);
+
+	// Children writing disjoint bytes of the same words all get merged.
+	for (n = 0; n < PMAP_CHECK_NCHILD; n++)
+		pmap_check_fork(n, pmap_check_interleave);
+	for (n = 0; n < PMAP_CHECK_NCHILD; n++)
+		assert(pmap_check_join(n) == T_SYSCALL);
+	for (i = 0; i < PMAP_CHECK_DIRTY; i++)
+		assert(p[i] == i % 255 + 1);
+	for (; i < PMAP_CHECK_SIZE; i += PAGESIZE)
+		assert(p[i] == 0);
+
+	// Conflicting writes make the page inaccessible to the parent
+	// (and anything it forks), and get counted.
+	uint32_t conf0 = pmap_check_conflicts(si);
+	pmap_check_fork(0, pmap_check_conflict);
+	pmap_check_fork(1, pmap_check_conflict);
+	assert(pmap_check_join(0) == T_SYSCALL);
+	assert(pmap_check_join(1) == T_SYSCALL);
+	assert(pmap_check_conflicts(si) == conf0 + 1);
+	pmap_check_fork(2, pmap_check_touch);
+	assert(pmap_check_join(2) == T_PGFLT);
+	sys_get(SYS_ZERO | SYS_PERM | SYS_RW, 0, NULL, NULL,
+		(void*)PMAP_CHECK_BASE, PMAP_CHECK_SIZE);
+	assert(p[0] == 0);
+
+	// How fast is a merge where every page needs a byte-level merge?
+	for (i = 0; i < PMAP_CHECK_SIZE; i += PAGESIZE)
+		p[i] = 1;
+	pmap_check_fork(0, pmap_check_dirty);
+	for (i = 0; i < PMAP_CHECK_SIZE; i += PAGESIZE)
+		p[i] = 3;
+	procstate ps;
+	sys_get(0, 0, &ps, NULL, NULL, 0);	// wait for it to finish first
+	uint64_t t0 = rdtsc();
+	assert(pmap_check_join(0) == T_SYSCALL);
+	uint64_t cycles = rdtsc() - t0;
+	for (i = 0; i < PMAP_CHECK_SIZE; i += PAGESIZE)
+		assert(p[i] == 3 && p[i+1] == 2);
+	cprintf("pmap_check: merged %d pages in %d cycles/page on %d CPUs\n",
+		PMAP_CHECK_SIZE / PAGESIZE,
+		(int) (cycles / (PMAP_CHECK_SIZE / PAGESIZE)), si->ncpu);
+
+	// Release the region, and what the children still hold of it.
+	for (n = 0; n < PMAP_CHECK_NCHILD; n++)
+		sys_put(SYS_ZERO | SYS_SNAP, n, NULL, NULL,
+			(void*)PMAP_CHECK_BASE, PMAP_CHECK_SIZE);
+	sys_get(SYS_ZERO | SYS_PERM, 0, NULL, NULL,
+		(void*)PMAP_CHECK_BASE, PMAP_CHECK_SIZE);
+
+	cprintf("pmap_check_user() succeeded!\n");
+}
@@ -0,0 +1,103 @@
+/*
+ * Page mapping and page directory/table management definitions.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_PMAP_H
+#define PIOS_KERN_PMAP_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/mmu.h>
+#include <inc/vm.h>
+
+#include <inc/trap.h>
+
+#include <kern/mem.h>
+
+
+// Page directory and page table entries
+typedef uint32_t pte_t;
+typedef pte_t pde_t;
+
+// The bootstrap page directory, which maps only the kernel's regions
+// (see inc/vm.h) and which all process page directories start from.
+extern pde_t pmap_bootpdir[NPDENTRIES];
+
+// Unused user pages, and user PDEs with no page table,
+// refer to this page of zeros, with no access permissions.
+extern uint8_t pmap_zero[PAGESIZE];
+#define PTE_ZERO	(mem_phys(pmap_zero))
+
+// A device page, either memory-mapped I/O or a pinned DMA buffer
+// (see kern/udev.c), in the one PTE_AVAIL bit SYS_RW leaves free.
+// We don't reference-count such pages, copy them on write, or merge them:
+// they stay mapped, writable, right where the driver put them.
+#define PTE_DEV		0x800
+
+
+// Set up the bootstrap page directory on the boot CPU,
+// and enable paging with it on the current CPU.
+void pmap_init(void);
+
+// Allocate a new page directory for a process,
+// with the kernel's mappings and an empty user space.
+// Returns NULL if out of memory.
+pde_t *pmap_newpdir(void);
+
+// Free a page directory allocated by pmap_newpdir(),
+// and everything its user space maps.
+void pmap_freepdir(pageinfo *pdirpi);
+
+// Find the page table entry for user address 'va' in a page directory.
+// If there's no page table there yet, allocate one if 'writing',
+// else return NULL.  Also returns NULL if out of memory.
+pte_t *pmap_walk(pde_t *pdir, uint32_t va, bool writing);
+
+// Unmap a page-aligned range of user space.
+void pmap_remove(pde_t *pdir, uint32_t va, size_t size);
+
+// Map the physical pages [pa,pa+size) at user address 'va' as device pages,
+// with PTE_P, PTE_U, PTE_W, PTE_DEV and any extra 'perm' (e.g. PTE_PCD),
+// replacing whatever was mapped there.  Returns false if out of memory.
+bool pmap_mapdev(pde_t *pdir, uint32_t va, uint32_t pa, size_t size,
+		int perm);
+
+// Invalidate any TLB entries this CPU has for a range of user space,
+// after we've changed the page tables for it.
+void pmap_inval(pde_t *pdir, uint32_t va, size_t size);
+
+// Copy a 4MB-aligned range of user space from one page directory
+// to another, sharing the pages copy-on-write.
+// Returns false if out of memory.
+bool pmap_copy(pde_t *spdir, uint32_t sva, pde_t *dpdir, uint32_t dva,
+		size_t size);
+
+// Handle a copy-on-write fault on behalf of the current process,
+// returning to the faulting code if it was one, else to our caller.
+void pmap_pagefault(trapframe *tf);
+
+// Set the nominal permissions (SYS_READ/SYS_WRITE) on a page-aligned
+// range of user space.  Returns false if out of memory.
+bool pmap_setperm(pde_t *pdir, uint32_t va, uint32_t size, int perm);
+
+// Merge the changes made in a 4MB-aligned source range since the
+// reference snapshot 'rpdir' into the destination range.  Each changed page
+// that the destination also changed is merged byte by byte; where both
+// changed the same byte, the destination page becomes inaccessible.
+// Idle CPUs help with large merges, via pmap_mergehelp().
+// Returns false if out of memory, having merged only some pages.
+bool pmap_merge(pde_t *rpdir, pde_t *spdir, uint32_t sva,
+		pde_t *dpdir, uint32_t dva, size_t size);
+
+// Called by idle CPUs to help with any merge in progress.
+void pmap_mergehelp(void);
+
+// Check fork/join memory semantics from user mode,
+// and report how fast a parallel merge runs.
+void pmap_check_user(void);
+
+#endif /* !PIOS_KERN_PMAP_H */
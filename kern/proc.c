@@ -0,0 +1,932 @@
+/*
+ * PIOS process management.
+ *
+ * Each CPU has its own run queue of ready processes: a work-stealing
+ * deque, which only the owning CPU pushes to and pops from (at the
+ * bottom, without any atomic instructions in the common case),
+ * while idle CPUs with nothing of their own to run steal the oldest
+ * ready processes from the top of other CPUs' deques using CMPXCHG.
+ * See Chase and Lev, "Dynamic Circular Work-Stealing Deque", SPAA 2005.
+ * Since a process made ready goes on the queue of the CPU that readied it,
+ * processes that interact tend to stay on the same CPU,
+ * while idle CPUs spread any excess work around.
+ * A process made ready while its CPU's deque is full goes on a shared,
+ * locked overflow list instead, whence CPUs move processes back to
+ * their deques as they make room.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/syscall.h>
+#include <inc/sysinfo.h>
+
+#include <kern/cpu.h>
+#include <kern/cons.h>
+#include <kern/mem.h>
+#include <kern/trap.h>
+#include <kern/proc.h>
+#include <kern/init.h>
+#include <kern/sysinfo.h>
+#include <kern/clock.h>
+#include <kern/timer.h>
+#include <kern/perf.h>
+#include <kern/udev.h>
+#include <kern/trace.h>
+
+
+proc *proc_root;		// root process, once it's created in init()
+
+proc_preempt_mode proc_preemption;
+
+#define PROC_RQSIZE	1024	// Max ready processes per CPU (power of 2)
+#define PROC_RQMASK	(PROC_RQSIZE - 1)
+
+// A CPU's run queue.  Indexes increase forever and wrap around buf.
+typedef struct procdeque {
+	volatile uint32_t top;		// Next process to steal
+	volatile uint32_t bottom;	// Where the owner pushes next
+	proc *volatile	buf[PROC_RQSIZE];
+} procdeque;
+
+static procdeque proc_rq[CPU_MAX];
+
+// Processes that found their run queue full, oldest first.
+static spinlock proc_overflow_lock;
+static proc *proc_overflow_head;
+static proc **proc_overflow_tail = &proc_overflow_head;
+
+// Gangs whose members are all waiting to be dispatched together, in order.
+static spinlock proc_gangq_lock;
+static procgang *proc_gangq_head;
+static procgang **proc_gangq_tail = &proc_gangq_head;
+
+
+// Push a process onto the bottom of our own run queue.
+// Returns false if the queue is full.
+static bool
+proc_push(procdeque *dq, proc *p)
+{
+	uint32_t b = dq->bottom;
+	if (b - dq->top >= PROC_RQSIZE)
+		return 0;
+	dq->buf[b & PROC_RQMASK] = p;
+	// x86 doesn't reorder stores, so thieves that see the new
+	// bottom will see the process too.
+	asm volatile("" : : : "memory");
+	dq->bottom = b + 1;
+	return 1;
+}
+
+// Move the oldest process on the overflow list, if any,
+// to our own run queue, if it has room.
+static void
+proc_refill(procdeque *dq)
+{
+	if (proc_overflow_head == NULL)
+		return;		// the usual case, so don't take the lock
+	spinlock_acquire(&proc_overflow_lock);
+	proc *p = proc_overflow_head;
+	if (p != NULL && proc_push(dq, p)) {
+		proc_overflow_head = p->rqnext;
+		if (proc_overflow_head == NULL)
+			proc_overflow_tail = &proc_overflow_head;
+		p->rqnext = NULL;
+	}
+	spinlock_release(&proc_overflow_lock);
+}
+
+// Pop the most recently pushed process from our own run queue.
+static proc *
+proc_pop(procdeque *dq)
+{
+	uint32_t b = dq->bottom - 1;
+	dq->bottom = b;
+	mfence();	// claim the slot before checking for thieves
+	uint32_t t = dq->top;
+	if ((int32_t) (b - t) < 0) {	// empty
+		dq->bottom = t;
+		return NULL;
+	}
+	proc *p = dq->buf[b & PROC_RQMASK];
+	if (b != t)
+		return p;	// more than one left: no thief can get this one
+
+	// Taking the last one, so race any thieves for it.
+	if (cmpxchg(&dq->top, t, t + 1) != t)
+		p = NULL;	// a thief won
+	dq->bottom = t + 1;
+	return p;
+}
+
+// Try to steal the oldest process from another CPU's run queue.
+static proc *
+proc_steal1(procdeque *dq)
+{
+	while (1) {
+		uint32_t t = dq->top;
+		asm volatile("" : : : "memory");	// x86 keeps loads in order
+		uint32_t b = dq->bottom;
+		if ((int32_t) (b - t) <= 0)
+			return NULL;
+		proc *p = dq->buf[t & PROC_RQMASK];
+		if (cmpxchg(&dq->top, t, t + 1) == t)
+			return p;
+		pause();	// lost a race with the owner or a thief; retry
+	}
+}
+
+// Look for work on other CPUs, starting with our neighbor,
+// so that thieves don't all go after the same CPU.
+static proc *
+proc_steal(cpu *self)
+{
+	cpu *c = self->next ? self->next : &cpu_boot;
+	for (; c != self; c = c->next ? c->next : &cpu_boot) {
+		proc *p = proc_steal1(&proc_rq[c->id]);
+		if (p != NULL) {
+			sysinfo_page->cpu[self->id].steals++;
+			return p;
+		}
+	}
+	return NULL;
+}
+
+
+void
+proc_init(void)
+{
+	if (!cpu_onboot())
+		return;
+
+	spinlock_init(&proc_gangq_lock);
+	spinlock_init(&proc_overflow_lock);
+}
+
+proc *
+proc_alloc(proc *p, uint32_t cn)
+{
+	pageinfo *pi = mem_alloc();
+	if (!pi)
+		return NULL;
+	mem_incref(pi);
+
+	proc *cp = (proc*)mem_pi2ptr(pi);
+	memset(cp, 0, sizeof(proc));
+	spinlock_init(&cp->lock);
+	cp->parent = p;
+	cp->state = PROC_STOP;
+	spinlock_init(&cp->kids.lock);
+
+	cp->pdir = pmap_newpdir();
+	if (cp->pdir == NULL) {
+		mem_decref(pi, mem_free);
+		return NULL;
+	}
+
+	// Integer register state
+	cp->sv.tf.ds = CPU_GDT_UDATA | 3;
+	cp->sv.tf.es = CPU_GDT_UDATA | 3;
+	cp->sv.tf.fs = CPU_GDT_UDATA | 3;
+	cp->sv.tf.gs = CPU_GDT_UDATA | 3;
+	cp->sv.tf.cs = CPU_GDT_UCODE | 3;
+	cp->sv.tf.ss = CPU_GDT_UDATA | 3;
+	memset(cp->iomap, 0xff, sizeof(cp->iomap));	// no I/O ports
+
+	// Only the root process may use all the I/O ports, with IOPL 3;
+	// others get just the ones they claim (see kern/udev.c).
+	cp->sv.tf.eflags = FL_IF | (p == NULL ? FL_IOPL_3 : FL_IOPL_0);
+
+	if (p)
+		p->child[cn] = cp;
+	return cp;
+}
+
+void
+proc_ready(proc *p)
+{
+	p->state = PROC_READY;
+	if (!proc_push(&proc_rq[cpu_cur()->id], p)) {
+		// More ready processes than fit: user code can make that
+		// happen, so it's no reason to panic.
+		spinlock_acquire(&proc_overflow_lock);
+		p->rqnext = NULL;
+		*proc_overflow_tail = p;
+		proc_overflow_tail = &p->rqnext;
+		spinlock_release(&proc_overflow_lock);
+	}
+	cpu_kick();		// get an idle CPU, if any, to come steal it
+}
+
+// Put gang 'g' on the gang run queue if all its remaining members
+// are waiting to be dispatched.  Called with g->lock held.
+static void
+proc_gangenq(procgang *g)
+{
+	if (g->queued || g->nrun > 0 || g->nwait == 0)
+		return;
+	g->queued = 1;
+	g->next = NULL;
+	spinlock_acquire(&proc_gangq_lock);
+	*proc_gangq_tail = g;
+	proc_gangq_tail = &g->next;
+	spinlock_release(&proc_gangq_lock);
+	cpu_kick();		// an idle CPU can start it
+}
+
+static void
+proc_gangqueue(procgang *g)
+{
+	spinlock_acquire(&g->lock);
+	proc_gangenq(g);
+	spinlock_release(&g->lock);
+}
+
+// The current process 'p' is leaving its gang for good,
+// because it stopped or is waiting for a child of its own.
+static void
+proc_gangleave(proc *p)
+{
+	procgang *g = p->gang;
+	if (g == NULL)
+		return;
+	spinlock_acquire(&g->lock);
+	p->gang = NULL;
+	g->nrun--;
+	proc_gangenq(g);	// the others may be waiting on us
+	spinlock_release(&g->lock);
+}
+
+// Find a CPU other than 'self' to run gang member 'p' next,
+// preferring idle CPUs, and never taking one from another gang.
+static cpu *
+proc_gangcpu(cpu *self, proc *p)
+{
+	int pass;
+	for (pass = 0; pass < 2; pass++) {
+		cpu *c;
+		for (c = &cpu_boot; c != NULL; c = c->next) {
+			if (c == self || !c->booted)
+				continue;
+			if (pass == 0 && c->idle_start == 0)
+				continue;
+			proc *cur = c->proc;
+			if (cur != NULL && cur->gang != NULL)
+				continue;
+			if (cmpxchg((volatile uint32_t*) &c->gang_next,
+					0, (uint32_t) p) == 0) {
+				cpu_poke(c);
+				return c;
+			}
+		}
+	}
+	return NULL;
+}
+
+// Dispatch all the waiting members of gang 'g' at once, each on its own
+// CPU, running one of them right here.  Called with g->lock held.
+static void gcc_noreturn
+proc_ganglaunch(procgang *g)
+{
+	cpu *self = cpu_cur();
+	proc *mine = NULL;
+	g->stop = 0;
+	int i;
+	for (i = 0; i < g->n; i++) {
+		proc *p = g->memb[i];
+		if (p->gang != g || p->state != PROC_GANG)
+			continue;
+		g->nwait--;
+		g->nrun++;
+		p->state = PROC_READY;
+		if (mine == NULL)
+			mine = p;
+		else if (proc_gangcpu(self, p) == NULL) {
+			// More members than free CPUs: the rest run as usual.
+			g->nrun--;
+			p->gang = NULL;
+			proc_ready(p);
+		}
+	}
+	assert(mine != NULL);
+	spinlock_release(&g->lock);
+
+	sysinfo_page->cpu[self->id].gangs++;
+	proc_run(mine);
+}
+
+// Run the gang member another CPU handed us, if any,
+// or else dispatch the next gang waiting to run, if any.
+static void
+proc_gangnext(cpu *c)
+{
+	proc *p = (proc*) xchg((volatile uint32_t*) &c->gang_next, 0);
+	if (p != NULL)
+		proc_run(p);
+
+	if (proc_gangq_head == NULL)
+		return;
+	spinlock_acquire(&proc_gangq_lock);
+	procgang *g = proc_gangq_head;
+	if (g != NULL && (proc_gangq_head = g->next) == NULL)
+		proc_gangq_tail = &proc_gangq_head;
+	spinlock_release(&proc_gangq_lock);
+	if (g == NULL)
+		return;
+
+	spinlock_acquire(&g->lock);
+	g->queued = 0;
+	proc_ganglaunch(g);
+}
+
+// Stop the current gang member 'p', which we've saved,
+// along with all the other members of its gang that are running,
+// then run something else for a while.
+static void gcc_noreturn
+proc_gangstop(cpu *c, proc *p)
+{
+	procgang *g = p->gang;
+	spinlock_acquire(&g->lock);
+	if (!g->stop) {
+		g->stop = 1;
+		int i;
+		for (i = 0; i < g->n; i++) {
+			proc *mp = g->memb[i];
+			if (mp != p && mp->gang == g && mp->state == PROC_RUN)
+				cpu_poke(mp->runcpu);
+		}
+	}
+	p->state = PROC_GANG;
+	g->nrun--;
+	g->nwait++;
+	proc_gangenq(g);
+	spinlock_release(&g->lock);
+
+	// Give whatever the gang displaced here a turn before it comes back.
+	proc *np = proc_steal1(&proc_rq[c->id]);
+	if (np != NULL)
+		proc_run(np);
+	cpu_idle();
+}
+
+void
+proc_gang(proc *p, proc *cp)
+{
+	procgang *g = &p->kids;
+	spinlock_acquire(&g->lock);
+	if (g->nrun == 0 && g->nwait == 0)
+		g->n = 0;		// the last gang is all done
+	if (g->n == PROC_GANGMAX) {
+		spinlock_release(&g->lock);
+		proc_ready(cp);		// too many: run it on its own
+		return;
+	}
+	g->memb[g->n++] = cp;
+	cp->gang = g;
+	cp->state = PROC_GANG;
+	g->nwait++;
+	spinlock_release(&g->lock);
+}
+
+void
+proc_gangipi(trapframe *tf)
+{
+	cpu *c = cpu_cur();
+	proc *p = c->proc;
+	procgang *g = p->gang;
+	if (g != NULL) {
+		if (g->stop) {		// our gang's time slice is up
+			proc_save(p, tf, 1);
+			proc_gangstop(c, p);
+		}
+		return;		// gang members don't make way for others
+	}
+
+	// Make way for a gang member.
+	proc *np = (proc*) xchg((volatile uint32_t*) &c->gang_next, 0);
+	if (np == NULL)
+		return;
+	proc_save(p, tf, 1);
+	proc_ready(p);
+	proc_run(np);
+}
+
+void
+proc_save(proc *p, trapframe *tf, int entry)
+{
+	if (tf != &p->sv.tf)
+		p->sv.tf = *tf;
+	if (entry == 0)
+		p->sv.tf.eip -= 2;	// back up to the INT instruction
+
+	// Stop the clock on this time slice.
+	cpu *c = cpu_cur();
+	if (c->perf_armed) {
+		uint32_t n = perf_stop();
+		if (p->sv.pff & PFF_ICNT)
+			p->sv.icnt += n;
+	}
+	timer_cancel(&c->quantum);
+	c->preempt = 0;
+	p->sv.tf.eflags &= ~FL_TF;	// proc_run() decides on single-stepping
+}
+
+void gcc_noreturn
+proc_wait(proc *p, proc *cp, trapframe *tf)
+{
+	assert(spinlock_holding(&cp->lock));
+	assert(cp->state != PROC_STOP);
+
+	p->state = PROC_WAIT;
+	cp->waiter = p;
+	proc_save(p, tf, 0);	// retry the system call once cp stops
+	spinlock_release(&cp->lock);
+
+	// Waiting means we've started all the children we're going to:
+	// it's time for our gang, if we have one, to run.
+	proc_gangleave(p);
+	proc_gangqueue(&p->kids);
+	cpu_idle();		// find something else to do
+}
+
+void gcc_noreturn
+proc_block(proc *p, trapframe *tf, spinlock *lk)
+{
+	assert(spinlock_holding(lk));
+	proc_save(p, tf, 1);
+	p->state = PROC_BLOCK;
+	spinlock_release(lk);
+
+	proc_gangleave(p);
+	proc_gangqueue(&p->kids);
+	cpu_idle();
+}
+
+void
+proc_sched(void)
+{
+	cpu *c = cpu_cur();
+
+	// Gangs come first, since their members are waiting for each other.
+	proc_gangnext(c);
+
+	proc_refill(&proc_rq[c->id]);
+	proc *p = proc_pop(&proc_rq[c->id]);
+	if (p == NULL)
+		p = proc_steal(c);
+	if (p != NULL)
+		proc_run(p);
+}
+
+// Time slice timer expiry, used when we can't count instructions.
+static void
+proc_quantum(timer *t)
+{
+	cpu *c = t->arg;
+	c->preempt = 1;		// trap() preempts once we're back in user mode
+}
+
+// Start the clock on process 'p's time slice on CPU 'c'.
+static void
+proc_arm(cpu *c, proc *p)
+{
+	proc_preempt_mode mode = proc_preemption;
+	if (mode == PROC_PREEMPT_AUTO || (mode == PROC_PREEMPT_ICNT && !perf_icnt))
+		mode = perf_icnt ? PROC_PREEMPT_ICNT : PROC_PREEMPT_TIME;
+
+	c->preempt = 0;
+	uint32_t insns = PROC_QUANTUM_INSNS;
+	if (p->sv.pff & PFF_ICNT) {
+		int32_t left = p->sv.imax - p->sv.icnt;
+		if (mode != PROC_PREEMPT_ICNT || left <= PROC_ICNT_SKID) {
+			// Count the rest exactly, one instruction at a time.
+			p->sv.tf.eflags |= FL_TF;
+			insns = 0;
+		} else
+			insns = MIN(insns, left - PROC_ICNT_SKID);
+	}
+
+	if (mode == PROC_PREEMPT_ICNT && insns > 0)
+		perf_arm(insns);
+	else if (mode == PROC_PREEMPT_TIME)
+		timer_set(&c->quantum, clock_ns() + PROC_QUANTUM_NS,
+				proc_quantum, c);
+}
+
+void gcc_noreturn
+proc_run(proc *p)
+{
+	cpu *c = cpu_cur();
+
+	// We might be on our way out of the idle loop.
+	if (c->idle_start) {
+		cpu_wake(c);
+		c->idle_woke = 0;
+	}
+
+	p->state = PROC_RUN;
+	p->runcpu = c;
+	c->proc = p;
+	TRACE(procrun, p, p->sv.tf.eip, p->sv.tf.esp, 0);
+	sysinfo_page->cpu[c->id].switches++;
+
+	// Kernel mappings are global, so only a real switch of address space
+	// costs anything more than restoring registers.
+	if (rcr3() != mem_phys(p->pdir))
+		lcr3(mem_phys(p->pdir));
+
+	// Base the thread-local storage segment where the process wants it;
+	// trap_return reloads %gs from it.
+	if (c->tls != p->sv.tls) {
+		c->gdt[CPU_GDT_UDTLS >> 3] = SEGDESC32(1, STA_W, p->sv.tls,
+							0xffffffff, 3);
+		c->tls = p->sv.tls;
+	}
+	udev_switch(c, p);
+
+	proc_arm(c, p);
+	trap_return(&p->sv.tf);
+}
+
+void gcc_noreturn
+proc_yield(trapframe *tf)
+{
+	cpu *c = cpu_cur();
+	proc *p = c->proc;
+
+	// Gang members keep their CPUs for the rest of the gang's time slice.
+	if (p->gang != NULL)
+		trap_return(tf);
+
+	// Take the next process before putting ourselves back,
+	// or we'd just get ourselves again.
+	proc *np = proc_pop(&proc_rq[c->id]);
+	if (np == NULL)
+		trap_return(tf);	// nobody else to run here
+
+	proc_save(p, tf, 1);
+	proc_ready(p);
+	proc_run(np);
+}
+
+void
+proc_work(trapframe *tf)
+{
+	cpu *c = cpu_cur();
+	proc *p = c->proc;
+	if (p->gang != NULL)
+		return;		// let the gang's time slice run out first
+
+	proc_save(p, tf, 1);
+	proc_ready(p);		// we'll likely get it right back
+	cpu_idle();		// which runs the work first
+}
+
+void gcc_noreturn
+proc_preempt(trapframe *tf)
+{
+	cpu *c = cpu_cur();
+	proc *p = c->proc;
+	proc_save(p, tf, 1);
+
+	// The counter interrupt just gets a process near its instruction
+	// limit started on single-stepping the rest (see proc_arm).
+	if ((p->sv.pff & PFF_ICNT) &&
+			p->sv.imax - p->sv.icnt <= PROC_ICNT_SKID)
+		proc_run(p);
+
+	// A gang's time slice ends for all its members together.
+	if (p->gang != NULL) {
+		sysinfo_page->cpu[c->id].preempts++;
+		proc_gangstop(c, p);
+	}
+
+	// Let a gang waiting to run have this CPU.
+	if (c->gang_next != NULL || proc_gangq_head != NULL) {
+		sysinfo_page->cpu[c->id].preempts++;
+		proc_ready(p);
+		proc_gangnext(c);
+		cpu_idle();	// someone else got the gang first
+	}
+
+	// Take the oldest ready process, not the newest,
+	// so that processes sharing this CPU take turns.
+	proc_refill(&proc_rq[c->id]);
+	proc *np = proc_steal1(&proc_rq[c->id]);
+	if (np == NULL)
+		proc_run(p);	// nothing else to run: start a new slice
+
+	sysinfo_page->cpu[c->id].preempts++;
+	proc_ready(p);		// some idle CPU may steal it right away
+	proc_run(np);
+}
+
+void gcc_noreturn
+proc_step(trapframe *tf)
+{
+	proc *p = proc_cur();
+	assert(tf->eflags & FL_TF);
+
+	// If the instruction was a system call, trap() counted it already,
+	// and we're now one past it; that's still the same every time.
+	if (++p->sv.icnt >= p->sv.imax) {
+		tf->trapno = T_ICNT;
+		proc_ret(tf, -1);
+	}
+	trap_return(tf);
+}
+
+void gcc_noreturn
+proc_ret(trapframe *tf, int entry)
+{
+	proc *cp = proc_cur();
+	proc *p = cp->parent;
+
+	// The root process has nowhere to return to:
+	// the system is done, so idle in the kernel from now on.
+	if (p == NULL) {
+		if (tf->trapno != T_SYSCALL) {
+			trap_print(tf);
+			panic("trap in root process");
+		}
+		proc_save(cp, tf, entry);
+		trace_done();
+		cons_flush();
+		done();
+	}
+
+	spinlock_acquire(&cp->lock);
+	proc_save(cp, tf, entry);
+	cp->state = PROC_STOP;
+	proc *waiter = cp->waiter;
+	cp->waiter = NULL;
+	spinlock_release(&cp->lock);
+
+	proc_gangleave(cp);
+	proc_gangqueue(&cp->kids);
+
+	if (waiter != NULL)
+		proc_ready(waiter);
+	cpu_idle();
+}
+
+
+#define PROC_CHECK_NCHILD	64		// Max children we use
+#define PROC_CHECK_YIELDS	1000		// Yields per yielding child
+#define PROC_CHECK_WORK		(1 << 20)	// Loop iterations per job
+#define PROC_CHECK_IMAX		100000		// Instruction limit to test
+#define PROC_CHECK_LONGWORK	(1 << 24)	// Iterations of a long job
+#define PROC_CHECK_ROUNDS	100		// Barrier rounds per gang member
+#define PROC_CHECK_HOG		32		// First child # of CPU hogs
+
+static char proc_check_stack[PROC_CHECK_NCHILD][PAGESIZE]
+	gcc_aligned(PAGESIZE);
+static volatile uint64_t proc_check_cycles[PROC_CHECK_NCHILD];
+
+static void
+proc_check_work(void)
+{
+	volatile int i;
+	for (i = 0; i < PROC_CHECK_WORK; i++)
+		;
+}
+
+static void gcc_noreturn
+proc_check_yielder(int n)
+{
+	uint64_t t0 = rdtsc();
+	int i;
+	for (i = 0; i < PROC_CHECK_YIELDS; i++)
+		sys_yield();
+	proc_check_cycles[n] = rdtsc() - t0;
+	while (1)
+		sys_ret();
+}
+
+static volatile uint32_t proc_check_count[PROC_CHECK_NCHILD];
+
+// Spin forever, until our instruction limit stops us.
+static void gcc_noreturn
+proc_check_spinner(int n)
+{
+	while (1)
+		proc_check_count[n]++;
+}
+
+// A job that runs for several time slices.
+static void gcc_noreturn
+proc_check_longworker(int n)
+{
+	volatile int i;
+	for (i = 0; i < PROC_CHECK_LONGWORK; i++)
+		;
+	while (1)
+		sys_ret();
+}
+
+static volatile uint32_t proc_check_barcount;	// Members arrived
+static volatile uint32_t proc_check_barsense;	// Flips when all have
+static int proc_check_barn;			// Members in the barrier
+
+// Run barrier rounds with our siblings, in each of which
+// every member has to wait for the last one to arrive.
+static void gcc_noreturn
+proc_check_barrier(int n)
+{
+	uint32_t sense = 0;
+	uint64_t t0 = rdtsc();
+	int i;
+	for (i = 0; i < PROC_CHECK_ROUNDS; i++) {
+		sense = !sense;
+		if (xadd(&proc_check_barcount, 1) == proc_check_barn - 1) {
+			proc_check_barcount = 0;
+			proc_check_barsense = sense;
+		} else
+			while (proc_check_barsense != sense)
+				pause();
+	}
+	proc_check_cycles[n] = rdtsc() - t0;
+	while (1)
+		sys_ret();
+}
+
+static void gcc_noreturn
+proc_check_worker(int n)
+{
+	proc_check_work();
+	while (1)
+		sys_ret();
+}
+
+// Start child n running fn(n) on its own stack.
+static void
+proc_check_spawn(int n, void (*fn)(int), uint32_t flags)
+{
+	spawn(flags, n, NULL, &proc_check_stack[n][PAGESIZE], fn, n,
+		NULL, NULL, 0);
+}
+
+// Sum one of the per-CPU counters in the sysinfo page over all CPUs.
+#define proc_check_sum(si, field) ({ \
+	uint32_t __sum = 0; \
+	int __i; \
+	for (__i = 0; __i < (si)->ncpu; __i++) \
+		__sum += (si)->cpu[__i].field; \
+	__sum; })
+
+// Run a process until its instruction limit stops it, twice,
+// and check it stops at exactly the same point both times.
+static void
+proc_check_icnt(void)
+{
+	uint32_t eip[2], count[2];
+	int run;
+	for (run = 0; run < 2; run++) {
+		proc_check_count[0] = 0;
+		uint32_t *esp = (uint32_t*) &proc_check_stack[0][PAGESIZE];
+		*--esp = 0;		// argument
+		*--esp = 0;		// fake return address
+
+		procstate ps;
+		memset(&ps, 0, sizeof(ps));
+		ps.tf.eip = (uint32_t) proc_check_spinner;
+		ps.tf.esp = (uint32_t) esp;
+		ps.pff = PFF_ICNT;
+		ps.imax = PROC_CHECK_IMAX;
+		sys_put(SYS_REGS | SYS_START, 0, &ps, NULL, NULL, 0);
+		sys_get(SYS_REGS, 0, &ps, NULL, NULL, 0);
+		assert(ps.tf.trapno == T_ICNT);
+		assert(ps.icnt == PROC_CHECK_IMAX);
+		eip[run] = ps.tf.eip;
+		count[run] = proc_check_count[0];
+	}
+	assert(eip[0] == eip[1] && count[0] == count[1]);
+	cprintf("proc_check: stopped after %d instructions (%s), "
+		"%d iterations\n", PROC_CHECK_IMAX,
+		perf_icnt ? "perfctr" : "single-step", count[0]);
+}
+
+// Run more long jobs than CPUs under one preemption policy,
+// returning how many cycles they all took.
+static uint64_t
+proc_check_preemption(const volatile sysinfo *si, proc_preempt_mode mode,
+			const char *name, uint64_t base)
+{
+	int nchild = MIN(2 * si->ncpu + 1, PROC_CHECK_NCHILD);
+	proc_preemption = mode;
+	uint32_t pre0 = proc_check_sum(si, preempts);
+	uint64_t t0 = rdtsc();
+	int n;
+	for (n = 0; n < nchild; n++)
+		proc_check_spawn(n, proc_check_longworker, 0);
+	for (n = 0; n < nchild; n++)
+		sys_get(0, n, NULL, NULL, NULL, 0);
+	uint64_t cycles = rdtsc() - t0;
+	uint32_t npre = proc_check_sum(si, preempts) - pre0;
+	proc_preemption = PROC_PREEMPT_AUTO;
+
+	int over = base ? (int64_t) (cycles - base) * 10000 / (int64_t) base : 0;
+	cprintf("proc_check: preempt %s: %d jobs %lld cycles, "
+		"%d preemptions, overhead %d.%02d%%\n", name, nchild,
+		cycles, npre, over / 100, (over < 0 ? -over : over) % 100);
+	return cycles;
+}
+
+// Run one child per CPU through barrier rounds while as many CPU hogs
+// compete with them, started as a gang if 'flags' is SYS_GANG or not,
+// returning the average cycles per round.
+static uint64_t
+proc_check_gang(const volatile sysinfo *si, uint32_t flags)
+{
+	int ncpu = si->ncpu;
+	int n;
+	proc_check_barn = ncpu;
+	proc_check_barcount = 0;
+	proc_check_barsense = 0;
+	for (n = 0; n < ncpu; n++)
+		proc_check_spawn(PROC_CHECK_HOG + n, proc_check_longworker, 0);
+	for (n = 0; n < ncpu; n++)
+		proc_check_spawn(n, proc_check_barrier, flags);
+
+	uint64_t cycles = 0;
+	for (n = 0; n < ncpu; n++) {
+		sys_get(0, n, NULL, NULL, NULL, 0);
+		cycles += proc_check_cycles[n];
+	}
+	for (n = 0; n < ncpu; n++)
+		sys_get(0, PROC_CHECK_HOG + n, NULL, NULL, NULL, 0);
+	return cycles / (ncpu * PROC_CHECK_ROUNDS);
+}
+
+// Runs in user mode, as part of the root process.
+void
+proc_check(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	int ncpu = si->ncpu;
+	int n, nchild;
+
+	// Context switch latency: keep a couple of children per CPU busy
+	// yielding to each other.  Check they get back what they left with.
+	nchild = MIN(2 * ncpu, PROC_CHECK_NCHILD);
+	uint32_t sw0 = proc_check_sum(si, switches);
+	for (n = 0; n < nchild; n++)
+		proc_check_spawn(n, proc_check_yielder, 0);
+	uint64_t cycles = 0;
+	for (n = 0; n < nchild; n++) {
+		procstate ps;
+		sys_get(SYS_REGS, n, &ps, NULL, NULL, 0);
+		assert(ps.tf.trapno == T_SYSCALL);
+		assert(ps.tf.esp > (uint32_t) &proc_check_stack[n][0]);
+		assert(ps.tf.esp < (uint32_t) &proc_check_stack[n][PAGESIZE]);
+		cycles += proc_check_cycles[n];
+	}
+	uint32_t nsw = proc_check_sum(si, switches) - sw0;
+	cprintf("proc_check: yield %d cycles avg, %d yields, %d switches\n",
+		(int) (cycles / (nchild * PROC_CHECK_YIELDS)),
+		nchild * PROC_CHECK_YIELDS, nsw);
+
+	// Load balance: make a batch of equal jobs ready on this CPU,
+	// and see how close to a perfect speedup the thieves get us.
+	uint64_t t0 = rdtsc();
+	proc_check_work();
+	uint64_t tjob = rdtsc() - t0;
+
+	nchild = MIN(4 * ncpu, PROC_CHECK_NCHILD);
+	uint32_t st0 = proc_check_sum(si, steals);
+	t0 = rdtsc();
+	for (n = 0; n < nchild; n++)
+		proc_check_spawn(n, proc_check_worker, 0);
+	for (n = 0; n < nchild; n++)
+		sys_get(0, n, NULL, NULL, NULL, 0);
+	uint64_t tall = rdtsc() - t0;
+	uint32_t nst = proc_check_sum(si, steals) - st0;
+	int speedup = tjob * nchild * 100 / tall;
+	cprintf("proc_check: %d jobs on %d CPUs: speedup %d.%02d "
+		"(ideal %d), %d steals\n", nchild, ncpu,
+		speedup / 100, speedup % 100, MIN(nchild, ncpu), nst);
+
+	// Instruction limits, and the cost of preemption by time slices
+	// versus instruction counts, compared to none at all.
+	proc_check_icnt();
+	uint64_t base = proc_check_preemption(si, PROC_PREEMPT_NONE, "none", 0);
+	proc_check_preemption(si, PROC_PREEMPT_TIME, "time", base);
+	if (perf_icnt)
+		proc_check_preemption(si, PROC_PREEMPT_ICNT, "icnt", base);
+
+	// Barrier latency among siblings competing with hogs for the CPUs,
+	// scheduled independently and then as a gang.
+	static_assert(PROC_CHECK_HOG + CPU_MAX <= PROC_CHECK_NCHILD);
+	uint32_t g0 = proc_check_sum(si, gangs);
+	uint64_t solo = proc_check_gang(si, 0);
+	uint64_t gang = proc_check_gang(si, SYS_GANG);
+	uint32_t ngang = proc_check_sum(si, gangs) - g0;
+	assert(ngang > 0);
+	cprintf("proc_check: barrier %lld cycles/round alone, "
+		"%lld as a gang, %d gang dispatches\n", solo, gang, ngang);
+
+	cprintf("proc_check() succeeded!\n");
+}
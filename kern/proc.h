@@ -0,0 +1,180 @@
+/*
+ * PIOS process management definitions.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_PROC_H
+#define PIOS_KERN_PROC_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+#include <inc/syscall.h>
+
+#include <kern/spinlock.h>
+#include <kern/pmap.h>
+#include <kern/cpu.h>
+#include <kern/elf.h>
+
+
+#define PROC_CHILDREN	256	// Max # of children a process can have
+
+// Time slices, counted in user-mode instructions where the processor's
+// performance counters let us (see kern/perf.h), so that preemption
+// doesn't depend on wall-clock time, or else in nanoseconds.
+#define PROC_QUANTUM_INSNS	10000000
+#define PROC_QUANTUM_NS		10000000	// 10ms
+
+// How many instructions the counter interrupt may arrive late by.
+// We count the last ones before a PFF_ICNT limit by single-stepping.
+#define PROC_ICNT_SKID	256
+
+// How to preempt processes that don't give up the CPU themselves.
+typedef enum proc_preempt_mode {
+	PROC_PREEMPT_AUTO = 0,	// Instruction counts if we can, else time
+	PROC_PREEMPT_NONE,	// Never preempt
+	PROC_PREEMPT_TIME,	// Time slices (nondeterministic)
+	PROC_PREEMPT_ICNT,	// Instruction count slices
+} proc_preempt_mode;
+
+typedef enum proc_state {
+	PROC_STOP	= 0,	// Passively waiting for parent to run it
+	PROC_READY,		// Scheduled to run but not running now
+	PROC_RUN,		// Running on some CPU
+	PROC_WAIT,		// Waiting to synchronize with a child
+	PROC_GANG,		// Ready, but waiting for its gang to run
+	PROC_BLOCK,		// Blocked on a futex (kern/futex.c)
+} proc_state;
+
+#define PROC_GANGMAX	32	// Max members per gang (CPU_MAX)
+
+// A gang: children a parent started together with SYS_START|SYS_GANG,
+// which we dispatch all at once, each on its own CPU, and preempt together,
+// so that members that synchronize with each other don't end up waiting
+// for siblings that aren't running.
+typedef struct procgang {
+	spinlock	lock;		// Protects all of the below
+	struct proc	*memb[PROC_GANGMAX];
+	int		n;		// Number of members
+	int		nrun;		// Members dispatched and still running
+	int		nwait;		// Members in PROC_GANG state
+	bool		queued;		// On the gang run queue
+	volatile bool	stop;		// Preempting the whole gang
+	struct procgang	*next;		// Next on the gang run queue
+} procgang;
+
+// Thread state and page directory of a process.
+// Each process occupies one page.
+typedef struct proc {
+
+	// Master spinlock protecting proc's state.
+	spinlock	lock;
+
+	// Process hierarchy information.
+	struct proc	*parent;
+	struct proc	*child[PROC_CHILDREN];
+
+	// Scheduling state of this process.
+	proc_state	state;		// current state
+	struct proc	*waiter;	// parent waiting for us to stop
+	struct proc	*rqnext;	// next on the run queue overflow list
+	struct cpu	*runcpu;	// cpu we're running on if running
+	procgang	*gang;		// gang we're a member of, if any
+	procgang	kids;		// gang of our own children
+	struct proc	*fnext;		// next waiter on our futex bucket
+	uint32_t	fkey;		// physical address of our futex
+
+	// Save area for user-mode register state when not running.
+	procstate	sv;
+
+	// I/O ports claimed for a user-level driver (kern/udev.c),
+	// in the TSS I/O permission bitmap's form: a clear bit grants a port.
+	uint8_t		iomap[CPU_IOPORTS/8];
+	uint32_t	iogen;		// Bumped per claim; 0 if none yet
+
+	// Virtual memory state for this process.
+	pde_t		*pdir;		// Working page directory
+	pde_t		*rpdir;		// Reference snapshot for SYS_MERGE
+	elfseg		elf[ELF_MAXSEG];	// Pages yet to load, if any
+} proc;
+
+#define proc_cur()	(cpu_cur()->proc)
+
+extern proc *proc_root;		// Root process, running user() in init.c
+
+// Current preemption policy: PROC_PREEMPT_AUTO unless changed,
+// which proc_check() does to compare the others.
+extern proc_preempt_mode proc_preemption;
+
+
+// Initialize the process scheduler, on the boot CPU.
+void proc_init(void);
+
+// Allocate a new, stopped child process of 'p', as child number 'cn',
+// or a parentless process if 'p' is NULL.  Returns NULL if out of memory.
+proc *proc_alloc(proc *p, uint32_t cn);
+
+// Put process 'p' on the current CPU's run queue,
+// from which this or any idle CPU may take it to run.
+void proc_ready(proc *p);
+
+// Save the register state of the current process 'p' from 'tf',
+// which it trapped with, and stop counting its instructions or time.
+// If 'entry' is 0, back up to re-execute the INT instruction of
+// a system call that couldn't complete yet; otherwise don't.
+void proc_save(proc *p, trapframe *tf, int entry);
+
+// Block the current process 'p', which has completed the system call
+// it trapped into with 'tf', until something calls proc_ready() on it.
+// Releases 'lk', which must protect whatever will find 'p' to wake it.
+void proc_block(proc *p, trapframe *tf, spinlock *lk) gcc_noreturn;
+
+// Block the current process 'p' until child 'cp' stops,
+// then restart the system call it was making.
+// Must be called holding cp->lock, which it releases.
+void proc_wait(proc *p, proc *cp, trapframe *tf) gcc_noreturn;
+
+// Run a ready process from this CPU's run queue, or stolen from
+// another CPU's if ours is empty.  Returns only if there is none.
+void proc_sched(void);
+
+// Switch to and run a specified process, which the caller has taken
+// off the run queues (or created) and so has to itself.
+void proc_run(proc *p) gcc_noreturn;
+
+// Yield the current CPU to another ready process, if there is one.
+void proc_yield(trapframe *tf) gcc_noreturn;
+
+// Make child 'cp' of the current process 'p' a member of p's gang, to be
+// dispatched along with the rest once p waits for any of its children.
+void proc_gang(proc *p, proc *cp);
+
+// Handle a T_IPI, which may ask us to run a gang member
+// or to stop the current one; returns if there's nothing to do.
+void proc_gangipi(trapframe *tf);
+
+// Put the current process back on the run queue so that the current
+// CPU's kernel worker can run the work an interrupt just queued
+// (kern/work.h).  Returns only if the process is a gang member.
+void proc_work(trapframe *tf);
+
+// Preempt the current process at the end of its time slice,
+// running the longest-waiting ready process on this CPU, if any, instead.
+void proc_preempt(trapframe *tf) gcc_noreturn;
+
+// Count an instruction the current process single-stepped (T_DEBUG),
+// stopping it with T_ICNT if it has reached its instruction limit.
+void proc_step(trapframe *tf) gcc_noreturn;
+
+// Stop the current process and return control to its parent.
+// 'entry' is as in proc_save(); -1 means a trap, not a system call.
+void proc_ret(trapframe *tf, int entry) gcc_noreturn;
+
+// Check the process scheduler from user mode, reporting context switch
+// latency and how well idle CPUs balance load by stealing work.
+void proc_check(void);
+
+#endif // !PIOS_KERN_PROC_H
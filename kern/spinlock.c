@@ -0,0 +1,71 @@
+/*
+ * Spin locks for multiprocessor mutual exclusion in the kernel.
+ *
+ * Copyright (c) 2010 Yale University.
+ * Copyright (c) 2006-2009 Frans Kaashoek, Robert Morris, Russ Cox,
+ *                         Massachusetts Institute of Technology
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ *
+ * Derived from xv6.
+ */
+
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/spinlock.h>
+
+
+void
+spinlock_init_(struct spinlock *lk, const char *file, int line)
+{
+	lk->locked = 0;
+	lk->file = file;
+	lk->line = line;
+	lk->cpu = NULL;
+}
+
+void
+spinlock_acquire(struct spinlock *lk)
+{
+	if (spinlock_holding(lk))
+		panic("spinlock_acquire: already holding lock %s:%d",
+			lk->file, lk->line);
+
+	// The xchg is atomic.
+	// It also serializes, so that reads after acquire are not
+	// reordered before it.
+	while (xchg(&lk->locked, 1) != 0)
+		while (lk->locked)
+			pause();
+
+	lk->cpu = cpu_cur();
+}
+
+void
+spinlock_release(struct spinlock *lk)
+{
+	if (!spinlock_holding(lk))
+		panic("spinlock_release: not holding lock %s:%d",
+			lk->file, lk->line);
+
+	lk->cpu = NULL;
+
+	// The xchg serializes, so that reads before release are
+	// not reordered after it.  The 1996 PentiumPro manual (Volume 3,
+	// 7.2) says reads can be carried out speculatively and in
+	// any order, which implies we need to serialize here.
+	// But the 2007 Intel 64 Architecture Memory Ordering White
+	// Paper says that Intel 64 and IA-32 will not move a load
+	// after a store. So lock->locked = 0 would work here.
+	// The xchg being asm volatile ensures gcc emits it after
+	// the above assignments (and after the critical section).
+	xchg(&lk->locked, 0);
+}
+
+int
+spinlock_holding(spinlock *lk)
+{
+	return lk->locked && lk->cpu == cpu_cur();
+}
+
@@ -0,0 +1,46 @@
+/*
+ * Spin locks for multiprocessor mutual exclusion in the kernel.
+ *
+ * Copyright (c) 2010 Yale University.
+ * Copyright (c) 2006-2009 Frans Kaashoek, Robert Morris, Russ Cox,
+ *                         Massachusetts Institute of Technology
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ *
+ * Derived from xv6.
+ */
+
+#ifndef PIOS_KERN_SPINLOCK_H
+#define PIOS_KERN_SPINLOCK_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+
+// Mutual exclusion lock.
+typedef struct spinlock {
+	volatile uint32_t locked;	// Is the lock held?
+
+	// For debugging:
+	const char	*file;		// Source file where spinlock_init() called
+	int		line;		// Line number of spinlock_init()
+	struct cpu	*cpu;		// The cpu holding the lock.
+} spinlock;
+
+// Initialize a lock, remembering where it was declared for debugging.
+#define spinlock_init(lk)	spinlock_init_(lk, __FILE__, __LINE__)
+void spinlock_init_(spinlock *lk, const char *file, int line);
+
+// Acquire the lock, spinning until it is free.
+// Kernel code runs with interrupts disabled (except in the idle loop),
+// so holding a spinlock never races with an interrupt on the same CPU.
+void spinlock_acquire(spinlock *lk);
+
+// Release the lock.
+void spinlock_release(spinlock *lk);
+
+// Check whether this cpu is holding the lock.
+int spinlock_holding(spinlock *lk);
+
+#endif /* PIOS_KERN_SPINLOCK_H */
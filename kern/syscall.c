@@ -0,0 +1,383 @@
+/*
+ * System call handling.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/x86.h>
+#include <inc/vm.h>
+#include <inc/mmu.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/trap.h>
+#include <inc/syscall.h>
+
+#include <kern/cpu.h>
+#include <kern/trap.h>
+#include <kern/proc.h>
+#include <kern/pmap.h>
+#include <kern/futex.h>
+#include <kern/cons.h>
+#include <kern/udev.h>
+#include <kern/elf.h>
+#include <kern/initrd.h>
+#include <kern/trace.h>
+#include <kern/sysinfo.h>
+#include <kern/init.h>
+#include <kern/syscall.h>
+
+
+// This bottom half of syscall() reflects a trap the user process caused,
+// by returning it to its parent to deal with.
+static void gcc_noreturn
+systrap(trapframe *utf, int trapno, int err)
+{
+	utf->trapno = trapno;
+	utf->err = err;
+	proc_ret(utf, 0);	// back up so the parent can restart the call
+}
+
+// Recover from a trap that occurs during a copyin or copyout,
+// by aborting the system call and reporting the trap to the parent.
+static void gcc_noreturn
+sysrecover(trapframe *ktf, void *recoverdata)
+{
+	cpu *c = cpu_cur();
+	trapframe *utf = (trapframe*)recoverdata;	// user trapframe
+	assert(c->recover == sysrecover);
+	c->recover = NULL;
+
+	systrap(utf, ktf->trapno, ktf->err);
+}
+
+// Check a user virtual address block for validity:
+// i.e., make sure the complete area specified lies below VM_USERHI.
+// Anything below that may be mapped in user mode (see inc/vm.h),
+// so the hardware will catch any remaining problems during usercopy().
+static void
+checkva(trapframe *utf, uint32_t uva, size_t size)
+{
+	if (uva >= VM_USERHI || size > VM_USERHI - uva)
+		systrap(utf, T_PGFLT, 0);
+}
+
+// Check that a region of per-process user space for a memory operation
+// lies within [VM_USERLO,VM_USERHI) and is aligned to 'align' bytes.
+static void
+checkmem(trapframe *utf, uint32_t uva, size_t size, uint32_t align)
+{
+	if (uva < VM_USERLO || uva >= VM_USERHI || size > VM_USERHI - uva ||
+			(uva | size) & (align - 1))
+		systrap(utf, T_GPFLT, 0);
+}
+
+// Abort a system call the kernel hasn't the memory to complete,
+// reporting it to the parent as a page fault, as pmap_pagefault() does
+// when it can't get a page: user code mustn't be able to panic us.
+static void gcc_noreturn
+sysnomem(trapframe *utf)
+{
+	systrap(utf, T_PGFLT, 0);
+}
+
+// Copy data to/from user space,
+// using the processor's own page protections to check permissions,
+// and reflecting any fault to the parent as in systrap().
+static void
+usercopy(trapframe *utf, bool copyout,
+			void *kva, uint32_t uva, size_t size)
+{
+	checkva(utf, uva, size);
+
+	cpu *c = cpu_cur();
+	c->recover = sysrecover;
+	c->recoverdata = utf;
+	if (copyout)
+		memmove((void*)uva, kva, size);
+	else
+		memmove(kva, (void*)uva, size);
+	c->recover = NULL;
+}
+
+static void
+do_cputs(trapframe *tf, uint32_t cmd)
+{
+	// Print the string supplied by the user: pointer in EBX
+	char buf[CPUTS_MAX+1];
+	uint32_t uva = tf->regs.ebx;
+	size_t size = CPUTS_MAX;
+	if (uva < VM_USERHI && VM_USERHI - uva < size)
+		size = VM_USERHI - uva;
+	usercopy(tf, 0, buf, uva, size);
+	buf[size] = 0;
+	cputs(buf);
+
+	trap_return(tf);	// syscall completed
+}
+
+static void
+do_getc(trapframe *tf, uint32_t cmd)
+{
+	// Return the next character of input in EAX, waiting for one.
+	int c;
+	while ((c = cons_getc()) == 0)
+		cons_wait(proc_cur(), tf);	// returns if some came meanwhile
+	tf->regs.eax = c;
+	trap_return(tf);	// syscall completed
+}
+
+// Find or create child 'cn' of the current process,
+// and wait for it to stop if it isn't already.
+static proc *
+getchild(trapframe *tf, proc *p, uint32_t cn)
+{
+	proc *cp = p->child[cn];
+	if (cp == NULL) {
+		cp = proc_alloc(p, cn);
+		if (cp == NULL)
+			sysnomem(tf);
+	}
+
+	spinlock_acquire(&cp->lock);
+	if (cp->state != PROC_STOP)
+		proc_wait(p, cp, tf);	// restarts the system call later
+	spinlock_release(&cp->lock);
+	return cp;
+}
+
+static void
+do_put(trapframe *tf, uint32_t cmd)
+{
+	proc *p = proc_cur();
+	proc *cp = getchild(tf, p, tf->regs.edx & 0xff);
+
+	// Put child's general register state
+	if (cmd & SYS_REGS) {
+		usercopy(tf, 0, &cp->sv, tf->regs.ebx, sizeof(procstate));
+
+		// Make sure the child can't escape to kernel mode.
+		cp->sv.tf.ds = CPU_GDT_UDATA | 3;
+		cp->sv.tf.es = CPU_GDT_UDATA | 3;
+		cp->sv.tf.fs = CPU_GDT_UDATA | 3;
+		cp->sv.tf.gs = (cp->sv.tls ? CPU_GDT_UDTLS : CPU_GDT_UDATA) | 3;
+		cp->sv.tf.cs = CPU_GDT_UCODE | 3;
+		cp->sv.tf.ss = CPU_GDT_UDATA | 3;
+		cp->sv.tf.eflags &= FL_USER;
+		cp->sv.tf.eflags |= FL_IF;
+		cp->sv.pff &= PFF_ICNT;
+	}
+
+	// Copy or zero the child's memory, or load a program into it
+	uint32_t sva = tf->regs.esi, dva = tf->regs.edi, size = tf->regs.ecx;
+	if (cmd & SYS_EXEC) {
+		if ((cmd & SYS_MEMOP) != SYS_NONE)
+			systrap(tf, T_GPFLT, 0);
+		bool ok;
+		if (size != 0)
+			ok = elf_load(cp, (void*) sva, size);
+		else {
+			char name[INITRD_NAMELEN];
+			usercopy(tf, 0, name, sva, sizeof(name));
+			name[INITRD_NAMELEN-1] = 0;
+			const initrd_file *f = initrd_lookup(name);
+			ok = f != NULL && elf_loadfile(cp, f);
+		}
+		if (!ok)
+			systrap(tf, T_GPFLT, 0);
+	}
+	switch (cmd & SYS_MEMOP) {
+	case SYS_NONE:
+		break;
+	case SYS_COPY:
+		checkmem(tf, sva, size, PTSIZE);
+		checkmem(tf, dva, size, PTSIZE);
+		if (!pmap_copy(p->pdir, sva, cp->pdir, dva, size))
+			sysnomem(tf);
+		elf_copysegs(p, sva, cp, dva, size);
+		break;
+	case SYS_ZERO:
+		checkmem(tf, dva, size, PTSIZE);
+		pmap_remove(cp->pdir, dva, size);
+		elf_copysegs(NULL, 0, cp, dva, size);
+		break;
+	default:
+		systrap(tf, T_GPFLT, 0);	// no SYS_MERGE on put
+	}
+
+	// Set the child's memory permissions
+	if (cmd & SYS_PERM) {
+		checkmem(tf, dva, size, PAGESIZE);
+		if (!pmap_setperm(cp->pdir, dva, size, cmd & SYS_RW))
+			sysnomem(tf);
+	}
+
+	// Snapshot the child's memory, to merge its changes against later
+	if (cmd & SYS_SNAP) {
+		if (cp->rpdir == NULL && (cp->rpdir = pmap_newpdir()) == NULL)
+			sysnomem(tf);
+		if (!pmap_copy(cp->pdir, VM_USERLO, cp->rpdir, VM_USERLO,
+				VM_USERHI-VM_USERLO))
+			sysnomem(tf);
+	}
+
+	// Start the child if requested
+	if (cmd & SYS_START) {
+		if (cmd & SYS_GANG)
+			proc_gang(p, cp);
+		else
+			proc_ready(cp);
+	}
+
+	trap_return(tf);	// syscall completed
+}
+
+static void
+do_get(trapframe *tf, uint32_t cmd)
+{
+	proc *p = proc_cur();
+	proc *cp = getchild(tf, p, tf->regs.edx & 0xff);
+
+	// Get child's general register state
+	if (cmd & SYS_REGS)
+		usercopy(tf, 1, &cp->sv, tf->regs.ebx, sizeof(procstate));
+
+	// Copy, merge, or zero our own memory
+	uint32_t sva = tf->regs.esi, dva = tf->regs.edi, size = tf->regs.ecx;
+	switch (cmd & SYS_MEMOP) {
+	case SYS_NONE:
+		break;
+	case SYS_COPY:
+		checkmem(tf, sva, size, PTSIZE);
+		checkmem(tf, dva, size, PTSIZE);
+		if (!pmap_copy(cp->pdir, sva, p->pdir, dva, size))
+			sysnomem(tf);
+		elf_copysegs(cp, sva, p, dva, size);
+		break;
+	case SYS_MERGE:
+		checkmem(tf, sva, size, PTSIZE);
+		checkmem(tf, dva, size, PTSIZE);
+		if (cp->rpdir == NULL)
+			systrap(tf, T_GPFLT, 0);	// never snapshotted
+		if (!pmap_merge(cp->rpdir, cp->pdir, sva, p->pdir, dva, size))
+			sysnomem(tf);
+		break;
+	case SYS_ZERO:
+		checkmem(tf, dva, size, PTSIZE);
+		pmap_remove(p->pdir, dva, size);
+		pmap_inval(p->pdir, dva, size);
+		elf_copysegs(NULL, 0, p, dva, size);
+		break;
+	}
+
+	// Set our own memory permissions
+	if (cmd & SYS_PERM) {
+		checkmem(tf, dva, size, PAGESIZE);
+		if (!pmap_setperm(p->pdir, dva, size, cmd & SYS_RW))
+			sysnomem(tf);
+	}
+
+	trap_return(tf);	// syscall completed
+}
+
+// Tell the user-level scheduler of process 'p' that it's about to block,
+// by bumping its upcall word and waking a process waiting on that.
+static void
+do_upcall(trapframe *tf, proc *p)
+{
+	uint32_t uva = p->sv.upcall;
+	if (uva & 3)
+		systrap(tf, T_GPFLT, 0);
+	checkva(tf, uva, sizeof(uint32_t));
+
+	cpu *c = cpu_cur();
+	c->recover = sysrecover;
+	c->recoverdata = tf;
+	xadd((volatile uint32_t*) uva, 1);
+	c->recover = NULL;
+	sysinfo_page->cpu[c->id].upcalls++;
+
+	futex_wake(futex_phys(p, uva), 1);
+}
+
+static void
+do_futex(trapframe *tf, uint32_t cmd)
+{
+	// Futex word address in EBX, which must be aligned.
+	uint32_t uva = tf->regs.ebx;
+	if (uva & 3)
+		systrap(tf, T_GPFLT, 0);
+
+	// Read the word, which also makes sure it's mapped,
+	// then find the physical address that identifies it.
+	proc *p = proc_cur();
+	uint32_t val;
+	usercopy(tf, 0, &val, uva, sizeof(val));
+	uint32_t pa = futex_phys(p, uva);
+
+	if (cmd & SYS_WAKE)
+		tf->regs.eax = futex_wake(pa, tf->regs.ecx);
+	else if (val == tf->regs.edx) {
+		if (p->sv.upcall != 0 && p->sv.upcall != uva)
+			do_upcall(tf, p);
+		futex_wait(p, tf, pa, tf->regs.edx);
+	}
+
+	trap_return(tf);	// syscall completed
+}
+
+static void
+do_dev(trapframe *tf, uint32_t cmd)
+{
+	cpu *c = cpu_cur();
+	proc *p = c->proc;
+	uint32_t size = tf->regs.ecx;
+
+	switch (cmd & SYS_DEVOP) {
+	case SYS_DEVPORT: {
+		uint32_t port = tf->regs.edx;
+		if (port >= CPU_IOPORTS || size > CPU_IOPORTS - port)
+			systrap(tf, T_GPFLT, 0);
+		tf->regs.eax = udev_claimports(p, port, size);
+		udev_switch(c, p);	// use them as soon as we return
+		break;
+		}
+	case SYS_DEVMMIO:
+		checkmem(tf, tf->regs.edi, size, PAGESIZE);
+		if (PGOFF(tf->regs.esi) != 0)
+			systrap(tf, T_GPFLT, 0);
+		tf->regs.eax = udev_claimmmio(p, tf->regs.esi, size,
+						tf->regs.edi);
+		break;
+	case SYS_DEVDMA:
+		checkmem(tf, tf->regs.edi, size, PAGESIZE);
+		tf->regs.eax = udev_allocdma(p, size, tf->regs.edi);
+		break;
+	default:
+		systrap(tf, T_GPFLT, 0);
+	}
+
+	trap_return(tf);	// syscall completed
+}
+
+// Common function to handle all system calls -
+// decode the system call type and call an appropriate handler function.
+// Be sure to handle undefined system calls appropriately.
+void
+syscall(trapframe *tf)
+{
+	// EAX register holds system call command/flags
+	uint32_t cmd = tf->regs.eax;
+	TRACE(syscall, cmd, tf->regs.ebx, tf->regs.ecx, tf->regs.edx);
+	switch (cmd & SYS_TYPE) {
+	case SYS_CPUTS:	return do_cputs(tf, cmd);
+	case SYS_PUT:	return do_put(tf, cmd);
+	case SYS_GET:	return do_get(tf, cmd);
+	case SYS_RET:	proc_ret(tf, 1);
+	case SYS_YIELD:	proc_yield(tf);
+	case SYS_FUTEX:	return do_futex(tf, cmd);
+	case SYS_DEV:	return do_dev(tf, cmd);
+	case SYS_GETC:	return do_getc(tf, cmd);
+	default:	return;		// handle as a regular trap
+	}
+}
@@ -0,0 +1,21 @@
+/*
+ * System call handling definitions.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_SYSCALL_H
+#define PIOS_KERN_SYSCALL_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/syscall.h>
+
+
+// Handle a system call from user mode (T_SYSCALL trap).
+// Returns only if the system call is unrecognized.
+void syscall(trapframe *tf);
+
+#endif /* !PIOS_KERN_SYSCALL_H */
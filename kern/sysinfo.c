@@ -0,0 +1,122 @@
+/*
+ * System information page shared with user code.
+ *
+ * The kernel writes clock parameters, CPU identities and statistics
+ * into a page at SYSINFO_ADDR (see inc/sysinfo.h) that user code reads
+ * directly, so that timestamping or sampling a counter from user space
+ * costs a few loads rather than a trap into the kernel.
+ * Fields that must be read consistently are protected by a seqlock:
+ * the writer holds sysinfo_lock and keeps the sequence number odd
+ * while it updates them, and readers retry if the number changed.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/clock.h>
+#include <kern/sysinfo.h>
+#include <kern/spinlock.h>
+
+
+static spinlock sysinfo_lock;	// Serializes seqlock writers
+
+static bool sysinfo_rdtscp;	// Processor supports RDTSCP
+
+
+void
+sysinfo_init(void)
+{
+	static_assert(SYSINFO_NCPU == CPU_MAX);
+	static_assert(sizeof(sysinfo) <= PAGESIZE);
+
+	if (cpu_onboot()) {
+		spinlock_init(&sysinfo_lock);
+		memset(sysinfo_page, 0, PAGESIZE);
+
+		cpuinfo inf;
+		cpuid(0x80000000, &inf);
+		if (inf.eax >= 0x80000001) {
+			cpuid(0x80000001, &inf);
+			sysinfo_rdtscp = (inf.edx & CPUID_EXT_EDX_RDTSCP) != 0;
+		}
+	}
+
+	// Have RDTSCP tell user code which CPU it read the TSC on.
+	if (sysinfo_rdtscp)
+		wrmsr(MSR_TSC_AUX, cpu_cur()->id);
+}
+
+void
+sysinfo_setclock(void)
+{
+	cpu *c = cpu_cur();
+	sysinfo *si = sysinfo_page;
+
+	spinlock_acquire(&sysinfo_lock);
+	si->seq++;
+	asm volatile("" : : : "memory");
+
+	si->cpu[c->id].tsc_base = c->tsc_base;
+	si->cpu[c->id].apicid = c->apicid;
+	if (c->id >= si->ncpu)
+		si->ncpu = c->id + 1;
+	si->clock_mult = clock_mult;
+	si->clock_shift = clock_shift;
+	si->tsc_hz = clock_tsc_hz;
+	if (sysinfo_rdtscp)
+		si->flags |= SYSINFO_RDTSCP;
+
+	asm volatile("" : : : "memory");
+	si->seq++;
+	spinlock_release(&sysinfo_lock);
+}
+
+
+#define SYSINFO_CHECKNS		1000000		// 1ms
+#define SYSINFO_CHECKREADS	1000
+
+// Runs in user mode, after trap_check_user(), so it can't use cpu_cur().
+void
+sysinfo_check_user(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	assert(si->ncpu >= 1 && si->tsc_hz > 0);
+	assert(si->mem_nfree > 0 && si->mem_nfree < si->mem_npage);
+	assert(si->mem_nalloc >= si->mem_nfreed);
+
+	// Both ways of finding out which CPU we're on should agree,
+	// unless we got moved in between, which nothing does to us here.
+	int cpu = -1;
+	uint64_t ns0 = sysinfo_clock(si, &cpu);
+	assert(cpu >= 0 && cpu < si->ncpu);
+	assert(sysinfo_cpuid(si) == cpu);
+	assert(si->cpu[cpu].traps > 0);
+
+	// The clock should advance at the same rate as the TSC.
+	uint64_t tsc0 = rdtsc();
+	uint64_t ns1;
+	while ((ns1 = sysinfo_clock(si, NULL)) < ns0 + SYSINFO_CHECKNS)
+		assert(ns1 >= ns0);
+	uint64_t tscns = (rdtsc() - tsc0) * CLOCK_HZ / si->tsc_hz;
+	uint64_t clkns = ns1 - ns0;
+	assert(tscns > clkns - clkns/100 && tscns < clkns + clkns/100 + 1000);
+
+	// How much does reading the clock cost?
+	int i;
+	tsc0 = rdtsc();
+	for (i = 0; i < SYSINFO_CHECKREADS; i++)
+		sysinfo_clock(si, NULL);
+	uint64_t cyc = (rdtsc() - tsc0) / SYSINFO_CHECKREADS;
+
+	cprintf("sysinfo: clock read %d cycles (%s), %d free pages\n",
+		(int) cyc, (si->flags & SYSINFO_RDTSCP) ? "rdtscp" : "cpuid",
+		si->mem_nfree);
+	cprintf("sysinfo_check_user() succeeded!\n");
+}
@@ -0,0 +1,43 @@
+/*
+ * Kernel side of the system information page shared with user code.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_SYSINFO_H
+#define PIOS_KERN_SYSINFO_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/sysinfo.h>
+
+#include <kern/mem.h>
+#include <kern/cpu.h>
+
+
+// User code can't write the page at SYSINFO_ADDR, and with CR0_WP set
+// neither can the kernel: pmap_init() maps the same physical page
+// writable, for the kernel only, at SYSINFO_KADDR (so mem_init reserves
+// physical page 3 too, as it's hidden by this mapping).
+#define SYSINFO_KADDR	0x3000
+
+// The kernel's writable view of the page, and of the current CPU's entry.
+// Per-CPU counters are only ever written by their own CPU,
+// so the kernel just increments them without locking.
+#define sysinfo_page	((sysinfo *) SYSINFO_KADDR)
+#define sysinfo_cur()	(&sysinfo_page->cpu[cpu_cur()->id])
+
+
+// Clear the page on the boot CPU, and set up RDTSCP on every CPU.
+void sysinfo_init(void);
+
+// Publish the current CPU's APIC ID and clock parameters,
+// once its clock is running.
+void sysinfo_setclock(void);
+
+// Check from user mode that the page gives correct results.
+void sysinfo_check_user(void);
+
+#endif /* !PIOS_KERN_SYSINFO_H */
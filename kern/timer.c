@@ -0,0 +1,473 @@
+/*
+ * Per-CPU one-shot kernel timers.
+ *
+ * Timer deadlines are in nanoseconds of clock_ns() time (kern/clock.c).
+ * There is no periodic clock tick: each CPU programs its local APIC timer
+ * in one-shot mode to interrupt only when its earliest timer is due
+ * (or not at all), so an idle CPU stays halted until it has work to do.
+ *
+ * Each CPU keeps its pending timers in a hierarchical timing wheel,
+ * so that setting and cancelling a timer take constant time
+ * no matter how many are pending.  The wheel advances in ticks of
+ * 2^TIMER_SHIFT ns.  Level 0 has a slot for each of the next TIMER_SLOTS
+ * ticks; each slot of level n covers a whole turn of level n-1.
+ * When the wheel reaches the start of a higher-level slot, that slot's
+ * timers are "cascaded" down into the finer levels below it.
+ * Timers in a level 0 slot all expire within the same tick,
+ * but still fire at their precise deadline rather than at tick granularity.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/clock.h>
+#include <kern/timer.h>
+#include <kern/spinlock.h>
+#include <kern/sysinfo.h>
+
+#include <dev/lapic.h>
+
+
+#define TIMER_SHIFT	16		// Wheel ticks are 2^16ns (~65us)
+#define TIMER_LEVELS	4		// Levels in the wheel
+#define TIMER_SLOTBITS	6
+#define TIMER_SLOTS	(1 << TIMER_SLOTBITS)	// Slots per level
+#define TIMER_SLOTMASK	(TIMER_SLOTS - 1)
+#define TIMER_SPAN	(1ULL << (TIMER_LEVELS * TIMER_SLOTBITS)) // In ticks
+
+#define TIMER_EXPIRING	TIMER_LEVELS	// Level of timers about to fire
+
+#define TIMER_NONE	(~0ULL)		// "No tick" or "no deadline"
+
+typedef struct timerwheel {
+	spinlock	lock;		// Protects all of the below
+	struct cpu	*cpu;		// CPU this wheel belongs to
+	uint64_t	base;		// Next tick to process
+	uint64_t	armed;		// Deadline the APIC timer is set for
+	uint64_t	map[TIMER_LEVELS];	// Bitmaps of nonempty slots
+	timer		*slot[TIMER_LEVELS][TIMER_SLOTS];
+} timerwheel;
+
+static timerwheel timer_wheel[CPU_MAX];
+
+#define TIMER_CHECKNS	5000000		// 5ms, for timer_check()
+
+
+void
+timer_init(void)
+{
+	cpu *c = cpu_cur();
+	timerwheel *w = &timer_wheel[c->id];
+
+	spinlock_init(&w->lock);
+	w->cpu = c;
+	w->base = clock_ns() >> TIMER_SHIFT;
+	w->armed = TIMER_NONE;
+}
+
+static void
+timer_link(timer **head, timer *t)
+{
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+static void
+timer_unlink(timer *t)
+{
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->next = NULL;
+	t->pprev = NULL;
+}
+
+// Put a timer into the wheel slot appropriate for its deadline.
+static void
+timer_enqueue(timerwheel *w, timer *t)
+{
+	assert(spinlock_holding(&w->lock));
+
+	// Overdue timers go in the current tick's slot.
+	// Those beyond the wheel's span wait in the last slot it reaches,
+	// and get re-filed from there when that slot cascades.
+	uint64_t tick = t->deadline >> TIMER_SHIFT;
+	if (tick < w->base)
+		tick = w->base;
+	if (tick - w->base >= TIMER_SPAN)
+		tick = w->base + TIMER_SPAN - 1;
+
+	int level = 0;
+	uint64_t delta = tick - w->base;
+	while (delta >= TIMER_SLOTS) {
+		delta >>= TIMER_SLOTBITS;
+		level++;
+	}
+	int slot = (tick >> (level * TIMER_SLOTBITS)) & TIMER_SLOTMASK;
+
+	timer_link(&w->slot[level][slot], t);
+	w->map[level] |= 1ULL << slot;
+	t->level = level;
+	t->slot = slot;
+	t->wheel = w;
+}
+
+// Take a timer off its wheel.
+static void
+timer_dequeue(timerwheel *w, timer *t)
+{
+	assert(spinlock_holding(&w->lock));
+	assert(t->wheel == w);
+
+	timer_unlink(t);
+	if (t->level != TIMER_EXPIRING && w->slot[t->level][t->slot] == NULL)
+		w->map[t->level] &= ~(1ULL << t->slot);
+	t->wheel = NULL;
+}
+
+// Index of the lowest set bit in a nonzero 64-bit word.
+static int
+timer_ffs(uint64_t x)
+{
+	uint32_t lo = x;
+	return lo ? __builtin_ctz(lo) : 32 + __builtin_ctz((uint32_t) (x >> 32));
+}
+
+// Find the next tick, starting with w->base, at which the wheel
+// has something to do: cascade a slot or expire timers.
+// Returns TIMER_NONE if there are no timers, and the level concerned in *lev.
+static uint64_t
+timer_nexttick(timerwheel *w, int *lev)
+{
+	uint64_t next = TIMER_NONE;
+	int level;
+	for (level = 0; level < TIMER_LEVELS; level++) {
+		uint64_t map = w->map[level];
+		if (map == 0)
+			continue;
+
+		// Rotate the bitmap so that bit 0 represents the current slot.
+		int shift = level * TIMER_SLOTBITS;
+		uint64_t period = w->base >> shift;
+		int cur = period & TIMER_SLOTMASK;
+		if (cur != 0)
+			map = (map >> cur) | (map << (TIMER_SLOTS - cur));
+
+		// The current slot of a higher level is due now if the wheel
+		// is just starting it; otherwise it was already cascaded,
+		// so any timers in it are a whole turn of that level away.
+		int d = timer_ffs(map);
+		bool starting = (w->base & ((1ULL << shift) - 1)) == 0;
+		if (d == 0 && level > 0 && !starting)
+			d = (map & ~1ULL) ? timer_ffs(map & ~1ULL) : TIMER_SLOTS;
+
+		uint64_t tick = (period + d) << shift;
+		if (tick < next) {
+			next = tick;
+			*lev = level;
+		}
+	}
+	return next;
+}
+
+// Re-file the timers in a higher-level slot the wheel is just starting.
+static void
+timer_cascade(timerwheel *w, int level)
+{
+	int slot = (w->base >> (level * TIMER_SLOTBITS)) & TIMER_SLOTMASK;
+	timer *t;
+	while ((t = w->slot[level][slot]) != NULL) {
+		timer_dequeue(w, t);
+		timer_enqueue(w, t);
+	}
+}
+
+// Move a timer about to fire onto a private list, from which it can
+// still be cancelled until we actually call it.
+static void
+timer_expiring(timerwheel *w, timer *t, timer **expiring)
+{
+	timer_unlink(t);
+	if (w->slot[t->level][t->slot] == NULL)
+		w->map[t->level] &= ~(1ULL << t->slot);
+	timer_link(expiring, t);
+	t->level = TIMER_EXPIRING;
+}
+
+// Program our local APIC timer for the next thing the wheel must do.
+static void
+timer_arm(timerwheel *w)
+{
+	assert(spinlock_holding(&w->lock));
+	assert(w->cpu == cpu_cur());
+
+	int level;
+	uint64_t tick = timer_nexttick(w, &level);
+	if (tick == TIMER_NONE) {
+		w->armed = TIMER_NONE;
+		lapic_timer_oneshot(0);
+		return;
+	}
+
+	// A level 0 slot holds a single tick's timers: find the earliest.
+	// Otherwise we just need to wake up in time to cascade.
+	uint64_t deadline = tick << TIMER_SHIFT;
+	if (level == 0) {
+		timer *t;
+		deadline = TIMER_NONE;
+		for (t = w->slot[0][tick & TIMER_SLOTMASK]; t; t = t->next)
+			if (t->deadline < deadline)
+				deadline = t->deadline;
+	}
+	w->armed = deadline;
+
+	// Deadlines too far out for the APIC timer just fire early and re-arm.
+	uint64_t now = clock_ns();
+	uint32_t count = deadline > now ? clock_ns2lapic(deadline - now) : 0;
+	lapic_timer_oneshot(count > 0 ? count : 1);
+}
+
+// Lock the wheel a timer is pending on, if any, and return it.
+static timerwheel *
+timer_lock(timer *t)
+{
+	while (1) {
+		timerwheel *w = t->wheel;
+		if (w == NULL)
+			return NULL;
+		spinlock_acquire(&w->lock);
+		if (t->wheel == w)
+			return w;
+		spinlock_release(&w->lock);	// migrated meanwhile; retry
+	}
+}
+
+void
+timer_set(timer *t, uint64_t deadline, void (*fn)(timer *t), void *arg)
+{
+	assert(!(read_eflags() & FL_IF));
+
+	timerwheel *w = timer_lock(t);
+	if (w != NULL) {
+		timer_dequeue(w, t);
+		spinlock_release(&w->lock);
+	}
+
+	t->deadline = deadline;
+	t->fn = fn;
+	t->arg = arg;
+
+	w = &timer_wheel[cpu_cur()->id];
+	spinlock_acquire(&w->lock);
+	timer_enqueue(w, t);
+	if (deadline < w->armed)	// new earliest deadline
+		timer_arm(w);
+	spinlock_release(&w->lock);
+}
+
+void
+timer_cancel(timer *t)
+{
+	timerwheel *w = timer_lock(t);
+	if (w == NULL)
+		return;
+	timer_dequeue(w, t);
+	spinlock_release(&w->lock);
+	// If t was the earliest, the APIC timer will just fire early.
+}
+
+// Advance the wheel to clock time 'now', calling all expired timers.
+static void
+timer_run(timerwheel *w, uint64_t now)
+{
+	cpu *c = cpu_cur();
+	uint64_t target = now >> TIMER_SHIFT;
+
+	spinlock_acquire(&w->lock);
+	while (1) {
+		// Skip straight over ticks with nothing to do.
+		int level;
+		uint64_t tick = timer_nexttick(w, &level);
+		if (tick > target) {
+			if (target > w->base)
+				w->base = target;
+			break;
+		}
+		w->base = tick;
+
+		// Cascade each higher level we're starting a new slot of.
+		for (level = 1; level < TIMER_LEVELS; level++) {
+			if (tick & ((1ULL << (level * TIMER_SLOTBITS)) - 1))
+				break;
+			timer_cascade(w, level);
+		}
+
+		// Collect this tick's expired timers: all of them for past
+		// ticks, but only the ones actually due in the current tick.
+		timer *expiring = NULL, *t, *tn;
+		for (t = w->slot[0][tick & TIMER_SLOTMASK]; t; t = tn) {
+			tn = t->next;
+			if (tick < target || t->deadline <= now)
+				timer_expiring(w, t, &expiring);
+		}
+		if (tick < target)
+			w->base = tick + 1;	// new timers for tick go in next
+
+		// Call them one by one without holding the lock,
+		// since they may well set or cancel timers themselves.
+		while ((t = expiring) != NULL) {
+			timer_dequeue(w, t);
+			spinlock_release(&w->lock);
+
+			// How long after its deadline did a halted CPU get here?
+			if (c->idle_woke) {
+				uint64_t lat = clock_ns() - t->deadline;
+				c->wake_timers++;
+				c->wake_lat_total += lat;
+				if (lat > c->wake_lat_max)
+					c->wake_lat_max = lat;
+				c->idle_woke = 0;
+			}
+
+			sysinfo_page->cpu[c->id].timers++;
+			t->fn(t);
+			spinlock_acquire(&w->lock);
+		}
+
+		if (tick == target)
+			break;
+	}
+	timer_arm(w);
+	spinlock_release(&w->lock);
+}
+
+void
+timer_intr(void)
+{
+	timer_run(&timer_wheel[cpu_cur()->id], clock_ns());
+}
+
+void
+timer_migrate(cpu *to)
+{
+	timerwheel *from = &timer_wheel[cpu_cur()->id];
+	timerwheel *w = &timer_wheel[to->id];
+	if (from == w || from->armed == TIMER_NONE)
+		return;
+
+	// Always lock the lower-numbered wheel first to avoid deadlock.
+	timerwheel *first = from < w ? from : w;
+	timerwheel *second = from < w ? w : from;
+	spinlock_acquire(&first->lock);
+	spinlock_acquire(&second->lock);
+
+	uint64_t earliest = TIMER_NONE;
+	int level, slot;
+	for (level = 0; level < TIMER_LEVELS; level++)
+		for (slot = 0; slot < TIMER_SLOTS; slot++) {
+			timer *t;
+			while ((t = from->slot[level][slot]) != NULL) {
+				timer_dequeue(from, t);
+				timer_enqueue(w, t);
+				if (t->deadline < earliest)
+					earliest = t->deadline;
+			}
+		}
+	from->armed = TIMER_NONE;
+	lapic_timer_oneshot(0);
+
+	// Make the other CPU re-arm its APIC timer if it now needs to fire
+	// sooner, by making it think the timer already went off.
+	bool kick = earliest < w->armed;
+	if (kick)
+		w->armed = earliest;
+
+	spinlock_release(&second->lock);
+	spinlock_release(&first->lock);
+
+	if (kick)
+		lapic_ipi(to->apicid, T_LTIMER);
+}
+
+
+static void
+timer_check_fn(timer *t)
+{
+	static int seq;
+
+	assert(clock_ns() >= t->deadline);	// never early
+	*(int *) t->arg = ++seq;
+}
+
+#define TIMER_CHECKN	1024
+
+static timer timer_check_timers[TIMER_CHECKN];
+static int timer_check_fired[TIMER_CHECKN];
+
+void
+timer_check(void)
+{
+	if (!lapic)
+		return;
+
+	// Set two timers out of order and a third that we cancel,
+	// then idle until both live ones have fired.
+	int seq1 = 0, seq2 = 0, seq3 = 0;
+	timer t1, t2, t3;
+	t1.wheel = t2.wheel = t3.wheel = NULL;
+	uint64_t now = clock_ns();
+	timer_set(&t2, now + 2*TIMER_CHECKNS, timer_check_fn, &seq2);
+	timer_set(&t1, now + TIMER_CHECKNS, timer_check_fn, &seq1);
+	timer_set(&t3, now + TIMER_CHECKNS/2, timer_check_fn, &seq3);
+	timer_cancel(&t3);
+	while (timer_pending(&t1) || timer_pending(&t2))
+		cpu_halt();
+	assert(seq1 == 1 && seq2 == 2 && seq3 == 0);
+	assert(clock_ns() >= now + 2*TIMER_CHECKNS);
+	assert(cpu_cur()->idle_halts > 0);
+
+	// Now load up the wheel with timers spread over every level,
+	// some well beyond its span, and time setting and cancelling them.
+	// Cancel the far-off ones and let the rest fire.
+	int i, ncancel = 0;
+	uint32_t seed = 1;
+	now = clock_ns();
+	uint64_t t0 = rdtsc();
+	for (i = 0; i < TIMER_CHECKN; i++) {
+		seed = seed * 1103515245 + 12345;
+		uint64_t delta = (i & 1) ? (seed >> 8) % (4*TIMER_CHECKNS)
+				: (uint64_t) (seed >> 8) << (i & 30);
+		timer_check_fired[i] = 0;
+		timer_set(&timer_check_timers[i], now + delta,
+			timer_check_fn, &timer_check_fired[i]);
+	}
+	uint64_t t1c = rdtsc();
+	for (i = 0; i < TIMER_CHECKN; i++)
+		if (timer_check_timers[i].deadline > now + 4*TIMER_CHECKNS) {
+			timer_cancel(&timer_check_timers[i]);
+			ncancel++;
+		}
+	uint64_t t2c = rdtsc();
+	for (i = 0; i < TIMER_CHECKN; i++)
+		while (timer_pending(&timer_check_timers[i]))
+			cpu_halt();
+	for (i = 0; i < TIMER_CHECKN; i++)
+		assert((timer_check_fired[i] != 0) ==
+			(timer_check_timers[i].deadline <= now + 4*TIMER_CHECKNS));
+	assert(timer_wheel[cpu_cur()->id].armed == TIMER_NONE);
+
+	cprintf("timer_check: set %d cycles, cancel %d cycles avg\n",
+		(int) ((t1c - t0) / TIMER_CHECKN),
+		(int) ((t2c - t1c) / (ncancel ? ncancel : 1)));
+	cpu_idlestats();
+	cprintf("timer_check() succeeded!\n");
+}
+
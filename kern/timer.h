@@ -0,0 +1,62 @@
+/*
+ * Per-CPU one-shot kernel timers.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_TIMER_H
+#define PIOS_KERN_TIMER_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct cpu;
+
+// A kernel timer, normally embedded in the structure it is a timeout for.
+// Timers are set on the current CPU's timer wheel,
+// but may expire on another CPU if this one hands them off when idle;
+// the expiry function must not care which CPU it runs on.
+typedef struct timer {
+	struct timer	*next;		// Next timer in the same wheel slot
+	struct timer	**pprev;	// Pointer to us in previous timer/slot
+	uint64_t	deadline;	// clock_ns() time at which it expires
+	void		(*fn)(struct timer *t);	// Called on expiry
+	void		*arg;		// For use by fn
+	struct timerwheel *volatile wheel; // Wheel we're pending on, or NULL
+	uint8_t		level;		// Wheel level and slot we're in
+	uint8_t		slot;
+} timer;
+
+// Is timer 't' currently set and not yet expired?
+static gcc_inline bool
+timer_pending(timer *t)
+{
+	return t->wheel != NULL;
+}
+
+
+// Set up the current CPU's timer wheel.
+void timer_init(void);
+
+// Arm timer 't' to call 'fn' at clock time 'deadline',
+// replacing any earlier setting of the same timer.
+// The timer starts out on the current CPU's timer wheel.
+// Must be zero-initialized, or at least have wheel == NULL, before first use.
+void timer_set(timer *t, uint64_t deadline, void (*fn)(timer *t), void *arg);
+
+// Cancel a pending timer, from any CPU; harmless if it already fired.
+void timer_cancel(timer *t);
+
+// Run expired timers and re-arm the local APIC timer (T_LTIMER handler).
+void timer_intr(void);
+
+// Move all of the current CPU's pending timers onto CPU 'to'.
+void timer_migrate(struct cpu *to);
+
+// Check for correct operation of timers and the idle loop.
+void timer_check(void);
+
+#endif /* !PIOS_KERN_TIMER_H */
@@ -0,0 +1,243 @@
+/*
+ * Binary event tracing: static tracepoints logged to per-CPU buffers.
+ *
+ * A tracepoint costs next to nothing while tracing is off.  While it's
+ * on, it writes a fixed-size record with the TSC, the CPU, the event
+ * and its arguments into the current CPU's buffer: no formatting,
+ * no locks, since only the CPU that owns a buffer writes it,
+ * always with interrupts off.  Each buffer is a ring of pages
+ * that keeps the latest TRACE_NREC records.
+ *
+ * trace_dump() sends the buffers out the serial port in the binary
+ * format of inc/trace.h, which misc/tracedump.c turns into text
+ * or Chrome's trace event JSON, naming events from kernel.sym.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/log.h>
+#include <kern/clock.h>
+#include <kern/trace.h>
+
+#include <dev/serial.h>
+
+
+#define TRACE_PERPAGE	(PAGESIZE / sizeof(tracerec))
+#define TRACE_NPAGES	16
+#define TRACE_NREC	(TRACE_PERPAGE * TRACE_NPAGES)
+
+typedef struct tracebuf {
+	tracerec	*page[TRACE_NPAGES];	// NULL until trace_start()
+	uint32_t	head;		// Records logged, ever
+} tracebuf;
+
+static tracebuf trace_bufs[CPU_MAX];
+
+volatile bool trace_on;
+
+tracepoint trace_trap = { "trap", 1 };
+tracepoint trace_syscall = { "syscall", 1 };
+tracepoint trace_procrun = { "procrun", 1 };
+tracepoint trace_halt = { "halt", 1 };
+tracepoint trace_wake = { "wake", 1 };
+
+static tracepoint *trace_points[] = {
+	&trace_trap, &trace_syscall, &trace_procrun, &trace_halt, &trace_wake,
+};
+#define TRACE_NPOINTS	(sizeof(trace_points) / sizeof(trace_points[0]))
+
+static bool trace_booted;		// Tracing since trace_init()
+
+
+void
+trace_log(tracepoint *tp, uint32_t a0, uint32_t a1, uint32_t a2, uint32_t a3)
+{
+	cpu *c = cpu_cur();
+	tracebuf *tb = &trace_bufs[c->id];
+	if (tb->page[0] == NULL)
+		return;			// CPU came along since trace_start()
+	uint32_t i = tb->head % TRACE_NREC;
+	tracerec *r = &tb->page[i / TRACE_PERPAGE][i % TRACE_PERPAGE];
+	r->tsc = rdtsc();
+	r->event = (uint32_t) tp;
+	r->cpu = c->id;
+	r->arg[0] = a0;
+	r->arg[1] = a1;
+	r->arg[2] = a2;
+	r->arg[3] = a3;
+	tb->head++;
+}
+
+void
+trace_init(void)
+{
+	if (!cpu_onboot())
+		return;
+#ifdef TRACE_BOOT
+	if (!trace_start())
+		warn("trace_init: no memory to trace in");
+	trace_booted = 1;
+#endif
+}
+
+bool
+trace_start(void)
+{
+	static_assert(sizeof(tracerec) == 32);
+	cpu *c;
+	int i;
+	for (c = &cpu_boot; c != NULL; c = c->next) {
+		tracebuf *tb = &trace_bufs[c->id];
+		for (i = 0; i < TRACE_NPAGES; i++) {
+			if (tb->page[i] != NULL)
+				continue;
+			pageinfo *pi = mem_alloc();
+			if (pi == NULL)
+				return 0;
+			mem_incref(pi);
+			tb->page[i] = mem_pi2ptr(pi);
+		}
+	}
+	trace_on = 1;
+	return 1;
+}
+
+void
+trace_stop(void)
+{
+	trace_on = 0;
+}
+
+bool
+trace_enable(const char *name, bool enabled)
+{
+	int i;
+	for (i = 0; i < TRACE_NPOINTS; i++)
+		if (strcmp(trace_points[i]->name, name) == 0) {
+			trace_points[i]->enabled = enabled;
+			return 1;
+		}
+	return 0;
+}
+
+// Send 'n' bytes out the serial port, adding them to the sum at 'sum'.
+static void
+trace_out(const void *p, size_t n, uint32_t *sum)
+{
+	const uint8_t *b = p;
+	while (n-- > 0) {
+		if (sum != NULL)
+			*sum = (*sum ^ *b) * TRACE_FNVPRIME;
+		serial_putc(*b++);
+	}
+}
+
+void
+trace_dump(void)
+{
+	trace_stop();
+	if (!serial_exists)
+		return;
+
+	cpu *c;
+	uint32_t nrec = 0;
+	for (c = &cpu_boot; c != NULL; c = c->next)
+		if (trace_bufs[c->id].page[0] != NULL)
+			nrec += MIN(trace_bufs[c->id].head, TRACE_NREC);
+
+	// Keep console output from getting in among the bytes.
+	log_hold();
+	tracehdr hdr = { TRACE_MAGIC, nrec, clock_tsc_hz };
+	trace_out(&hdr, sizeof(hdr), NULL);
+	uint32_t sum = TRACE_FNVBASIS;
+	for (c = &cpu_boot; c != NULL; c = c->next) {
+		tracebuf *tb = &trace_bufs[c->id];
+		if (tb->page[0] == NULL)
+			continue;
+		uint32_t i;
+		for (i = tb->head - MIN(tb->head, TRACE_NREC); i != tb->head;
+				i++) {
+			uint32_t j = i % TRACE_NREC;
+			tracerec r = tb->page[j / TRACE_PERPAGE]
+						[j % TRACE_PERPAGE];
+			r.tsc -= c->tsc_base;	// the same time base on every CPU
+			trace_out(&r, sizeof(r), &sum);
+		}
+	}
+	tracetail tail = { TRACE_ENDMAGIC, sum };
+	trace_out(&tail, sizeof(tail), NULL);
+	serial_flush();
+	log_release();
+
+	cprintf("trace_dump: %d records\n", nrec);
+}
+
+void
+trace_done(void)
+{
+	// A panic in user mode, as in user() or the checks it runs,
+	// can't do the port I/O it takes to dump the trace.
+	if (read_cs() & 3)
+		return;
+	if (trace_booted)
+		trace_dump();
+}
+
+
+#define TRACE_CHECKN	1000	// Events to time
+
+void
+trace_check(void)
+{
+	assert(cpu_onboot());
+	bool on = trace_on;
+	tracebuf *tb = &trace_bufs[cpu_cur()->id];
+
+	// Tracepoints cost almost nothing while tracing is off...
+	trace_stop();
+	uint32_t head = tb->head;
+	int i;
+	uint64_t t0 = rdtsc();
+	for (i = 0; i < TRACE_CHECKN; i++)
+		TRACE(wake, i, 0, 0, 0);
+	uint64_t t1 = rdtsc();
+	assert(tb->head == head);
+
+	// ... and not much more while it's on.
+	assert(trace_start());
+	uint64_t t2 = rdtsc();
+	for (i = 0; i < TRACE_CHECKN; i++)
+		TRACE(wake, i, 1, 2, 3);
+	uint64_t t3 = rdtsc();
+	assert(tb->head == head + TRACE_CHECKN);
+	tracerec *r = &tb->page[(head + 5) % TRACE_NREC / TRACE_PERPAGE]
+				[(head + 5) % TRACE_NREC % TRACE_PERPAGE];
+	assert(r->event == (uint32_t) &trace_wake && r->cpu == 0);
+	assert(r->arg[0] == 5 && r->arg[3] == 3);
+	assert(r->tsc >= t2 && r->tsc <= t3);
+
+	// Disabled tracepoints log nothing.
+	assert(trace_enable("wake", 0));
+	TRACE(wake, 0, 0, 0, 0);
+	assert(tb->head == head + TRACE_CHECKN);
+	assert(trace_enable("wake", 1));
+	assert(!trace_enable("no such tracepoint", 1));
+
+	// Throw away the test's records, unless we're tracing anyway.
+	if (!on) {
+		trace_stop();
+		tb->head = head;
+	}
+
+	cprintf("trace_check: %lld cycles per event, %lld while off\n",
+		(t3 - t2) / TRACE_CHECKN, (t1 - t0) / TRACE_CHECKN);
+	cprintf("trace_check() succeeded!\n");
+}
@@ -0,0 +1,72 @@
+/*
+ * Binary event tracing: static tracepoints logged to per-CPU buffers.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_TRACE_H
+#define PIOS_KERN_TRACE_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+#include <inc/trace.h>
+
+
+// A static tracepoint, defined in kern/trace.c as trace_<name>.
+typedef struct tracepoint {
+	const char	*name;
+	volatile bool	enabled;	// Log it while tracing is on
+} tracepoint;
+
+extern tracepoint trace_trap;		// trapno, eip, err, cs
+extern tracepoint trace_syscall;	// eax, ebx, ecx, edx
+extern tracepoint trace_procrun;	// proc, eip, esp, 0
+extern tracepoint trace_halt;		// 0, 0, 0, 0
+extern tracepoint trace_wake;		// 0, 0, 0, 0
+
+// Set while tracing is on (trace_start).
+extern volatile bool trace_on;
+
+// Log an event at tracepoint 'name' with up to TRACE_NARGS arguments,
+// if tracing is on and the tracepoint enabled.
+// When tracing is off, this costs a load and a branch.
+#define TRACE(name, a0, a1, a2, a3)					\
+	do {								\
+		if (trace_on && trace_##name.enabled)			\
+			trace_log(&trace_##name, (uint32_t) (a0),	\
+				(uint32_t) (a1), (uint32_t) (a2),	\
+				(uint32_t) (a3));			\
+	} while (0)
+
+void trace_log(tracepoint *tp, uint32_t a0, uint32_t a1, uint32_t a2,
+		uint32_t a3);
+
+
+// Called once mp_init() has found all the CPUs:
+// starts tracing if the kernel was built with TRACE=1 (kern/Makefrag).
+void trace_init(void);
+
+// Start or stop tracing.  trace_start() makes room for each CPU's buffer
+// the first time, and returns false if there isn't enough memory.
+// Each CPU's buffer keeps its TRACE_NREC latest records.
+bool trace_start(void);
+void trace_stop(void);
+
+// Enable or disable the tracepoint called 'name'.
+// Returns false if there is no such tracepoint.
+bool trace_enable(const char *name, bool enabled);
+
+// Stop tracing and dump all the CPUs' records to the serial port,
+// in the binary format of inc/trace.h.
+void trace_dump(void);
+
+// Called before the kernel halts: if tracing since boot, dump the trace.
+// Does nothing in user mode, which can't.
+void trace_done(void);
+
+void trace_check(void);
+
+#endif // !PIOS_KERN_TRACE_H
@@ -9,13 +9,29 @@
  */
 
 #include <inc/mmu.h>
+#include <inc/vm.h>
 #include <inc/x86.h>
 #include <inc/assert.h>
+#include <inc/string.h>
 
 #include <kern/cpu.h>
 #include <kern/trap.h>
 #include <kern/cons.h>
 #include <kern/init.h>
+#include <kern/timer.h>
+#include <kern/work.h>
+#include <kern/proc.h>
+#include <kern/pmap.h>
+#include <kern/elf.h>
+#include <kern/perf.h>
+#include <kern/syscall.h>
+#include <kern/sysinfo.h>
+#include <kern/trace.h>
+
+#include <dev/lapic.h>
+#include <dev/pic.h>
+#include <dev/serial.h>
+#include <dev/kbd.h>
 
 
 // Interrupt descriptor table.  Must be built at run time because
@@ -43,6 +59,18 @@ trap_init_idt(void)
     for (i = 16; i < 20; i++)
         SETGATE(idt[i], 1, CPU_GDT_KCODE, vectors[i], 3);
     SETGATE(idt[30], 1, CPU_GDT_KCODE, vectors[30], 3);
+
+	// Hardware interrupts use interrupt gates, so that they arrive
+	// with interrupts disabled, and can't be raised from user mode.
+    for (i = T_IRQ0; i < T_IRQ0 + 16; i++)
+        SETGATE(idt[i], 0, CPU_GDT_KCODE, vectors[i], 0);
+    SETGATE(idt[T_LTIMER], 0, CPU_GDT_KCODE, vectors[T_LTIMER], 0);
+    SETGATE(idt[T_LERROR], 0, CPU_GDT_KCODE, vectors[T_LERROR], 0);
+    SETGATE(idt[T_IPI], 0, CPU_GDT_KCODE, vectors[T_IPI], 0);
+    SETGATE(idt[T_PERFCTR], 0, CPU_GDT_KCODE, vectors[T_PERFCTR], 0);
+
+	// System calls are made from user mode with INT T_SYSCALL.
+    SETGATE(idt[T_SYSCALL], 0, CPU_GDT_KCODE, vectors[T_SYSCALL], 3);
 	
     cprintf("trap_init succeed!\n");
 	//panic("trap_init() not implemented.");
@@ -123,6 +151,128 @@ trap_print(trapframe *tf)
 	cprintf("  ss   0x----%04x\n", tf->ss);
 }
 
+// Handle a hardware or inter-processor interrupt,
+// returning only if it isn't one we know about.
+// Time in the handler proper counts as irq_cycles,
+// apart from the DPCs it defers (kern/work.h).
+static void
+trap_intr(trapframe *tf)
+{
+	cpu *c = cpu_cur();
+	sysinfo_cpu *sc = &sysinfo_page->cpu[c->id];
+	uint64_t t0 = rdtsc();
+
+	switch (tf->trapno) {
+	case T_LTIMER:
+		sc->intrs++;
+		lapic_eoi();
+		timer_intr();
+		break;
+	case T_PERFCTR:
+		sc->intrs++;
+		perf_intr();
+		break;
+	case T_LERROR:
+		lapic_errintr();
+		break;
+	case T_IPI:
+		// Another CPU kicked us out of the idle loop (cpu_kick),
+		// or wants us to run or stop a gang member (cpu_poke).
+		lapic_eoi();
+		break;
+	case T_IRQ0 + IRQ_SERIAL:
+		sc->intrs++;
+		serial_intr();
+		pic_eoi(IRQ_SERIAL);
+		break;
+	case T_IRQ0 + IRQ_KBD:
+		sc->intrs++;
+		kbd_intr();
+		pic_eoi(IRQ_KBD);
+		break;
+	case T_IRQ0 + IRQ_SPURIOUS:
+		// Spurious interrupts from the PIC or local APIC need no EOI.
+		break;
+	default:
+		return;
+	}
+	sc->irq_cycles += rdtsc() - t0;
+	dpc_run();
+
+	if (!(tf->cs & 3) || c->proc == NULL)
+		trap_return(tf);	// interrupted the kernel
+	if (work_pending(c))
+		proc_work(tf);		// the kernel worker goes first
+
+	switch (tf->trapno) {
+	case T_LTIMER:
+		if (c->preempt)
+			proc_preempt(tf);	// time slice is up
+		break;
+	case T_PERFCTR:
+		proc_preempt(tf);	// instruction count ran out
+		break;			// not reached
+	case T_IPI:
+		proc_gangipi(tf);
+		break;
+	}
+	trap_return(tf);
+}
+
+// The kernel couldn't push a utrapframe onto the exception stack,
+// so give the original trap to the parent after all.
+static void gcc_noreturn
+trap_upcallfail(trapframe *ktf, void *recoverdata)
+{
+	cpu *c = cpu_cur();
+	c->recover = NULL;
+	proc_ret((trapframe*) recoverdata, -1);
+}
+
+// Reflect a trap from user mode to the current process's own handler,
+// if it has one, on its exception stack.  Returns if it can't.
+static void
+trap_upcall(trapframe *tf)
+{
+	cpu *c = cpu_cur();
+	proc *p = c->proc;
+	uint32_t xesp = p->sv.xesp;
+	if (p->sv.xeip == 0)
+		return;
+
+	// A trap in the handler itself nests below the handler's frame,
+	// leaving room for utrap_resume() to use on the way back.
+	uint32_t esp = xesp;
+	if (tf->esp <= xesp && tf->esp > xesp - PAGESIZE)
+		esp = tf->esp - 4;
+	esp = (esp - sizeof(utrapframe)) & ~3;
+	uint32_t utfva = esp;
+	esp -= 8;		// handler's argument and fake return address
+	if (esp < xesp - PAGESIZE || xesp > VM_USERHI)
+		return;		// exception stack overflow
+
+	utrapframe utf;
+	utf.trapno = tf->trapno;
+	utf.err = tf->err;
+	utf.fva = tf->trapno == T_PGFLT ? rcr2() : 0;
+	utf.regs = tf->regs;
+	utf.eip = tf->eip;
+	utf.eflags = tf->eflags;
+	utf.esp = tf->esp;
+	uint32_t frame[2] = { 0, utfva };
+
+	c->recover = trap_upcallfail;
+	c->recoverdata = tf;
+	memmove((void*) utfva, &utf, sizeof(utf));
+	memmove((void*) esp, frame, sizeof(frame));
+	c->recover = NULL;
+
+	sysinfo_page->cpu[c->id].utraps++;
+	tf->esp = esp;
+	tf->eip = p->sv.xeip;
+	trap_return(tf);
+}
+
 void gcc_noreturn
 trap(trapframe *tf)
 {
@@ -130,11 +280,48 @@ trap(trapframe *tf)
 	// and some versions of GCC rely on DF being clear.
 	asm volatile("cld" ::: "cc");
 
-	// If this trap was anticipated, just use the designated handler.
 	cpu *c = cpu_cur();
-	if (c->recover)
+	sysinfo_cpu *sc = &sysinfo_page->cpu[c->id];
+	sc->traps++;
+	TRACE(trap, tf->trapno, tf->eip, tf->err, tf->cs);
+
+	// Copy-on-write faults, even in usercopy(), just need a page copied,
+	// and faults on executables' pages not yet loaded, a page loaded.
+	if (tf->trapno == T_PGFLT) {
+		pmap_pagefault(tf);
+		elf_pagefault(tf);
+	}
+
+	// If this trap was anticipated, just use the designated handler.
+	if (c->recover && tf->trapno < T_IRQ0)
 		c->recover(tf, c->recoverdata);
 
+	// If we were halted in the idle loop, we aren't anymore.
+	cpu_wake(c);
+
+	if (tf->trapno >= T_IRQ0)
+		trap_intr(tf);
+
+	switch (tf->trapno) {
+	case T_SYSCALL:
+		sc->syscalls++;
+		if ((tf->eflags & FL_TF) && c->proc)
+			c->proc->sv.icnt++;	// single-stepped over the INT
+		syscall(tf);
+		break;			// unrecognized system call
+	case T_DEBUG:
+		if ((tf->cs & 3) && (tf->eflags & FL_TF) && c->proc)
+			proc_step(tf);	// counting instructions
+		break;
+	}
+
+	// A trap from user mode that the kernel doesn't handle itself
+	// goes to the process's own handler, if any, or else to its parent.
+	if ((tf->cs & 3) && c->proc) {
+		trap_upcall(tf);
+		proc_ret(tf, -1);
+	}
+
 	trap_print(tf);
 	panic("unhandled trap");
 }
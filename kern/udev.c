@@ -0,0 +1,314 @@
+/*
+ * Device resources claimed by user-level polled device drivers.
+ *
+ * A user-level driver busy-polls its device directly, with no system calls
+ * or interrupts on its fast path.  It first claims what it needs:
+ *
+ * - I/O ports, which the TSS I/O permission bitmap then grants it
+ *   whenever it runs (see cpu.iomap), so that its IN and OUT
+ *   instructions go straight to the device.  Processes other than
+ *   the root run with IOPL 0, so they can use only the ports they claim.
+ * - Memory-mapped I/O pages, which we map uncached where it asks.
+ * - A DMA buffer: physically contiguous memory from a pool we set aside
+ *   in the kernel image, mapped where the driver asks, whose physical
+ *   address the driver programs into the device.  The pages stay pinned:
+ *   we never copy them on write, merge them, or hand them to a child,
+ *   so the device and the driver always see the same memory.
+ *
+ * Claims are exclusive, since two drivers can't share one device,
+ * and last as long as the process does, since PIOS never frees processes.
+ * Nobody can claim the devices the kernel drives itself.
+ *
+ * The bitmap covers only ports below CPU_IOPORTS, which takes in
+ * the legacy ISA devices; a full 64K-port bitmap wouldn't fit
+ * in the cpu structure's page.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/vm.h>
+#include <inc/syscall.h>
+#include <inc/sysinfo.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/mp.h>
+#include <kern/proc.h>
+#include <kern/pmap.h>
+#include <kern/udev.h>
+
+#include <dev/pic.h>
+#include <dev/pit.h>
+#include <dev/kbd.h>
+#include <dev/nvram.h>
+#include <dev/serial.h>
+#include <dev/video.h>
+#include <dev/debugcon.h>
+#include <dev/lapic.h>
+
+
+#define UDEV_KERNEL	((proc*) -1)	// Owner of the kernel's own ports
+
+// I/O ports the kernel's drivers use.
+static const struct {
+	uint16_t	port;
+	uint16_t	n;
+} udev_kports[] = {
+	{ IO_PIC1, 2 }, { IO_PIC2, 2 },		// dev/pic.c
+	{ IO_PIT, 4 }, { IO_PITGATE, 1 },	// dev/pit.c
+	{ KBDATAP, 1 }, { KBSTATP, 1 },		// dev/kbd.c
+	{ IO_RTC, 2 },				// dev/nvram.c
+	{ COM1, 8 }, { 0x84, 1 },		// dev/serial.c, with delay()
+	{ MONO_BASE, 2 }, { CGA_BASE, 2 },	// dev/video.c
+	{ IO_DEBUGCON, 1 },			// dev/debugcon.c
+};
+
+typedef struct udev_mmio {
+	uint32_t	pa;		// Physical address
+	uint32_t	size;		// Size in bytes, or 0 if slot is free
+	proc		*owner;		// Process that claimed it
+} udev_mmio;
+
+static spinlock udev_lock;		// Protects all of the below
+static proc *udev_port[CPU_IOPORTS];	// Owner of each I/O port, if any
+static udev_mmio udev_mmios[UDEV_MAXMMIO];
+static uint32_t udev_dmanext;		// Bytes of udev_dmapool handed out
+
+// Physically contiguous, since the kernel image is, and never freed.
+static uint8_t udev_dmapool[UDEV_DMASIZE] gcc_aligned(PAGESIZE);
+
+
+void
+udev_init(void)
+{
+	if (!cpu_onboot())
+		return;
+
+	spinlock_init(&udev_lock);
+	int i, j;
+	for (i = 0; i < sizeof(udev_kports) / sizeof(udev_kports[0]); i++)
+		for (j = 0; j < udev_kports[i].n; j++)
+			udev_port[udev_kports[i].port + j] = UDEV_KERNEL;
+}
+
+bool
+udev_claimports(proc *p, uint32_t port, uint32_t n)
+{
+	assert(port <= CPU_IOPORTS && n <= CPU_IOPORTS - port);
+
+	spinlock_acquire(&udev_lock);
+	uint32_t i;
+	for (i = port; i < port + n; i++)
+		if (udev_port[i] != NULL && udev_port[i] != p) {
+			spinlock_release(&udev_lock);
+			return 0;
+		}
+	for (i = port; i < port + n; i++) {
+		udev_port[i] = p;
+		p->iomap[i / 8] &= ~(1 << (i % 8));
+	}
+	p->iogen++;		// CPUs that had our old ports must reload
+	spinlock_release(&udev_lock);
+	return 1;
+}
+
+bool
+udev_claimmmio(proc *p, uint32_t pa, size_t size, uint32_t va)
+{
+	// Only device memory, which no process's pages can be,
+	// and not the local APIC, which the kernel uses.
+	if (pa < mem_max || size > 0 - pa)
+		return 0;
+	uint32_t lapicpa = (uint32_t) lapic;
+	if (lapic != NULL && pa < lapicpa + PAGESIZE && lapicpa < pa + size)
+		return 0;
+
+	spinlock_acquire(&udev_lock);
+	udev_mmio *slot = NULL;
+	int i;
+	for (i = 0; i < UDEV_MAXMMIO; i++) {
+		udev_mmio *m = &udev_mmios[i];
+		if (m->size == 0) {
+			if (slot == NULL)
+				slot = m;
+		} else if (pa < m->pa + m->size && m->pa < pa + size &&
+				m->owner != p) {
+			spinlock_release(&udev_lock);
+			return 0;	// someone else's device
+		}
+	}
+	if (slot == NULL) {
+		spinlock_release(&udev_lock);
+		return 0;
+	}
+	slot->pa = pa;
+	slot->size = size;
+	slot->owner = p;
+	spinlock_release(&udev_lock);
+
+	return pmap_mapdev(p->pdir, va, pa, size, PTE_PCD | PTE_PWT);
+}
+
+uint32_t
+udev_allocdma(proc *p, size_t size, uint32_t va)
+{
+	spinlock_acquire(&udev_lock);
+	if (size == 0 || size > UDEV_DMASIZE - udev_dmanext) {
+		spinlock_release(&udev_lock);
+		return 0;
+	}
+	uint32_t pa = mem_phys(udev_dmapool + udev_dmanext);
+	udev_dmanext += size;
+	spinlock_release(&udev_lock);
+
+	if (!pmap_mapdev(p->pdir, va, pa, size, 0))
+		return 0;	// the pool space stays used up
+	return pa;
+}
+
+void
+udev_loadports(cpu *c, proc *p)
+{
+	if (p != NULL) {
+		memmove(c->iomap, p->iomap, sizeof(p->iomap));
+		c->iogen = p->iogen;
+	} else
+		memset(c->iomap, 0xff, CPU_IOPORTS/8);
+	c->ioproc = p;
+}
+
+
+#define UDEV_CHECKBYTES	PAGESIZE	// Bytes to loop back through COM2
+#define UDEV_CHECKDMA	(2*PAGESIZE)	// Size of the driver's DMA buffer
+#define UDEV_CHECKVA	VM_USERLO	// Where the driver maps its buffer
+#define UDEV_CHECKMMIO	(VM_USERLO + UDEV_CHECKDMA)	// ...and the I/O APIC
+
+static char udev_checkstack[PAGESIZE] gcc_aligned(PAGESIZE);
+static struct {
+	uint32_t	dmapa;		// Physical address of the DMA buffer
+	bool		com2;		// COM2 is there to loop bytes through
+	uint32_t	syscalls;	// System calls during the polling loop
+	uint64_t	cycles;		// Time the polling loop took
+	uint32_t	ioapicver;	// I/O APIC version register, if mapped
+} udev_checkst;
+
+static uint32_t
+udev_checksyscalls(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	uint32_t n = 0;
+	int i;
+	for (i = 0; i < si->ncpu; i++)
+		n += si->cpu[i].syscalls;
+	return n;
+}
+
+// The driver, running as a child of the root process.
+static void
+udev_check_driver(void)
+{
+	// The kernel's ports, and ports beyond the bitmap, are off limits.
+	assert(!sys_devport(COM1, 8));
+	assert(!sys_devport(IO_DEBUGCON, 1));
+	assert(sys_devport(COM2, 8));
+	assert(sys_devport(COM2 + COM_LSR, 1));	// claiming again is fine
+
+	// A DMA buffer: fill the first page, to loop through the device
+	// into the second page, while the device would see them at 'pa'.
+	uint32_t pa = sys_devdma((void*) UDEV_CHECKVA, UDEV_CHECKDMA);
+	assert(pa != 0 && PGOFF(pa) == 0);
+	uint8_t *buf = (uint8_t*) UDEV_CHECKVA;
+	int i;
+	for (i = 0; i < UDEV_CHECKBYTES; i++)
+		buf[i] = i * 7;
+	udev_checkst.dmapa = pa;
+
+	// Read the I/O APIC's version register through an uncached mapping,
+	// if there is one; the kernel leaves it alone.
+	if (mp_ioapicaddr != 0 &&
+			sys_devmmio(mp_ioapicaddr, (void*) UDEV_CHECKMMIO,
+					PAGESIZE)) {
+		volatile uint32_t *ioapic = (uint32_t*) UDEV_CHECKMMIO;
+		ioapic[0] = 1;			// IOREGSEL: version register
+		udev_checkst.ioapicver = ioapic[4];	// IOWIN
+	}
+
+	// Busy-poll the UART in loopback mode, byte by byte,
+	// as a polled driver would, with no help from the kernel.
+	outb(COM2 + COM_SCR, 0x5a);
+	udev_checkst.com2 = inb(COM2 + COM_SCR) == 0x5a;
+	if (udev_checkst.com2) {
+		outb(COM2 + COM_IER, 0);
+		outb(COM2 + COM_FCR, 0);
+		outb(COM2 + COM_LCR, COM_LCR_WLEN8);
+		outb(COM2 + COM_MCR, COM_MCR_LOOP);
+		while (inb(COM2 + COM_LSR) & COM_LSR_DATA)
+			inb(COM2 + COM_RX);	// drain stale input
+
+		uint32_t sc0 = udev_checksyscalls();
+		uint64_t t0 = rdtsc();
+		for (i = 0; i < UDEV_CHECKBYTES; i++) {
+			while (!(inb(COM2 + COM_LSR) & COM_LSR_TXRDY))
+				pause();
+			outb(COM2 + COM_TX, buf[i]);
+			while (!(inb(COM2 + COM_LSR) & COM_LSR_DATA))
+				pause();
+			buf[PAGESIZE + i] = inb(COM2 + COM_RX);
+		}
+		udev_checkst.cycles = rdtsc() - t0;
+		udev_checkst.syscalls = udev_checksyscalls() - sc0;
+		outb(COM2 + COM_MCR, 0);
+		assert(memcmp(buf, buf + PAGESIZE, UDEV_CHECKBYTES) == 0);
+	}
+
+	// A port we never claimed, and the kernel's besides: this must fault.
+	inb(COM1 + COM_LSR);
+	panic("udev_check_driver: used a port it didn't claim");
+}
+
+// Runs in user mode, as part of the root process.
+void
+udev_check_user(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	memset(&udev_checkst, 0, sizeof(udev_checkst));
+
+	procstate ps;
+	memset(&ps, 0, sizeof(ps));
+	ps.tf.eip = (uint32_t) udev_check_driver;
+	ps.tf.esp = (uint32_t) &udev_checkstack[PAGESIZE];
+	sys_put(SYS_REGS | SYS_START, 0, &ps, NULL, NULL, 0);
+	sys_get(SYS_REGS, 0, &ps, NULL, NULL, 0);
+	assert(ps.tf.trapno == T_GPFLT);
+
+	// What the driver claimed is its own.
+	assert(!sys_devport(COM2, 1));
+	if (udev_checkst.ioapicver != 0)
+		assert(!sys_devmmio(mp_ioapicaddr, (void*) UDEV_CHECKMMIO,
+					PAGESIZE));
+
+	// The device would see the driver's data at the buffer's
+	// physical address, which is in the kernel image, mapped here too.
+	const uint8_t *dma = mem_ptr(udev_checkst.dmapa);
+	int i;
+	for (i = 0; i < UDEV_CHECKBYTES; i++)
+		assert(dma[i] == (uint8_t) (i * 7));
+
+	if (udev_checkst.com2) {
+		assert(udev_checkst.syscalls == 0);
+		cprintf("udev_check: %d bytes looped back through COM2, "
+			"%lldns per byte, no system calls\n", UDEV_CHECKBYTES,
+			udev_checkst.cycles * 1000000000ULL /
+				(si->tsc_hz * UDEV_CHECKBYTES));
+	} else
+		cprintf("udev_check: no COM2 to drive\n");
+	if (udev_checkst.ioapicver != 0)
+		cprintf("udev_check: I/O APIC version %x\n",
+			udev_checkst.ioapicver);
+	cprintf("udev_check_user() succeeded!\n");
+}
@@ -0,0 +1,57 @@
+/*
+ * Device resources claimed by user-level polled device drivers.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_UDEV_H
+#define PIOS_KERN_UDEV_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+#include <kern/cpu.h>
+#include <kern/proc.h>
+
+
+#define UDEV_MAXMMIO	16		// Max MMIO regions claimed at once
+#define UDEV_DMASIZE	(256*PAGESIZE)	// Pool for DMA buffers: 1MB
+
+
+// Set aside the I/O ports the kernel's own drivers use, on the boot CPU.
+void udev_init(void);
+
+// Claim I/O ports [port,port+n) for process 'p'.
+// Returns false if another process or the kernel already has one.
+bool udev_claimports(proc *p, uint32_t port, uint32_t n);
+
+// Claim the device memory [pa,pa+size) for process 'p',
+// and map it uncached at 'va' in its address space.
+// Returns false if it isn't device memory, someone else has it,
+// or we ran out of memory mapping it.
+bool udev_claimmmio(proc *p, uint32_t pa, size_t size, uint32_t va);
+
+// Allocate a pinned, physically contiguous DMA buffer for process 'p'
+// and map it at 'va'.  Returns its physical address, or 0 if out of room.
+uint32_t udev_allocdma(proc *p, size_t size, uint32_t va);
+
+// Load process 'p's I/O ports into CPU 'c's I/O permission bitmap.
+void udev_loadports(cpu *c, proc *p);
+
+// Grant the process about to run on CPU 'c' its I/O ports, if any,
+// reloading the bitmap only if it last held some other process's ports.
+static gcc_inline void
+udev_switch(cpu *c, proc *p)
+{
+	proc *io = p->iogen ? p : NULL;
+	if (c->ioproc != io || (io != NULL && c->iogen != io->iogen))
+		udev_loadports(c, io);
+}
+
+// Check a user-level driver's claims and its polling loop, from user mode.
+void udev_check_user(void);
+
+#endif /* !PIOS_KERN_UDEV_H */
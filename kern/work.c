@@ -0,0 +1,229 @@
+/*
+ * Deferred kernel work: per-CPU work queues and deferred procedure calls.
+ *
+ * Interrupt handlers should do only what can't wait, with interrupts off,
+ * and defer the rest in one of two ways, both per-CPU and lock-free,
+ * since only the CPU that owns a queue ever touches it:
+ *
+ * - A deferred procedure call (DPC) runs as soon as the handler that
+ *   queued it is done, on the way out of trap(), still with interrupts
+ *   disabled but after the interrupt has been acknowledged.
+ * - A work queue item runs in the CPU's kernel worker, which runs
+ *   before any user process gets the CPU back: from the idle loop,
+ *   or after putting an interrupted process back on the run queue.
+ *   The worker lets pending interrupts in between items,
+ *   so slow work split into pieces doesn't hold up interrupts.
+ *
+ * PIOS has only one kernel stack per CPU, which cpu_cur() depends on,
+ * so the worker runs on that stack rather than as a separate thread.
+ *
+ * The time CPU 'i' spends in each context accumulates in
+ * irq_cycles, dpc_cycles and work_cycles of sysinfo_page->cpu[i].
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+
+#include <kern/cpu.h>
+#include <kern/mem.h>
+#include <kern/work.h>
+#include <kern/clock.h>
+#include <kern/timer.h>
+#include <kern/sysinfo.h>
+
+#include <dev/lapic.h>
+
+
+typedef struct workq {
+	work		*head;		// First item to run, or NULL
+	work		**tail;		// Last item's next pointer, if any
+} workq;
+
+static workq work_dpcq[CPU_MAX];	// Each CPU's pending DPCs
+static workq work_q[CPU_MAX];		// Each CPU's work queue
+
+
+static void
+work_enqueue(workq *q, work *w, void (*fn)(work *w), void *arg)
+{
+	assert(!(read_eflags() & FL_IF));
+	if (w->queued)
+		return;
+	w->fn = fn;
+	w->arg = arg;
+	w->next = NULL;
+	w->queued = 1;
+	if (q->head == NULL)
+		q->tail = &q->head;
+	*q->tail = w;
+	q->tail = &w->next;
+}
+
+static work *
+work_dequeue(workq *q)
+{
+	work *w = q->head;
+	if (w != NULL) {
+		q->head = w->next;
+		w->queued = 0;		// it may queue itself again
+	}
+	return w;
+}
+
+void
+dpc_queue(work *w, void (*fn)(work *w), void *arg)
+{
+	work_enqueue(&work_dpcq[cpu_cur()->id], w, fn, arg);
+}
+
+void
+dpc_run(void)
+{
+	cpu *c = cpu_cur();
+	workq *q = &work_dpcq[c->id];
+	if (q->head == NULL)
+		return;
+
+	sysinfo_cpu *sc = &sysinfo_page->cpu[c->id];
+	uint64_t t0 = rdtsc();
+	work *w;
+	while ((w = work_dequeue(q)) != NULL) {
+		w->fn(w);
+		sc->dpcs++;
+	}
+	sc->dpc_cycles += rdtsc() - t0;
+}
+
+void
+work_queue(work *w, void (*fn)(work *w), void *arg)
+{
+	work_enqueue(&work_q[cpu_cur()->id], w, fn, arg);
+}
+
+bool
+work_pending(cpu *c)
+{
+	return work_q[c->id].head != NULL;
+}
+
+void
+work_run(void)
+{
+	assert(!(read_eflags() & FL_IF));
+	cpu *c = cpu_cur();
+	assert(c->proc == NULL);
+	workq *q = &work_q[c->id];
+	sysinfo_cpu *sc = &sysinfo_page->cpu[c->id];
+
+	work *w;
+	while ((w = work_dequeue(q)) != NULL) {
+		uint64_t t0 = rdtsc();
+		w->fn(w);
+		sc->works++;
+		sc->work_cycles += rdtsc() - t0;
+
+		// Take any interrupts that came up meanwhile.
+		// STI takes effect only after the following instruction.
+		asm volatile("sti; nop; cli" : : : "memory");
+	}
+}
+
+
+#define WORK_CHECKNS		1000000		// 1ms
+#define WORK_CHECKPIECES	256		// Pieces of the slow job
+#define WORK_CHECKZEROS		16		// Page zeroings per piece
+
+static struct {
+	timer		irq;		// Starts things off from an interrupt
+	timer		poll;		// Interrupt we take during the job
+	work		dpc;
+	work		job;
+	void		*page;		// Page the job keeps zeroing
+	int		pieces;		// Pieces of the job done
+	int		pollpiece;	// Pieces done when 'poll' fired
+	uint64_t	polllat;	// How late 'poll' fired, in ns
+} work_checkst;
+
+static void
+work_check_poll(timer *t)
+{
+	work_checkst.polllat = clock_ns() - t->deadline;
+	work_checkst.pollpiece = work_checkst.pieces;
+}
+
+// The slow job: zero a page over and over, a piece at a time.
+static void
+work_check_piece(work *w)
+{
+	assert(w == &work_checkst.job);
+	if (work_checkst.pieces == 0)
+		timer_set(&work_checkst.poll, clock_ns() + WORK_CHECKNS/10,
+			work_check_poll, NULL);
+
+	int i;
+	for (i = 0; i < WORK_CHECKZEROS; i++)
+		memset(work_checkst.page, 0, PAGESIZE);
+	if (++work_checkst.pieces < WORK_CHECKPIECES)
+		work_queue(w, work_check_piece, NULL);
+}
+
+static void
+work_check_dpc(work *w)
+{
+	assert(w == &work_checkst.dpc && !w->queued);
+	work_queue(&work_checkst.job, work_check_piece, NULL);
+}
+
+static void
+work_check_irq(timer *t)
+{
+	// Defer the rest, twice: queue it again to check that's harmless.
+	dpc_queue(&work_checkst.dpc, work_check_dpc, NULL);
+	dpc_queue(&work_checkst.dpc, work_check_dpc, NULL);
+}
+
+void
+work_check(void)
+{
+	if (!lapic)
+		return;
+
+	cpu *c = cpu_cur();
+	sysinfo_cpu *sc = &sysinfo_page->cpu[c->id];
+	pageinfo *pi = mem_alloc();
+	assert(pi != NULL);
+	memset(&work_checkst, 0, sizeof(work_checkst));
+	work_checkst.page = mem_pi2ptr(pi);
+
+	// From a timer interrupt, through a DPC, to the worker.
+	uint64_t irq0 = sc->irq_cycles, dpc0 = sc->dpc_cycles;
+	uint64_t work0 = sc->work_cycles;
+	uint32_t ndpc0 = sc->dpcs, nwork0 = sc->works;
+	timer_set(&work_checkst.irq, clock_ns() + WORK_CHECKNS,
+		work_check_irq, NULL);
+	// Check before halting whether that's all: the last work_run()
+	// may have done the rest, leaving no timer to wake us up again.
+	while (1) {
+		work_run();
+		if (work_checkst.pieces == WORK_CHECKPIECES &&
+				!timer_pending(&work_checkst.poll))
+			break;
+		cpu_halt();
+	}
+	assert(!work_pending(c));
+	assert(sc->dpcs - ndpc0 == 1);
+	assert(sc->works - nwork0 == WORK_CHECKPIECES);
+	mem_free(pi);
+
+	cprintf("work_check: cycles in irq %lld dpc %lld work %lld; "
+		"timer %lldns late after %d of %d pieces\n",
+		sc->irq_cycles - irq0, sc->dpc_cycles - dpc0,
+		sc->work_cycles - work0, work_checkst.polllat,
+		work_checkst.pollpiece, WORK_CHECKPIECES);
+	cprintf("work_check() succeeded!\n");
+}
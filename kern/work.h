@@ -0,0 +1,58 @@
+/*
+ * Deferred kernel work: per-CPU work queues and deferred procedure calls.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_KERN_WORK_H
+#define PIOS_KERN_WORK_H
+#ifndef PIOS_KERNEL
+# error "This is a kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct cpu;
+
+// A unit of deferred work, normally embedded in the structure it is for.
+// The same structure serves as a deferred procedure call (dpc_queue)
+// or as a work queue item (work_queue), but only one at a time.
+typedef struct work {
+	struct work	*next;		// Next item on the same queue
+	void		(*fn)(struct work *w);	// Called to do the work
+	void		*arg;		// For use by fn
+	volatile bool	queued;		// On a queue and not yet started
+} work;
+
+
+// Queue a deferred procedure call on the current CPU, to run once
+// the interrupt handler queueing it is done, before we return from the
+// interrupt, with interrupts still disabled.  DPCs must be short:
+// they are for the part of an interrupt's work that needn't hold off
+// other interrupts, not for slow work.  Harmless if already queued.
+void dpc_queue(work *w, void (*fn)(work *w), void *arg);
+
+// Run the current CPU's pending DPCs, on the way out of an interrupt.
+void dpc_run(void);
+
+// Queue a work item on the current CPU's work queue,
+// to run in the CPU's kernel worker ahead of any user process.
+// A long job should do a piece at a time and re-queue itself,
+// so that interrupts and other work get a look in between the pieces.
+// Harmless if already queued; a running item may queue itself again.
+void work_queue(work *w, void (*fn)(work *w), void *arg);
+
+// Does CPU 'c' have work queued for its worker?
+bool work_pending(struct cpu *c);
+
+// Run the current CPU's worker until its work queue is empty.
+// Must be called with interrupts disabled, with no process running,
+// but lets pending interrupts in between work items.
+void work_run(void);
+
+// Check DPCs and work queues, and report how time splits between
+// interrupt handlers, DPCs and the worker.  Boot CPU only.
+void work_check(void);
+
+#endif /* !PIOS_KERN_WORK_H */
@@ -0,0 +1,29 @@
+/*
+ * Starting a child process running one of our own functions.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/string.h>
+#include <inc/syscall.h>
+
+
+void
+spawn(uint32_t flags, uint16_t child, procstate *ps, void *stacktop,
+	void (*fn)(int), int arg, void *localsrc, void *childdest, size_t size)
+{
+	procstate zero;
+	if (ps == NULL) {
+		memset(&zero, 0, sizeof(zero));
+		ps = &zero;
+	}
+
+	uint32_t *esp = stacktop;
+	*--esp = arg;		// argument
+	*--esp = 0;		// fake return address
+	ps->tf.eip = (uint32_t) fn;
+	ps->tf.esp = (uint32_t) esp;
+	sys_put(SYS_REGS | SYS_START | flags, child, ps,
+		localsrc, childdest, size);
+}
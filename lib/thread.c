@@ -0,0 +1,340 @@
+/*
+ * User-level ("green") threads, run M:N over a few kernel processes.
+ *
+ * Threads switch entirely in user mode, saving and restoring only
+ * the callee-saved registers and the stack pointer, so creating one
+ * or switching between two costs a few dozen instructions.
+ * The threads share one run queue, from which each virtual processor
+ * (a child process running thread_vpmain) takes the next thread to run.
+ * A thread that yields switches straight to the next one,
+ * without going through the virtual processor's scheduler loop.
+ *
+ * Virtual processors with nothing to run sleep on the futex thread_idle,
+ * which the kernel also uses as their upcall word (see procstate.upcall):
+ * when a thread blocks its virtual processor in the kernel,
+ * the kernel wakes an idle virtual processor to run the others.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/syscall.h>
+#include <inc/sysinfo.h>
+#include <inc/thread.h>
+
+
+static volatile uint32_t thread_qlock;	// Protects the run queue
+static thread *thread_qhead;		// Run queue, oldest first
+static thread **thread_qtail = &thread_qhead;
+
+static volatile uint32_t thread_nlive;	// Threads not yet exited
+static volatile uint32_t thread_idle;	// Bumped when there's work to do
+static volatile uint32_t thread_nidle;	// Virtual processors waiting for it
+
+static threadvp thread_vp[THREAD_MAXVP];
+static char thread_vpstack[THREAD_MAXVP][PAGESIZE] gcc_aligned(PAGESIZE);
+
+
+// Save the callee-saved registers on the current stack and the stack
+// pointer in *savesp, then switch to stack 'sp' and restore them from it.
+void thread_swtch(uint32_t *savesp, uint32_t sp);
+asm(	".text\n"
+	".globl thread_swtch\n"
+	"thread_swtch:\n"
+	"	movl	4(%esp),%eax\n"
+	"	movl	8(%esp),%edx\n"
+	"	pushl	%ebp\n"
+	"	pushl	%ebx\n"
+	"	pushl	%esi\n"
+	"	pushl	%edi\n"
+	"	movl	%esp,(%eax)\n"
+	"	movl	%edx,%esp\n"
+	"	popl	%edi\n"
+	"	popl	%esi\n"
+	"	popl	%ebx\n"
+	"	popl	%ebp\n"
+	"	ret\n");
+
+static gcc_inline threadvp *
+thread_curvp(void)
+{
+	threadvp *vp;
+	asm volatile("movl %%gs:4,%0" : "=r" (vp));
+	return vp;
+}
+
+static void
+thread_enqueue(thread *t)
+{
+	t->next = NULL;
+	while (xchg(&thread_qlock, 1) != 0)
+		pause();
+	*thread_qtail = t;
+	thread_qtail = &t->next;
+	xchg(&thread_qlock, 0);
+
+	// Wake an idle virtual processor, if any, to run it.
+	if (thread_nidle > 0) {
+		xadd(&thread_idle, 1);
+		sys_wake(&thread_idle, 1);
+	}
+}
+
+static thread *
+thread_dequeue(void)
+{
+	if (thread_qhead == NULL)
+		return NULL;
+	while (xchg(&thread_qlock, 1) != 0)
+		pause();
+	thread *t = thread_qhead;
+	if (t != NULL && (thread_qhead = t->next) == NULL)
+		thread_qtail = &thread_qhead;
+	xchg(&thread_qlock, 0);
+	return t;
+}
+
+// Finish a switch, in whatever context we switched to:
+// now that we're off the stack of the thread we switched from,
+// it's safe to let another virtual processor run it.
+static void
+thread_finish(void)
+{
+	threadvp *vp = thread_curvp();
+	thread *prev = vp->prev;
+	if (prev != NULL) {
+		vp->prev = NULL;
+		thread_enqueue(prev);
+	}
+}
+
+// Switch to thread 'to', or to the virtual processor's scheduler if NULL,
+// saving our stack pointer in *savesp.  If 'prev' isn't NULL,
+// it is the current thread, to go back on the run queue.
+static void
+thread_switch(uint32_t *savesp, thread *to, thread *prev)
+{
+	threadvp *vp = thread_curvp();
+	vp->prev = prev;
+	vp->cur = to;
+	thread_swtch(savesp, to != NULL ? to->sp : vp->sp);
+	thread_finish();	// we may be on another virtual processor now
+}
+
+static void gcc_noreturn
+thread_entry(void)
+{
+	thread_finish();
+	thread *t = thread_self();
+	t->fn(t->arg);
+	thread_exit();
+}
+
+void
+thread_create(thread *t, void *stack, size_t size,
+		void (*fn)(void *arg), void *arg)
+{
+	uint32_t *sp = (uint32_t*) ROUNDDOWN((uint32_t) stack + size, 16);
+	*--sp = 0;			// thread_entry's fake return address
+	*--sp = (uint32_t) thread_entry;	// where thread_swtch returns
+	*--sp = 0;			// ebp
+	*--sp = 0;			// ebx
+	*--sp = 0;			// esi
+	*--sp = 0;			// edi
+	t->sp = (uint32_t) sp;
+	t->fn = fn;
+	t->arg = arg;
+	t->local = NULL;
+
+	xadd(&thread_nlive, 1);
+	thread_enqueue(t);
+}
+
+void
+thread_yield(void)
+{
+	thread *next = thread_dequeue();
+	if (next == NULL)
+		return;		// nobody else to run
+	thread *self = thread_self();
+	thread_switch(&self->sp, next, self);
+}
+
+void gcc_noreturn
+thread_exit(void)
+{
+	// The last thread out tells all the virtual processors to stop.
+	if (xadd(&thread_nlive, -1) == 1) {
+		xadd(&thread_idle, 1);
+		sys_wake(&thread_idle, THREAD_MAXVP);
+	}
+
+	uint32_t sp;		// never used again
+	thread_switch(&sp, thread_dequeue(), NULL);
+	panic("thread_exit: exited thread resumed");
+}
+
+// What each virtual processor runs: its scheduler loop.
+static void gcc_noreturn
+thread_vpmain(int id)
+{
+	threadvp *vp = thread_curvp();
+	assert(vp == &thread_vp[id]);
+
+	while (1) {
+		thread *t = thread_dequeue();
+		if (t != NULL) {
+			thread_switch(&vp->sp, t, NULL);
+			continue;	// it exited or blocked
+		}
+		if (thread_nlive == 0)
+			break;
+
+		// Sleep until there's something to do: check again
+		// once we're counted as idle, so that we don't miss it.
+		xadd(&thread_nidle, 1);
+		uint32_t seq = thread_idle;
+		if (thread_qhead == NULL && thread_nlive != 0)
+			sys_wait(&thread_idle, seq);
+		xadd(&thread_nidle, -1);
+	}
+	while (1)
+		sys_ret();
+}
+
+void
+thread_run(int nvp)
+{
+	assert(nvp > 0 && nvp <= THREAD_MAXVP);
+
+	int i;
+	for (i = 0; i < nvp; i++) {
+		threadvp *vp = &thread_vp[i];
+		memset(vp, 0, sizeof(*vp));
+		vp->self = vp;
+		vp->id = i;
+
+		procstate ps;
+		memset(&ps, 0, sizeof(ps));
+		ps.tls = (uint32_t) vp;
+		ps.upcall = (uint32_t) &thread_idle;
+		spawn(0, i, &ps, &thread_vpstack[i][PAGESIZE], thread_vpmain, i,
+			NULL, NULL, 0);
+	}
+	for (i = 0; i < nvp; i++)
+		sys_get(0, i, NULL, NULL, NULL, 0);
+	assert(thread_nlive == 0 && thread_qhead == NULL);
+}
+
+
+#define THREAD_CHECKN		32	// Threads we create at once
+#define THREAD_CHECKYIELDS	1000	// Yields per thread
+#define THREAD_CHECKSTACK	1024	// Stack bytes per thread
+
+static thread thread_checkt[THREAD_CHECKN];
+static char thread_checkstack[THREAD_CHECKN][THREAD_CHECKSTACK]
+	gcc_aligned(16);
+static volatile uint32_t thread_checkcount[THREAD_CHECKN];
+static volatile uint32_t thread_checkword;	// Futex the sleeper waits on
+
+// Yield repeatedly, checking that we stay ourselves wherever we resume.
+static void
+thread_checkyielder(void *arg)
+{
+	int n = (int) arg;
+	thread *t = thread_self();
+	assert(t == &thread_checkt[n]);
+	t->local = arg;
+	int i;
+	for (i = 0; i < THREAD_CHECKYIELDS; i++) {
+		thread_checkcount[n]++;
+		thread_yield();
+		assert(thread_self() == t && t->local == arg);
+	}
+}
+
+// Block our virtual processor in the kernel until the waker wakes us.
+static void
+thread_checksleeper(void *arg)
+{
+	while (thread_checkword == 0)
+		sys_wait(&thread_checkword, 0);
+}
+
+// Wake the sleeper once it has blocked, which only happens
+// if another virtual processor takes over the rest of the threads.
+static void
+thread_checkwaker(void *arg)
+{
+	const volatile sysinfo *si = SYSINFO;
+	uint32_t up0 = (uint32_t) arg, up;
+	do {
+		thread_yield();
+		up = 0;
+		int i;
+		for (i = 0; i < si->ncpu; i++)
+			up += si->cpu[i].upcalls;
+	} while (up == up0);
+	thread_checkword = 1;
+	sys_wake(&thread_checkword, 1);
+}
+
+static uint32_t
+thread_checkns(const volatile sysinfo *si, uint64_t cycles)
+{
+	return cycles * 1000000000ULL / si->tsc_hz;
+}
+
+// Runs in user mode, as part of the root process.
+void
+thread_check(void)
+{
+	const volatile sysinfo *si = SYSINFO;
+	int i;
+
+	// Creation cost, with no virtual processors yet to wake.
+	uint64_t t0 = rdtsc();
+	for (i = 0; i < THREAD_CHECKN; i++)
+		thread_create(&thread_checkt[i], thread_checkstack[i],
+			THREAD_CHECKSTACK, thread_checkyielder, (void*) i);
+	uint64_t tcreate = (rdtsc() - t0) / THREAD_CHECKN;
+
+	// Switch cost: all threads yield round-robin on one virtual processor.
+	memset((void*) thread_checkcount, 0, sizeof(thread_checkcount));
+	t0 = rdtsc();
+	thread_run(1);
+	uint64_t tswitch = (rdtsc() - t0) / (THREAD_CHECKN*THREAD_CHECKYIELDS);
+	for (i = 0; i < THREAD_CHECKN; i++)
+		assert(thread_checkcount[i] == THREAD_CHECKYIELDS);
+
+	// Now spread them over more virtual processors than CPUs,
+	// with one thread blocking its virtual processor in the kernel.
+	uint32_t up0 = 0;
+	for (i = 0; i < si->ncpu; i++)
+		up0 += si->cpu[i].upcalls;
+	int nvp = MIN(si->ncpu + 1, THREAD_MAXVP);
+	thread_checkword = 0;
+	memset((void*) thread_checkcount, 0, sizeof(thread_checkcount));
+	thread_create(&thread_checkt[0], thread_checkstack[0],
+			THREAD_CHECKSTACK, thread_checksleeper, NULL);
+	thread_create(&thread_checkt[1], thread_checkstack[1],
+			THREAD_CHECKSTACK, thread_checkwaker, (void*) up0);
+	for (i = 2; i < THREAD_CHECKN; i++)
+		thread_create(&thread_checkt[i], thread_checkstack[i],
+			THREAD_CHECKSTACK, thread_checkyielder, (void*) i);
+	thread_run(nvp);
+	for (i = 2; i < THREAD_CHECKN; i++)
+		assert(thread_checkcount[i] == THREAD_CHECKYIELDS);
+	assert(thread_checkword == 1);
+
+	cprintf("thread_check: create %dns, switch %dns, "
+		"%d threads on %d virtual processors\n",
+		thread_checkns(si, tcreate), thread_checkns(si, tswitch),
+		THREAD_CHECKN, nvp);
+	cprintf("thread_check() succeeded!\n");
+}
@@ -0,0 +1,137 @@
+/*
+ * User-level trap handling support.
+ *
+ * A process whose parent gave it an exception handler (procstate.xeip)
+ * gets its own traps, such as page faults, as upcalls: the kernel pushes
+ * a utrapframe onto the process's exception stack and runs the handler,
+ * which can resume the trapping code with utrap_resume()
+ * without another trip through the kernel.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/assert.h>
+#include <inc/x86.h>
+#include <inc/mmu.h>
+#include <inc/vm.h>
+#include <inc/trap.h>
+#include <inc/syscall.h>
+
+
+// Put the trap-time EIP just below the trap-time stack pointer,
+// restore the general registers and EFLAGS straight from the utrapframe,
+// then switch to the trap-time stack and return to the EIP.
+asm(	".text\n"
+	".globl utrap_resume\n"
+	"utrap_resume:\n"
+	"	movl	4(%esp),%eax\n"		// utf
+	"	movl	52(%eax),%edx\n"	// utf->esp
+	"	subl	$4,%edx\n"
+	"	movl	44(%eax),%ecx\n"	// utf->eip
+	"	movl	%ecx,(%edx)\n"
+	"	movl	%edx,52(%eax)\n"
+	"	leal	12(%eax),%esp\n"	// utf->regs
+	"	popal\n"
+	"	addl	$4,%esp\n"		// skip utf->eip
+	"	popfl\n"
+	"	popl	%esp\n"
+	"	ret\n");
+
+
+#define UTRAP_CHECK_BASE	VM_USERLO	// Region we write-protect
+#define UTRAP_CHECK_PAGES	4
+#define UTRAP_CHECK_TRAPS	1000		// Breakpoints to time
+
+static char utrap_check_stack[PAGESIZE] gcc_aligned(PAGESIZE);
+static char utrap_check_xstack[PAGESIZE] gcc_aligned(PAGESIZE);
+static volatile int utrap_check_npgflt, utrap_check_nbrkpt;
+static volatile uint32_t utrap_check_dirty;	// Pages written, one bit each
+static volatile uint64_t utrap_check_cycles;
+
+static void gcc_noreturn
+utrap_check_handler(utrapframe *utf)
+{
+	assert(read_esp() < (uint32_t) &utrap_check_xstack[PAGESIZE]);
+	assert(read_esp() > (uint32_t) &utrap_check_xstack[0]);
+
+	switch (utf->trapno) {
+	case T_BRKPT:
+		utrap_check_nbrkpt++;
+		break;
+	case T_PGFLT: {
+		// A write barrier, as a garbage collector might use:
+		// note which page got written, and let the write go ahead.
+		uint32_t va = ROUNDDOWN(utf->fva, PAGESIZE);
+		assert(utf->err & PFE_WR);
+		assert(va >= UTRAP_CHECK_BASE &&
+			va < UTRAP_CHECK_BASE + UTRAP_CHECK_PAGES*PAGESIZE);
+		utrap_check_dirty |= 1 << ((va - UTRAP_CHECK_BASE) / PAGESIZE);
+		utrap_check_npgflt++;
+		sys_get(SYS_PERM | SYS_RW, 0, NULL, NULL, (void*) va, PAGESIZE);
+		break;
+		}
+	default:
+		panic("utrap_check: unexpected trap %d", utf->trapno);
+	}
+	utrap_resume(utf);
+}
+
+static void gcc_noreturn
+utrap_check_child(int n)
+{
+	volatile uint8_t *p = (uint8_t*) UTRAP_CHECK_BASE;
+	int i;
+
+	// The first write to each page traps, and then gets done.
+	for (i = 0; i < UTRAP_CHECK_PAGES; i++)
+		p[i*PAGESIZE + 1] = i + 1;
+	assert(utrap_check_npgflt == UTRAP_CHECK_PAGES);
+	assert(utrap_check_dirty == (1 << UTRAP_CHECK_PAGES) - 1);
+	for (i = 0; i < UTRAP_CHECK_PAGES; i++)
+		p[i*PAGESIZE + 2] = i + 2;
+	assert(utrap_check_npgflt == UTRAP_CHECK_PAGES);
+	for (i = 0; i < UTRAP_CHECK_PAGES; i++)
+		assert(p[i*PAGESIZE + 1] == i + 1 && p[i*PAGESIZE + 2] == i + 2);
+
+	// A breakpoint's upcall resumes right after it, registers intact.
+	uint32_t a, b;
+	asm volatile("int3" : "=a" (a), "=b" (b) : "a" (0x12345678), "b" (n));
+	assert(a == 0x12345678 && b == n && utrap_check_nbrkpt == 1);
+
+	// How long does a round trip through the handler take?
+	uint64_t t0 = rdtsc();
+	for (i = 0; i < UTRAP_CHECK_TRAPS; i++)
+		asm volatile("int3");
+	utrap_check_cycles = (rdtsc() - t0) / UTRAP_CHECK_TRAPS;
+	assert(utrap_check_nbrkpt == 1 + UTRAP_CHECK_TRAPS);
+
+	while (1)
+		sys_ret();
+}
+
+// Runs in user mode, as part of the root process.
+void
+utrap_check(void)
+{
+	procstate ps;
+	memset(&ps, 0, sizeof(ps));
+	ps.xeip = (uint32_t) utrap_check_handler;
+	ps.xesp = (uint32_t) &utrap_check_xstack[PAGESIZE];
+
+	// Give the child a zeroed, read-only region to write to.
+	utrap_check_npgflt = utrap_check_nbrkpt = 0;
+	utrap_check_dirty = 0;
+	spawn(SYS_ZERO | SYS_PERM | SYS_READ, 0, &ps,
+		&utrap_check_stack[PAGESIZE], utrap_check_child, 0,
+		NULL, (void*) UTRAP_CHECK_BASE, PTSIZE);
+	sys_get(SYS_REGS, 0, &ps, NULL, NULL, 0);
+	assert(ps.tf.trapno == T_SYSCALL);	// it returned, not trapped
+
+	cprintf("utrap_check: %d write barrier faults, "
+		"breakpoint round trip %d cycles\n",
+		utrap_check_npgflt, (int) utrap_check_cycles);
+	cprintf("utrap_check() succeeded!\n");
+}
@@ -25,7 +25,9 @@ echo_n () {
 	awk 'BEGIN { printf("'"$*"'"); }' </dev/null
 }
 
-# Run QEMU with serial output redirected to grade-out.  If $brkfn is
+# Run QEMU with console output redirected to grade-out: the debug console,
+# where the kernel writes it when there is one, and the serial port,
+# where trace dumps go (kern/trace.c).  If $brkfn is
 # non-empty, wait until $brkfn is reached or $timeout expires, then
 # kill QEMU.
 run () {
@@ -39,7 +41,9 @@ run () {
 	t0=`date +%s.%N 2>/dev/null`
 	(
 		ulimit -t $timeout
-		exec $qemu -nographic $qemuopts -serial stdio -monitor null \
+		exec $qemu -nographic $qemuopts \
+			-chardev stdio,id=cons,mux=on -serial chardev:cons \
+			-debugcon chardev:cons -monitor null \
 			-no-reboot $qemuextra
 	) <$in >grade-out 2>$err &
 	PID=$!
@@ -108,3 +112,37 @@ grmltest () {
 	fi
 }
 
+
+# Check the kernel's boot timeline for regressions.  The kernel prints
+# a line "boottime: <phase> <end> <duration>" (in microseconds) for each
+# phase of booting; boottimetest saves the phases and their durations
+# in grade-boottime and compares them with those in $boottime_base,
+# failing if any phase of at least $boottime_min microseconds got more
+# than $boottime_slack percent slower.  With no $boottime_base yet,
+# it makes this run's timeline the baseline: delete it to start over.
+boottime_base=grade-boottime.base
+boottime_slack=50
+boottime_min=1000
+
+boottimetest () {
+	echo_n "$1"
+	grep '^boottime: ' grade-out | awk '{ print $2, $4 }' >grade-boottime
+	if [ ! -s grade-boottime ]; then
+		fail "no boot timeline"
+	elif [ ! -f "$boottime_base" ]; then
+		cp grade-boottime "$boottime_base"
+		pass "saved as baseline in $boottime_base"
+	else
+		slow=`awk -v slack=$boottime_slack -v min=$boottime_min '
+			NR == FNR { base[$1] = $2; next }
+			($1 in base) && $2 >= min &&
+					$2 * 100 > base[$1] * (100 + slack) {
+				printf(" %s %dus->%dus", $1, base[$1], $2)
+			}' "$boottime_base" grade-boottime`
+		if [ "$slow" ]; then
+			fail "slower:$slow"
+		else
+			pass
+		fi
+	fi
+}
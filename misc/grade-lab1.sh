@@ -14,6 +14,7 @@ pts=15; greptest "Backtrace: " "debug_check() succeeded!"
 pts=25; greptest "Traps:     " "trap_check_kernel() succeeded!"
 pts=25; greptest "User mode: " "trap_check_user() succeeded!"
 pts=25; greptest "Memory:    " "mem_check() succeeded!"
+pts=0;  boottimetest "Boot time: "
 
 echo "Score: $score/100"
 
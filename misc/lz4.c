@@ -0,0 +1,104 @@
+/*
+ * Greedy compressor for the LZ4 block format (described in inc/initrd.h),
+ * for build-host tools: quick to write and, more to the point,
+ * very quick for the kernel to decompress.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <string.h>
+#include <stdint.h>
+
+#include "misc/lz4.h"
+
+
+#define HASHBITS	14		// Size of the match finder's table
+#define MINMATCH	4		// Shortest match LZ4 can encode
+#define LASTLITS	5		// Bytes at the end that must be literals
+#define MFLIMIT		12		// No match may start this near the end
+#define MAXOFF		65535		// Farthest back a match can be
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t
+hash32(uint32_t v)
+{
+	return (v * 2654435761U) >> (32 - HASHBITS);
+}
+
+// Append a length's continuation bytes, after a nibble of 15.
+static size_t
+putlen(uint8_t *dst, size_t len)
+{
+	size_t n = 0;
+	for (; len >= 255; len -= 255)
+		dst[n++] = 255;
+	dst[n++] = len;
+	return n;
+}
+
+// Append one sequence: 'nlit' literals, then a match of 'mlen' bytes
+// 'off' bytes back, or no match if 'mlen' is 0 (the last sequence).
+// Returns false if it won't fit before 'cap'.
+static int
+putseq(uint8_t *dst, size_t *op, size_t cap, const uint8_t *lit,
+	size_t nlit, size_t off, size_t mlen)
+{
+	if (*op + 1 + nlit/255 + 1 + nlit + 2 + mlen/255 + 1 > cap)
+		return 0;
+	uint8_t *token = &dst[(*op)++];
+	*token = (nlit >= 15 ? 15 : nlit) << 4;
+	if (nlit >= 15)
+		*op += putlen(&dst[*op], nlit - 15);
+	memcpy(&dst[*op], lit, nlit);
+	*op += nlit;
+	if (mlen == 0)
+		return 1;
+
+	dst[(*op)++] = off;
+	dst[(*op)++] = off >> 8;
+	mlen -= MINMATCH;
+	*token |= mlen >= 15 ? 15 : mlen;
+	if (mlen >= 15)
+		*op += putlen(&dst[*op], mlen - 15);
+	return 1;
+}
+
+// Compress 'n' bytes into at most 'cap' bytes at 'dst'.
+// Returns the compressed size, or 0 if it doesn't fit.
+size_t
+lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+	int table[1 << HASHBITS];
+	memset(table, -1, sizeof(table));
+
+	size_t ip = 0, anchor = 0, op = 0;
+	while (n >= MFLIMIT && ip < n - MFLIMIT) {
+		uint32_t h = hash32(read32(&src[ip]));
+		int ref = table[h];
+		table[h] = ip;
+		if (ref < 0 || ip - ref > MAXOFF ||
+				read32(&src[ref]) != read32(&src[ip])) {
+			ip++;
+			continue;
+		}
+		size_t len = MINMATCH;
+		while (ip + len < n - LASTLITS && src[ref + len] == src[ip + len])
+			len++;
+		if (!putseq(dst, &op, cap, &src[anchor], ip - anchor,
+				ip - ref, len))
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+	if (!putseq(dst, &op, cap, &src[anchor], n - anchor, 0, 0))
+		return 0;
+	return op;
+}
@@ -0,0 +1,18 @@
+/*
+ * LZ4 block compressor for build-host tools (see misc/lz4.c).
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#ifndef PIOS_MISC_LZ4_H
+#define PIOS_MISC_LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Compress 'n' bytes at 'src' into at most 'cap' bytes at 'dst'.
+// Returns the compressed size, or 0 if it doesn't fit.
+size_t lz4_compress(const uint8_t *src, size_t n, uint8_t *dst, size_t cap);
+
+#endif /* !PIOS_MISC_LZ4_H */
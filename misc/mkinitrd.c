@@ -0,0 +1,125 @@
+/*
+ * Build-host tool to pack files into a compressed initial ramdisk
+ * for linking into the kernel (see inc/initrd.h and kern/initrd.c).
+ *
+ * Usage: mkinitrd <archive> <name>=<path>...
+ *
+ * Each page of each file is compressed on its own (see misc/lz4.c).
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "inc/initrd.h"
+#include "misc/lz4.h"
+
+
+static void
+die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "mkinitrd: %s%s\n", msg, arg);
+	exit(1);
+}
+
+static uint8_t *
+readfile(const char *path, size_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		die("can't open ", path);
+	size_t cap = 65536, n = 0;
+	uint8_t *buf = malloc(cap);
+	size_t got;
+	while (buf != NULL && (got = fread(buf + n, 1, cap - n, f)) > 0)
+		if ((n += got) == cap)
+			buf = realloc(buf, cap *= 2);
+	if (buf == NULL)
+		die("out of memory reading ", path);
+	fclose(f);
+	*size = n;
+	return buf;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2)
+		die("usage: mkinitrd <archive> <name>=<path>...", "");
+	int nfiles = argc - 2;
+
+	// Lay out the header and file table, then append each file's
+	// block table and blocks, patching up the block table as we go.
+	size_t cap = 1 << 20, len = sizeof(initrd_hdr) +
+			nfiles * sizeof(initrd_file);
+	uint8_t *ar = calloc(1, cap);
+	if (ar == NULL)
+		die("out of memory", "");
+	initrd_hdr hdr = { INITRD_MAGIC, nfiles };
+	memcpy(ar, &hdr, sizeof(hdr));
+
+	size_t total = 0;
+	int i;
+	for (i = 0; i < nfiles; i++) {
+		char *name = argv[2 + i], *path = strchr(name, '=');
+		if (path == NULL)
+			die("expected <name>=<path>: ", name);
+		*path++ = 0;
+		if (strlen(name) >= INITRD_NAMELEN)
+			die("name too long: ", name);
+
+		size_t size;
+		uint8_t *data = readfile(path, &size);
+		size_t nblocks = (size + INITRD_BLOCK - 1) / INITRD_BLOCK;
+
+		initrd_file fe;
+		memset(&fe, 0, sizeof(fe));
+		strcpy(fe.name, name);
+		fe.size = size;
+		fe.blocks = len;
+		fe.sum = INITRD_FNVBASIS;
+		size_t j;
+		for (j = 0; j < size; j++)
+			fe.sum = (fe.sum ^ data[j]) * INITRD_FNVPRIME;
+		memcpy(ar + sizeof(hdr) + i * sizeof(fe), &fe, sizeof(fe));
+
+		size_t tab = len;
+		len += (nblocks + 1) * sizeof(uint32_t);
+		for (j = 0; j <= nblocks; j++) {
+			while (len + INITRD_BLOCK + 4 > cap) {
+				ar = realloc(ar, cap *= 2);
+				if (ar == NULL)
+					die("out of memory", "");
+			}
+			uint32_t off = len;
+			memcpy(ar + tab + j * 4, &off, 4);
+			if (j == nblocks)
+				break;
+
+			// Store a block as is if it doesn't get any smaller.
+			const uint8_t *blk = data + j * INITRD_BLOCK;
+			size_t n = size - j * INITRD_BLOCK;
+			if (n > INITRD_BLOCK)
+				n = INITRD_BLOCK;
+			size_t c = lz4_compress(blk, n, ar + len, n - 1);
+			if (c == 0) {
+				memcpy(ar + len, blk, n);
+				c = n;
+			}
+			len += c;
+		}
+		total += size;
+		free(data);
+	}
+
+	FILE *f = fopen(argv[1], "wb");
+	if (f == NULL || fwrite(ar, 1, len, f) != len || fclose(f) != 0)
+		die("can't write ", argv[1]);
+	printf("mkinitrd: %d files, %lu bytes packed into %lu\n",
+		nfiles, (unsigned long) total, (unsigned long) len);
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * Build-host tool to decode the binary event traces the kernel dumps
+ * to the serial port (see inc/trace.h and kern/trace.c).
+ *
+ * Usage: tracedump [-j] <kernel.sym> <serial output>
+ *
+ * Finds each trace dump in the serial output, among whatever console
+ * text surrounds it, and prints its events in time order, one per line:
+ *
+ *	<microseconds> cpu<n> <event> <args>
+ *
+ * or with -j, as Chrome trace event JSON, for chrome://tracing.
+ * Events are named from the kernel's symbol table (obj/kern/kernel.sym),
+ * and arguments that point into kernel code as the function they're in.
+ *
+ * Copyright (C) 2010 Yale University.
+ * See section "MIT License" in the file LICENSES for licensing terms.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "inc/trace.h"
+
+
+typedef struct sym {
+	uint32_t	addr;
+	char		type;
+	char		*name;
+} sym;
+
+static sym *syms;
+static size_t nsyms;
+static uint32_t etext;			// End of kernel code, roughly
+static int nevents;			// Events printed so far
+
+
+static void
+die(const char *msg, const char *arg)
+{
+	fprintf(stderr, "tracedump: %s%s\n", msg, arg);
+	exit(1);
+}
+
+static uint8_t *
+readfile(const char *path, size_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	if (f == NULL)
+		die("can't open ", path);
+	size_t cap = 65536, n = 0;
+	uint8_t *buf = malloc(cap);
+	size_t got;
+	while (buf != NULL && (got = fread(buf + n, 1, cap - n, f)) > 0)
+		if ((n += got) == cap)
+			buf = realloc(buf, cap *= 2);
+	if (buf == NULL)
+		die("out of memory reading ", path);
+	fclose(f);
+	*size = n;
+	return buf;
+}
+
+// Read the symbol table nm -n wrote, already sorted by address.
+static void
+readsyms(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		die("can't open ", path);
+	size_t cap = 1024;
+	syms = malloc(cap * sizeof(sym));
+	char line[512], name[512], type;
+	unsigned addr;
+	while (syms != NULL && fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "%x %c %511s", &addr, &type, name) != 3)
+			continue;	// undefined symbols have no address
+		if (nsyms == cap)
+			syms = realloc(syms, (cap *= 2) * sizeof(sym));
+		if (syms == NULL)
+			break;
+		syms[nsyms].addr = addr;
+		syms[nsyms].type = type;
+		syms[nsyms++].name = strdup(name);
+		if (strcmp(name, "etext") == 0)
+			etext = addr;
+	}
+	if (syms == NULL)
+		die("out of memory reading ", path);
+	fclose(f);
+
+	// Without an etext symbol, code ends where the next symbol after it is.
+	size_t i;
+	for (i = 0; etext == 0 && i + 1 < nsyms; i++)
+		if ((syms[i].type == 'T' || syms[i].type == 't') &&
+				syms[i+1].type != 'T' && syms[i+1].type != 't')
+			etext = syms[i+1].addr;
+}
+
+// The symbol at exactly 'addr', or NULL.
+static const char *
+symat(uint32_t addr)
+{
+	size_t lo = 0, hi = nsyms;
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (syms[mid].addr < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < nsyms && syms[lo].addr == addr; lo++)
+		if (strncmp(syms[lo].name, "trace_", 6) == 0)
+			return syms[lo].name + 6;
+	return NULL;
+}
+
+// Format 'val' as "func+off" if it points into kernel code, else in hex.
+static void
+fmtarg(char *buf, size_t size, uint32_t val)
+{
+	const sym *best = NULL;
+	size_t i;
+	if (val < etext)
+		for (i = 0; i < nsyms && syms[i].addr <= val; i++)
+			if (syms[i].type == 'T' || syms[i].type == 't')
+				best = &syms[i];
+	if (best != NULL)
+		snprintf(buf, size, "%s+0x%x", best->name, val - best->addr);
+	else
+		snprintf(buf, size, "0x%x", val);
+}
+
+static int
+cmprec(const void *a, const void *b)
+{
+	const tracerec *x = a, *y = b;
+	return x->tsc < y->tsc ? -1 : x->tsc > y->tsc;
+}
+
+// Print the events in the dump with header 'hdr' and records 'recs'.
+static void
+decode(const tracehdr *hdr, tracerec *recs, int json)
+{
+	qsort(recs, hdr->nrec, sizeof(tracerec), cmprec);
+	uint64_t base = hdr->nrec ? recs[0].tsc : 0;
+	double hz = hdr->tsc_hz ? (double) hdr->tsc_hz : 1e9;
+	uint32_t i;
+	int j;
+	for (i = 0; i < hdr->nrec; i++) {
+		const tracerec *r = &recs[i];
+		double us = (r->tsc - base) * 1e6 / hz;
+		char unknown[32];
+		const char *name = symat(r->event);
+		if (name == NULL) {
+			snprintf(unknown, sizeof(unknown), "0x%x", r->event);
+			name = unknown;
+		}
+		char args[TRACE_NARGS][256];
+		for (j = 0; j < TRACE_NARGS; j++)
+			fmtarg(args[j], sizeof(args[j]), r->arg[j]);
+
+		if (!json) {
+			printf("%14.3f cpu%d %-10s", us, r->cpu, name);
+			for (j = 0; j < TRACE_NARGS; j++)
+				printf(" %s", args[j]);
+			printf("\n");
+			continue;
+		}
+		printf("%s{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+			"\"ts\":%.3f,\"pid\":0,\"tid\":%d,\"args\":{",
+			nevents++ ? ",\n" : "", name, us, r->cpu);
+		for (j = 0; j < TRACE_NARGS; j++)
+			printf("%s\"a%d\":\"%s\"", j ? "," : "", j, args[j]);
+		printf("}}");
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	int json = argc > 1 && strcmp(argv[1], "-j") == 0;
+	if (argc != 3 + json)
+		die("usage: tracedump [-j] <kernel.sym> <serial output>", "");
+	readsyms(argv[1 + json]);
+	size_t size;
+	uint8_t *out = readfile(argv[2 + json], &size);
+
+	// Look for each dump's header, and take it if its tail checks out.
+	if (json)
+		printf("{\"traceEvents\":[\n");
+	int ndumps = 0;
+	size_t off;
+	for (off = 0; off + sizeof(tracehdr) <= size; off++) {
+		tracehdr hdr;
+		memcpy(&hdr, out + off, sizeof(hdr));
+		if (hdr.magic != TRACE_MAGIC ||
+				size - off < sizeof(hdr) + sizeof(tracetail) ||
+				hdr.nrec > (size - off - sizeof(hdr) -
+					sizeof(tracetail)) / sizeof(tracerec))
+			continue;
+		size_t len = hdr.nrec * sizeof(tracerec);
+		const uint8_t *p = out + off + sizeof(hdr);
+		tracetail tail;
+		memcpy(&tail, p + len, sizeof(tail));
+		uint32_t sum = TRACE_FNVBASIS;
+		size_t i;
+		for (i = 0; i < len; i++)
+			sum = (sum ^ p[i]) * TRACE_FNVPRIME;
+		if (tail.magic != TRACE_ENDMAGIC || tail.sum != sum)
+			continue;
+
+		tracerec *recs = malloc(len + 1);
+		if (recs == NULL)
+			die("out of memory", "");
+		memcpy(recs, p, len);
+		if (!json)
+			printf("trace dump %d: %u records\n", ndumps, hdr.nrec);
+		decode(&hdr, recs, json);
+		free(recs);
+		ndumps++;
+		off += sizeof(hdr) + len + sizeof(tail) - 1;
+	}
+	if (json)
+		printf("\n]}\n");
+	if (ndumps == 0)
+		die("no trace dumps found in ", argv[2 + json]);
+	return 0;
+}